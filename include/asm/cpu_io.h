@@ -24,6 +24,16 @@ static inline uint16_t inw(uint16_t port) {
     return ret;
 }
 
+static inline void outl(uint16_t port, uint32_t value) {
+    asm volatile ("outl %0, %1" : : "a"(value), "Nd"(port));
+}
+
+static inline uint32_t inl(uint16_t port) {
+    uint32_t ret;
+    asm volatile ("inl %1, %0" : "=a"(ret) : "Nd"(port));
+    return ret;
+}
+
 static inline void rep_insw(uint16_t port, void *addr, uint32_t count) {
     asm volatile ("rep insw" : "+D"(addr), "+c"(count) : "d"(port) : "memory");
 }
@@ -4,8 +4,26 @@
 #include <asm/cpu_io.h>
 #include <flags.h>
 
-void ata_read_sectors(uint32_t lba, uint32_t sector_count, const uint8_t* buffer);
-void ata_write_sectors(uint32_t lba, uint32_t sector_count, const uint8_t* buffer);
+// looks for a bus master IDE controller, transfers go through DMA from then on when the drive allows it
+void ata_init();
+// commands complete through IRQ14 from then on, the caller halts until the drive is done instead of polling it
+void ata_irq_install();
+// LBA48 when the drive has it, requests larger than a command can take are split
+void ata_read_sectors(uint64_t lba, uint32_t sector_count, const uint8_t* buffer);
+void ata_write_sectors(uint64_t lba, uint32_t sector_count, const uint8_t* buffer);
+
+// a piece of memory in a transfer, the pieces follow each other on disk and each holds at least one sector
+typedef struct {
+    const uint8_t* buffer;
+    uint32_t sector_count;
+} AtaSegment;
+
+// moves the segments as one run of sectors from `lba` on, with a single command where the drive allows
+void ata_read_segments(uint64_t lba, const AtaSegment* segments, uint32_t segment_count);
+void ata_write_segments(uint64_t lba, const AtaSegment* segments, uint32_t segment_count);
+
+// write barrier, returns once every sector written so far is on the media, writes may sit in the drive's cache until then
+void ata_flush();
 void ata_read_buffer(uint16_t* buffer);
 uint64_t ata_get_disk_size();
 void ata_read_blocks(uint32_t block_num, const uint8_t* buffer, uint32_t count);
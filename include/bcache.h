@@ -0,0 +1,181 @@
+#ifndef BCACHE_H
+#define BCACHE_H
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <flags.h>
+#include <blkq.h>
+
+#define BCACHE_BLOCKS 64        // number of blocks held in memory
+#define BCACHE_BUCKETS 64       // hash buckets, must be a power of 2
+#define BCACHE_BATCH_BLOCKS 8   // most blocks moved by a single transfer when merging
+
+// when a dirty block may be written back
+#define BCACHE_UNJOURNALED 0    // whenever it is recycled or flushed
+#define BCACHE_RUNNING 1        // logged by the running transaction, kept off the disk until it commits
+#define BCACHE_COMMITTED 2      // safe in the journal, its home copy can wait
+#define BCACHE_DELAYED 3        // file data with no block picked yet, held until `bcache_rekey` gives it one
+
+/**
+ * @brief A disk block held in memory.
+ *
+ * Blocks are found through a hash on `block_num` and recycled in least recently
+ * used order. A block with a non-zero `refcount` is pinned and never recycled,
+ * so `data` stays valid between `bcache_read`/`bcache_get` and `bcache_release`.
+ * Blocks of the running journal transaction and delayed blocks aren't recycled either.
+ *
+ * Metadata blocks are made of records, each ending up with a CRC-32C of itself
+ * in a checksum field, see `bcache_set_checksum`. The cache seals them on the
+ * way to the disk, checking them on the way in is left to the owner of the
+ * block, which knows which records are in use.
+ */
+typedef struct CacheBlock {
+	uint32_t block_num;
+	bool valid;                    // data holds the contents of block_num
+	bool dirty;                    // data is newer than the disk
+	uint8_t writeback;             // one of BCACHE_UNJOURNALED, BCACHE_RUNNING, BCACHE_COMMITTED, BCACHE_DELAYED
+	uint16_t refcount;             // pinned while non-zero
+	bool unchecked;                // read from disk, its checksums not looked at yet
+	uint16_t checksum_stride;      // bytes per checksummed record, 0 for blocks without checksums
+	uint16_t checksum_offset;      // of the checksum field within each record
+	struct CacheBlock* hash_next;  // next block in the same bucket
+	struct CacheBlock* lru_prev;   // towards the most recently used
+	struct CacheBlock* lru_next;   // towards the least recently used
+	uint8_t* data;                 // BLOCK_BYTES of block contents
+	BlockRequest io;               // reads and writes of the block through the request queue
+} CacheBlock;
+
+/**
+ * @brief Empties the cache, dropping every block without writing it back.
+ */
+void bcache_init();
+
+/**
+ * @brief Returns the block pinned in the cache, reading it from disk on a miss.
+ *
+ * @param block_num The block to read.
+ * @return The cached block, must be handed back with `bcache_release`.
+ */
+CacheBlock* bcache_read(uint32_t block_num);
+
+/**
+ * @brief Returns the block pinned in the cache without reading it from disk.
+ *
+ * For callers about to overwrite the whole block, check `valid` before relying
+ * on the previous contents.
+ *
+ * @param block_num The block to get.
+ * @return The cached block, must be handed back with `bcache_release`.
+ */
+CacheBlock* bcache_get(uint32_t block_num);
+
+/**
+ * @brief Returns the block if it is cached, without pinning it or going to the disk.
+ *
+ * For callers that can't afford a buffer being recycled to make room, the
+ * block is only safe to use until the cache next hands out a buffer.
+ *
+ * @param block_num The block to look for.
+ * @return The cached block, NULL on a miss, check `valid` before reading it.
+ */
+CacheBlock* bcache_lookup(uint32_t block_num);
+
+/**
+ * @brief Unpins a block returned by `bcache_read` or `bcache_get`.
+ */
+void bcache_release(CacheBlock* block);
+
+/**
+ * @brief Finds the cached block whose data holds `ptr`.
+ *
+ * Lets callers handed a pointer into a pinned block release or dirty it
+ * without keeping the block around too.
+ */
+CacheBlock* bcache_block_of(const void* ptr);
+
+/**
+ * @brief Marks a pinned block as modified, to be written back later.
+ *
+ * Clears `unchecked`, the contents are now the caller's.
+ */
+void bcache_mark_dirty(CacheBlock* block);
+
+/**
+ * @brief Gives a pinned block its checksum layout, used to seal it whenever it is written out.
+ *
+ * The layout lasts until the block leaves the cache or is discarded.
+ *
+ * @param block The block.
+ * @param stride Size of each record, BLOCK_BYTES for a block with a single checksum.
+ * @param offset Where the 32 bit checksum field sits in each record.
+ */
+void bcache_set_checksum(CacheBlock* block, uint16_t stride, uint16_t offset);
+
+/**
+ * @brief Stores the checksum of every record of the block, following its checksum layout.
+ *
+ * Done by the cache itself before a block goes home, and by the journal
+ * before it logs one.
+ */
+void bcache_seal(CacheBlock* block);
+
+/**
+ * @brief Marks a pinned block as filled in by the caller, with nothing to write back.
+ *
+ * For blocks named past the disk whose contents are derived from other
+ * blocks, such as decompressed file data.
+ */
+void bcache_mark_valid(CacheBlock* block);
+
+/**
+ * @brief Marks a pinned block as holding data that has no place on disk yet.
+ *
+ * `block_num` of a delayed block is only a name, the block stays in the cache
+ * until `bcache_rekey` moves it to a real block or it is discarded.
+ */
+void bcache_mark_delayed(CacheBlock* block);
+
+/**
+ * @brief Moves a delayed block to the disk block picked for it, to be written back from there.
+ *
+ * @param block The delayed block, pinned.
+ * @param block_num The disk block it now belongs to.
+ */
+void bcache_rekey(CacheBlock* block, uint32_t block_num);
+
+/**
+ * @brief Brings a run of blocks into the cache.
+ *
+ * Blocks missing from the cache are queued and read straight into their
+ * buffers, the queue merging each run of them into a single transfer.
+ * Blocks already cached are left alone.
+ *
+ * @param block_num The first block of the run.
+ * @param count The number of blocks in the run.
+ */
+void bcache_prefetch(uint32_t block_num, uint32_t count);
+
+/**
+ * @brief Drops a run of blocks from the cache without writing them back.
+ *
+ * Used when blocks are freed, so their stale contents never reach the disk.
+ *
+ * @param block_num The first block of the run.
+ * @param count The number of blocks in the run.
+ */
+void bcache_discard(uint32_t block_num, uint32_t count);
+
+/**
+ * @brief Writes every dirty block back to disk, except those of the running journal transaction and delayed blocks.
+ *
+ * Dirty blocks go through the request queue, which writes them in block
+ * order with adjacent blocks merged into a single transfer.
+ */
+void bcache_flush();
+
+/**
+ * @brief Writes back the dirty blocks the journal doesn't know about, file data in practice.
+ */
+void bcache_flush_data();
+
+#endif // BCACHE_H
@@ -0,0 +1,54 @@
+#ifndef BLKQ_H
+#define BLKQ_H
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <flags.h>
+
+#define BLKQ_DEPTH 64           // queued requests that make `blkq_submit` dispatch them on its own
+#define BLKQ_MERGE_MAX 64       // most requests merged into a single command
+
+/**
+ * @brief A read or write of a run of blocks, queued with `blkq_submit`.
+ *
+ * The request belongs to the caller, which keeps it and its buffer alive until
+ * `done` has been called. The queue links requests through `next`.
+ */
+typedef struct BlockRequest {
+	uint32_t block_num;
+	uint32_t count;             // blocks
+	uint8_t* buffer;            // count * BLOCK_BYTES
+	bool write;
+	void (*done)(struct BlockRequest* request); // called once the blocks are moved, may be NULL
+	void* owner;                // for `done` to find its way back
+	struct BlockRequest* next;
+} BlockRequest;
+
+/**
+ * @brief Queues a request, it goes out with the next `blkq_unplug`.
+ *
+ * The queue is kept sorted by block. A request touching blocks a queued write
+ * touches, or writing blocks a queued request touches, unplugs the queue first
+ * so the two never trade places. A full queue unplugs on its own.
+ */
+void blkq_submit(BlockRequest* request);
+
+/**
+ * @brief Sends every queued request to the disk and completes it.
+ *
+ * Requests go out in one sweep across the disk from where the last command
+ * ended, wrapping around to the lowest block. Requests in the same direction
+ * covering consecutive blocks are merged into a single command, each keeping
+ * its own buffer. `done` of each request runs once its command finished.
+ *
+ * Nothing reaches the disk before this, so submitters unplug before they rely
+ * on the blocks or issue a write barrier.
+ */
+void blkq_unplug();
+
+/**
+ * @brief Requests queued and waiting for `blkq_unplug`.
+ */
+uint32_t blkq_pending();
+
+#endif // BLKQ_H
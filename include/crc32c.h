@@ -0,0 +1,47 @@
+#ifndef CRC32C_H
+#define CRC32C_H
+
+#include <stdint.h>
+#include <stdbool.h>
+
+// CRC-32C (Castagnoli), the polynomial of the SSE4.2 crc32 instruction
+// Source: https://www.rfc-editor.org/rfc/rfc3720#appendix-B.4
+#define CRC32C_POLY 0x82F63B78  // reversed
+#define CRC32C_SLICES 8         // bytes folded in per step by the table driven version
+
+/**
+ * @brief Builds the lookup tables and picks the crc32 instruction when CPUID reports SSE4.2.
+ *
+ * Must run before any other crc32c function, calling it again does no harm.
+ */
+void crc32c_init();
+
+/**
+ * @brief Extends a CRC-32C over a buffer.
+ *
+ * @param crc The CRC of the data before `data`, 0 to start one.
+ * @param data The bytes to add.
+ * @param length The number of bytes in `data`.
+ * @return The CRC of everything so far, to be passed back in for the next piece.
+ */
+uint32_t crc32c(uint32_t crc, const void* data, uint32_t length);
+
+/**
+ * @brief Stores the CRC-32C of a record in the record's own checksum field.
+ *
+ * The checksum covers the whole record with the field taken as 0.
+ *
+ * @param record The record.
+ * @param length The size of the record.
+ * @param offset Where the 32 bit checksum field sits in the record.
+ */
+void crc32c_seal(void* record, uint32_t length, uint32_t offset);
+
+/**
+ * @brief Checks a record sealed by `crc32c_seal`.
+ *
+ * @return true if the checksum field matches the record.
+ */
+bool crc32c_verify(const void* record, uint32_t length, uint32_t offset);
+
+#endif // CRC32C_H
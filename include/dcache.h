@@ -0,0 +1,56 @@
+#ifndef DCACHE_H
+#define DCACHE_H
+
+#include <stdint.h>
+#include <stdbool.h>
+
+#define DCACHE_ENTRIES 128          // must be a power of 2
+#define DCACHE_WAYS 4               // slots probed per name
+#define DCACHE_NEGATIVE 0xFFFFFFFF  // inode_num recorded for a name that doesn't exist
+
+/**
+ * @brief A cached path component, mapping a name within a directory to its inode.
+ */
+typedef struct {
+	bool valid;
+	uint32_t hash;              // strhash of name
+	uint32_t parent_inode_num;  // Directory the name lives in.
+	uint32_t inode_num;         // Inode the name refers to, or DCACHE_NEGATIVE.
+	char name[32];
+} DirCacheEntry;
+
+/**
+ * @brief Empties the lookup cache.
+ */
+void dcache_init();
+
+/**
+ * @brief Looks up a name within a directory.
+ *
+ * @param parent_inode_num The directory to look in.
+ * @param name The name of the entry.
+ * @param inode_num Receives the inode of the entry, DCACHE_NEGATIVE if it is known not to exist.
+ * @return true on a hit, false if the directory has to be searched.
+ */
+bool dcache_lookup(uint32_t parent_inode_num, const char* name, uint32_t* inode_num);
+
+/**
+ * @brief Records the result of searching a directory for a name.
+ *
+ * @param parent_inode_num The directory that was searched.
+ * @param name The name that was searched for.
+ * @param inode_num The inode found, or DCACHE_NEGATIVE if there was none.
+ */
+void dcache_insert(uint32_t parent_inode_num, const char* name, uint32_t inode_num);
+
+/**
+ * @brief Forgets a name within a directory, after it is linked or unlinked.
+ */
+void dcache_invalidate(uint32_t parent_inode_num, const char* name);
+
+/**
+ * @brief Forgets every name within a directory, after the directory is removed.
+ */
+void dcache_invalidate_dir(uint32_t parent_inode_num);
+
+#endif // DCACHE_H
@@ -14,12 +14,13 @@
 #define STDERR 0 
 #define SERIAL 1
 
-typedef uint64_t (*file_handler)(bool, int64_t, const void*, uint32_t); // special file handler
 typedef void (*initializer)(int32_t);
 
+struct FileOps;
+
 typedef struct {
     char filename[32];
-    file_handler handler;
+    const struct FileOps* ops;  // driver behind the file's descriptors
     initializer initialization_func;
     int32_t fd;
 } SpecialFile;
@@ -34,11 +35,14 @@ typedef struct {
 extern RingBuffer keyboard_input_buffer;
 extern RingBuffer serial_port_buffer;
 
-// will be called on formatting of the disk, or if they are not guaranteed to be there
+// called on every boot, once the tmpfs on /dev is mounted
 // uint64_t tty_handler(bool read, int64_t fd, const void* buf, uint32_t count);
 void create_system_files();
 void open_system_files();
 
+// operations for the special file under /dev named `filename`, NULL if no driver provides it
+const struct FileOps* special_file_ops(const char* filename);
+
 extern SpecialFile system_files[2];
 
 #endif // FILE_HANDLERS_H
\ No newline at end of file
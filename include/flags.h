@@ -24,17 +24,47 @@
 #define ATA_CMD_WRITE_SECTORS  0x30
 #define ATA_CMD_CACHE_FLUSH    0xE7
 #define ATA_CMD_IDENTIFY       0xEC
+#define ATA_CMD_READ_DMA       0xC8
+#define ATA_CMD_WRITE_DMA      0xCA
+#define ATA_CMD_READ_MULTIPLE  0xC4
+#define ATA_CMD_WRITE_MULTIPLE 0xC5
+#define ATA_CMD_SET_MULTIPLE   0xC6  // sectors per DRQ block of the MULTIPLE commands, in the count register
+
+// LBA48 versions, the address and count registers take two bytes each, high byte first
+#define ATA_CMD_READ_SECTORS_EXT   0x24
+#define ATA_CMD_WRITE_SECTORS_EXT  0x34
+#define ATA_CMD_READ_DMA_EXT       0x25
+#define ATA_CMD_WRITE_DMA_EXT      0x35
+#define ATA_CMD_READ_MULTIPLE_EXT  0x29
+#define ATA_CMD_WRITE_MULTIPLE_EXT 0x39
+#define ATA_CMD_CACHE_FLUSH_EXT    0xEA
 
 // Status Flags
 #define ATA_SR_BSY             0x80  // Busy
 #define ATA_SR_DRDY            0x40  // Drive ready
 #define ATA_SR_DRQ             0x08  // Data request ready
+#define ATA_SR_ERR             0x01  // Error, details in ATA_REG_ERROR
+
+// Device control register
+#define ATA_CTRL_NIEN          0x02  // keeps the drive from raising IRQ14
+#define ATA_IRQ                14    // primary channel
+
+// Bus master IDE registers, from the base in BAR4 of the controller, primary channel
+#define ATA_BM_REG_COMMAND     0x0
+#define ATA_BM_REG_STATUS      0x2
+#define ATA_BM_REG_PRDT        0x4   // physical address of the PRD table
+#define ATA_BM_CMD_START       0x01
+#define ATA_BM_CMD_READ        0x08  // the device writes to memory
+#define ATA_BM_SR_ACTIVE       0x01
+#define ATA_BM_SR_ERROR        0x02  // write 1 to clear
+#define ATA_BM_SR_IRQ          0x04  // the drive raised its interrupt, write 1 to clear
+#define ATA_PRD_END            0x8000 // flags of the last PRD table entry
 
 // Drive types
 #define ATA_MASTER             0xA0
 #define ATA_SLAVE              0xB0
 
 #define SECTORS_PER_BLOCK      0x8  // for filesystem, 4KB blocks 
-#define BLOCK_BYTES            SECTORS_PER_BLOCK*SECTOR_BYTES
+#define BLOCK_BYTES            (SECTORS_PER_BLOCK * SECTOR_BYTES)
 
 #endif // FLAGS_H
\ No newline at end of file
@@ -8,13 +8,65 @@
 #include <file_handlers.h>
 
 
-// number of blocks per
-#define SUPER_SIZE 1 
-#define INODE_BITMAP_SIZE 1
-#define DATA_BITMAP_SIZE 1
-#define INODE_TABLE_SIZE 5
-#define DATA_REGION_START SUPER_SIZE + INODE_BITMAP_SIZE + DATA_BITMAP_SIZE + INODE_TABLE_SIZE
-#define DATA_REGION_SIZE 64 - SUPER_SIZE - INODE_BITMAP_SIZE - DATA_BITMAP_SIZE - INODE_TABLE_SIZE
+// Disk layout: the disk is split into block groups of BLOCKS_PER_GROUP blocks,
+// each starting with its own data bitmap, inode bitmap, block reference counts
+// and slice of the inode table, followed by its data blocks. Group 0 is preceded
+// by the superblock at block 0, the group descriptor table from block 1 and the
+// metadata journal.
+#define SUPER_SIZE 1                        // blocks
+#define BLOCKS_PER_GROUP (BLOCK_BYTES * 8)  // as many as one bitmap block covers
+#define BLOCKS_PER_INODE 4                  // one inode is formatted per this many blocks
+#define FS_MAX_GROUPS 1024                  // caps the file system at 128 GiB
+#define FS_MIN_GROUP_DATA 16                // a trailing group with fewer data blocks is left out
+#define JOURNAL_FRACTION 16                 // of the disk given to the journal, within JOURNAL_BLOCKS_MIN/MAX
+
+#define FS_VERSION 10 // bumped whenever the on-disk layout changes
+
+// extents held directly in the inode, the rest spill into `extent_block`
+#define INODE_DIRECT_EXTENTS 25
+#define EXTENTS_PER_BLOCK (BLOCK_BYTES / sizeof(BitRange) - 1) // the last slot holds the block's checksum
+#define INODE_EXTENTS_MAX (INODE_DIRECT_EXTENTS + EXTENTS_PER_BLOCK)
+#define EXTENT_IS_HOLE(extent) ((extent).start == 0) // block 0 is the superblock, never file data
+
+// directory and extent blocks end with a CRC-32C of themselves, see bcache_set_checksum
+#define BLOCK_CHECKSUM_OFFSET (BLOCK_BYTES - sizeof(uint32_t))
+
+// data blocks may be shared between files, copy-on-write, see FileSystemGroupDesc
+#define REFCOUNTS_PER_BLOCK BLOCK_CHECKSUM_OFFSET // one byte per data block, then the checksum
+#define REFCOUNT_TABLE_BLOCKS ((BLOCKS_PER_GROUP + REFCOUNTS_PER_BLOCK - 1) / REFCOUNTS_PER_BLOCK)
+#define REFCOUNT_MAX 0xFF
+
+// files small enough are kept in the inode, in place of the extents
+#define INODE_INLINE_BYTES (INODE_DIRECT_EXTENTS * sizeof(BitRange))
+#define INODE_FLAG_INLINE 0x1 // data lives in `inline_data`, the file owns no blocks
+#define INODE_FLAG_COMPRESSED 0x2 // data is kept in compressed clusters, inherited by new files in a directory
+#define INODE_FLAG_READONLY 0x4 // part of a snapshot, neither the file nor a directory's entries ever change
+
+// compressed files are read and written a cluster of file blocks at a time, see FileSystemInode
+#define COMPRESS_CLUSTER_BLOCKS 4
+#define COMPRESS_CLUSTER_BYTES (COMPRESS_CLUSTER_BLOCKS * BLOCK_BYTES)
+#define CLUSTER_PACKED 0x80000000         // in the length of a compressed file's extent, its cluster holds LZ4 data
+#define COMPRESSED_BLOCK_BASE 0x80000000  // cache names of decompressed blocks, past any real block
+
+// blocks appended to files are picked only once the data is written back, see DelayedRun
+#define DELAYED_BLOCKS_MAX 16           // held back across all files
+#define DELAYED_FILES_MAX 4             // files with blocks held back at once
+#define DELAYED_BLOCK_BASE 0xF0000000   // cache names of delayed blocks, past any real block
+
+// read-ahead window, in blocks, for file descriptors reading sequentially
+#define READ_AHEAD_MIN 4
+#define READ_AHEAD_MAX 16
+
+// blocks read by each transfer of `scrub`
+#define SCRUB_BATCH_BLOCKS 16
+
+// the background defragmenter moves a file at most this often, and rests this long between passes
+#define DEFRAG_STEP_TICKS 10    // 100 ms at 100 HZ
+#define DEFRAG_PASS_TICKS 6000  // a minute
+
+// metadata commits to the journal once this many changes pile up, or this long after the first one
+#define SYNC_UPDATE_THRESHOLD 64
+#define SYNC_INTERVAL_TICKS 500 // 5 seconds at 100 HZ
 
 #define FILE_TYPE_DIR 0
 #define FILE_TYPE_NORMAL 1
@@ -35,34 +87,129 @@ typedef struct {
     uint64_t disk_size;         // Total size of the disk in bytes.
     uint32_t sector_count;      // Total number of sectors on the disk.
     uint32_t block_count;       // Total number of formatted blocks.
-    uint32_t i_bmap_start;      // Start block of the inode bitmap.
-    uint32_t d_bmap_start;      // Start block of the data bitmap.
-    uint32_t inode_table_start; // Start block of the inode table.
+    uint32_t blocks_per_group;  // Blocks covered by each group, the last one may be shorter.
+    uint32_t inodes_per_group;  // Inodes in each group's slice of the inode table.
+    uint32_t group_count;       // Number of block groups.
+    uint32_t group_desc_start;  // Start block of the group descriptor table.
     uint32_t used_inodes;       // Number of used inodes.
-    uint32_t data_start;        // Start block of the data region.
+    uint32_t version;           // On-disk format revision, must match FS_VERSION.
+    uint32_t journal_start;     // Start block of the journal region.
+    uint32_t journal_blocks;    // Blocks in the journal region.
+    uint32_t checksum;          // CRC-32C of the superblock, taken with this field as 0.
 } FileSystemSuper;
 
+/**
+ * @brief Structure describing a block group.
+ *
+ * Inode `n` lives in group `n / inodes_per_group`, block `b` in group
+ * `b / blocks_per_group`. Bit `i` of a group's bitmaps stands for the i'th
+ * inode or block of the group, its own metadata blocks are marked as used.
+ *
+ * The bitmap checksums are taken whenever the descriptor is logged, which
+ * every commit that changes a bitmap does, so they match the bitmaps on
+ * disk once the journal is checkpointed.
+ *
+ * A data block referenced by more than one file, after `reflink` or
+ * `snapshot`, has a byte in the group's reference count table holding how
+ * many files share it past the first, 0 for any other block. A shared block
+ * is only freed once the last file lets go of it, and a file writing to one
+ * first moves its data to a block of its own.
+ */
+typedef struct {
+    uint32_t block_bitmap;      // Block holding the group's data block bitmap.
+    uint32_t inode_bitmap;      // Block holding the group's inode bitmap.
+    uint32_t inode_table;       // Start block of the group's slice of the inode table.
+    uint32_t data_start;        // First block after the group's metadata.
+    uint32_t free_blocks;       // Unallocated blocks in the group.
+    uint32_t free_inodes;       // Unallocated inodes in the group.
+    uint32_t dir_count;         // Directories with their inode in the group.
+    uint32_t block_bitmap_checksum; // CRC-32C of the data block bitmap.
+    uint32_t inode_bitmap_checksum; // CRC-32C of the inode bitmap.
+    uint32_t refcount_table;    // Start block of the group's REFCOUNT_TABLE_BLOCKS of reference counts.
+    uint32_t shared_blocks;     // Blocks of the group with a non-zero reference count, the table is skipped while 0.
+    uint32_t reserved[4];       // Keeps the descriptor a power of 2 in size.
+    uint32_t checksum;          // CRC-32C of the descriptor, taken with this field as 0.
+} FileSystemGroupDesc;
+
+_Static_assert(BLOCK_BYTES % sizeof(FileSystemGroupDesc) == 0, "descriptors must pack evenly into a block");
+
+#define GROUP_DESCS_PER_BLOCK (BLOCK_BYTES / sizeof(FileSystemGroupDesc))
+#define GROUP_DESC_BLOCKS_MAX ((FS_MAX_GROUPS + GROUP_DESCS_PER_BLOCK - 1) / GROUP_DESCS_PER_BLOCK)
+
 /**
  * @brief Structure representing an inode in the file system.
+ *
+ * A file's data is described by a list of extents, each a run of contiguous
+ * blocks, in file order. The first `INODE_DIRECT_EXTENTS` live in the inode
+ * itself; once those are used up, the remainder are stored as an array of
+ * `BitRange` in the overflow block `extent_block`.
+ *
+ * An extent starting at block 0 is a hole: its blocks have no storage and
+ * read as zeroes. So are blocks past the last extent but within `size`.
+ *
+ * With INODE_FLAG_COMPRESSED, extent `i` holds instead cluster `i` of the
+ * file, its COMPRESS_CLUSTER_BLOCKS file blocks. A cluster is stored as is,
+ * or, when that saves a block, as a ClusterHeader followed by the LZ4
+ * compressed data, with CLUSTER_PACKED set in the extent's length. Holes are
+ * extents with both fields 0.
+ *
+ * Regular files start out with INODE_FLAG_INLINE set, keeping up to
+ * INODE_INLINE_BYTES of data in the space of the extents, so reading them
+ * needs nothing past the inode table. The first write that doesn't fit moves
+ * the data into a block and clears the flag for good.
  */
 typedef struct {
     char name[32];              // Name of the file or directory.
     uint8_t file_type;          // Type of the file (0 - directory, 1 - file, 2 - special).
-    // TODO: replace this with a BitRange, or multiple
-    uint32_t data_block_start;  // Starting block of the file's data.
+    uint8_t flags;              // INODE_FLAG_*
+    uint16_t extent_count;      // Number of extents in use, inline and overflow.
     uint32_t size;              // Size of the file in bytes.
     uint32_t parent_inode_num;  // Parent inode number.
+    uint32_t extent_block;      // Block holding extents past INODE_DIRECT_EXTENTS, 0 if none.
+    uint32_t dir_tombstones;    // Directories only, removed entries still occupying a slot.
+    uint32_t checksum;          // CRC-32C of the inode, taken with this field as 0.
+    union {
+        BitRange extents[INODE_DIRECT_EXTENTS]; // Runs of data blocks, in file order.
+        uint8_t inline_data[INODE_INLINE_BYTES]; // File contents, with INODE_FLAG_INLINE.
+    };
 } FileSystemInode;
 
+_Static_assert(sizeof(FileSystemInode) == 256, "inodes must pack evenly into a block");
+
+#define INODES_PER_BLOCK (BLOCK_BYTES / sizeof(FileSystemInode))
+
+/**
+ * @brief Starts a cluster of a compressed file stored as LZ4 data.
+ */
+typedef struct {
+    uint32_t packed_bytes;      // Size of the LZ4 block that follows.
+    uint32_t plain_bytes;       // Size of the data it expands to, COMPRESS_CLUSTER_BYTES but at the end of the file.
+    uint32_t checksum;          // CRC-32C of the LZ4 block.
+} ClusterHeader;
+
+/**
+ * @brief What `stat` reports about a file.
+ */
+typedef struct {
+    uint32_t inode_num;
+    uint8_t file_type;
+    uint8_t flags;              // INODE_FLAG_*
+    uint32_t size;              // Size of the file in bytes.
+    uint32_t disk_blocks;       // Blocks the file takes up on disk, holes and compression aside.
+} FileStat;
+
 /**
  * @brief Structure representing a directory entry.
  */
 typedef struct {
     char name[32];              // Name of the file or directory.
     uint32_t inode_num;         // Inode number of the file or directory.
+    uint8_t file_type;          // Copy of the inode's file_type, so listings don't read the inode.
+    uint8_t reserved[3];
 } FileSystemDirEntry;
 
-#define DIR_FILE_COUNT_MAX (BLOCK_BYTES) / sizeof(FileSystemDirEntry)
+#define DIR_FILE_COUNT_MAX (BLOCK_CHECKSUM_OFFSET / sizeof(FileSystemDirEntry))
+#define DIR_TOMBSTONE 0xFFFFFFFF // inode_num left in the slot of a removed entry
 /**
  * @file fs.h
  * @brief Defines structures and constants for the file system directory data block.
@@ -83,20 +230,59 @@ typedef struct {
  * The `contents` array can be directly cast from a block buffer pointer, allowing
  * efficient access to directory entries. The number of files contained in the directory
  * can be inferred from the inode size, so an explicit `files_contained` field is omitted.
+ *
+ * A directory's blocks together form one open addressed hash table of
+ * `DIR_FILE_COUNT_MAX` slots per block. An entry lives at the first free slot
+ * from `strhash(name)` onwards, wrapping around at the end. A slot with an
+ * empty name is free: a zero `inode_num` ends a probe, while `DIR_TOMBSTONE`
+ * marks a removed entry that lookups have to step over. The table is rebuilt,
+ * doubling when needed, once live entries and tombstones fill 3/4 of it.
  */
 typedef struct {
 	// NOTE: we can just count according to the size in the inode
 	// uint16_t files_contained; // how many elements of the contents array
-	// only fits in one block
 	FileSystemDirEntry contents[DIR_FILE_COUNT_MAX]; // can cast block buffer as pointer
+	uint8_t reserved[BLOCK_CHECKSUM_OFFSET - DIR_FILE_COUNT_MAX * sizeof(FileSystemDirEntry)];
+	uint32_t checksum;
 } FileSystemDirDataBlock;
 
+_Static_assert(sizeof(FileSystemDirDataBlock) == BLOCK_BYTES, "directory blocks must fill a block");
+
+/**
+ * @brief A directory entry as returned by `readdir`.
+ */
+typedef struct {
+	char name[32];
+	uint32_t inode_num;
+	uint8_t file_type;
+} DirRecord;
+
+/**
+ * @brief Operations on an open file.
+ *
+ * Picked by `open` from the file system and the kind of file being opened,
+ * so `read`, `write`, `seek`, `close` and `readdir` reach regular files,
+ * directories and devices through a single indirect call.
+ */
+typedef struct FileOps {
+	uint64_t (*read)(int64_t fd, const void* buf, uint32_t count);
+	uint64_t (*write)(int64_t fd, const void* buf, uint32_t count);
+	int32_t (*seek)(int64_t fd, int32_t offset, uint32_t param);
+	int64_t (*close)(int64_t fd);
+	int32_t (*readdir)(int64_t fd, DirRecord* entries, uint32_t max); // NULL but for directories
+} FileOps;
+
 /**
  * @struct FileDescriptorEntry
  * @brief Represents an entry in the file descriptor table.
  *
  * This structure contains metadata for a file descriptor, including the file's
  * name, inode number, read/write positions, and an index for identification.
+ *
+ * A read starting where the previous one ended counts as sequential. Each time
+ * a sequential reader gets past `ra_end`, the next `ra_window` blocks beyond its
+ * request are prefetched into the block cache and the window doubles, up to
+ * READ_AHEAD_MAX. Any other read resets the window.
  */
 typedef struct {
     char name[32];
@@ -104,6 +290,10 @@ typedef struct {
 	uint64_t read_pos;
 	uint64_t write_pos;
 	uint32_t index;
+	uint64_t ra_expected;   // read_pos at which the next read would be sequential
+	uint32_t ra_window;     // blocks read ahead, 0 while access looks random
+	uint32_t ra_end;        // file block up to which the cache has been filled
+	const FileOps* ops;     // resolved once, when the file is opened
 } FileDescriptorEntry;
 
 /**
@@ -116,6 +306,42 @@ typedef struct {
 	FileDescriptorEntry entries[32]; // only 16 per process for now
 } FileDescriptorTable;
 
+/**
+ * @brief Data appended to a file that has no blocks on disk yet.
+ *
+ * Covers file blocks `first_block` up to `first_block + count`, right after
+ * the last block the file owns. Their data is kept in the cache under
+ * DELAYED_BLOCK_BASE names until the file is closed, read, synced or the
+ * delayed blocks run out, then the whole run is allocated at once, so files
+ * written a little at a time still end up contiguous.
+ */
+typedef struct {
+	uint32_t inode_num;
+	uint32_t first_block;
+	uint32_t count;     // 0 while the entry is unused
+} DelayedRun;
+
+/**
+ * @brief What `scrub` found.
+ */
+typedef struct {
+	uint32_t blocks_checked;    // Blocks read and checked against their checksums.
+	uint32_t errors;            // Blocks or records whose checksum doesn't match.
+} ScrubReport;
+
+/**
+ * @brief What `defrag` did.
+ */
+typedef struct {
+	uint32_t files_checked;     // Regular files looked at.
+	uint32_t files_moved;       // Files rewritten into a single run of blocks.
+	uint32_t blocks_moved;      // Data blocks those files hold.
+	uint32_t extents_before;    // Data extents of the files checked, before the pass.
+	uint32_t extents_after;     // The same, after it.
+	uint32_t free_runs_before;  // Runs of free blocks over the disk, before the pass.
+	uint32_t free_runs_after;   // The same, after it.
+} DefragReport;
+
 typedef struct {
 	bool valid;
 	uint32_t file_inode_num;
@@ -148,6 +374,8 @@ int64_t create(const char* path);
 /**
  * @brief Opens an existing file.
  * 
+ * Directories open too, to be read with `readdir`, a path ending in '/' names the directory itself.
+ *
  * @param path The absolute path of the file to open.
  * @return The file descriptor of the opened file, or -1 on failure.
  */
@@ -161,6 +389,29 @@ int64_t open(const char* path);
  */
 int64_t close(int64_t fd);
 
+/**
+ * @brief Frees the file descriptor, the `close` operation of files with no state of their own.
+ *
+ * @param fd The file descriptor to free.
+ * @return 0.
+ */
+int64_t release_file_descriptor(int64_t fd);
+
+/**
+ * @brief Hands out a file descriptor, for the file systems to open their files with.
+ *
+ * @param inode_num The file system's own number for the file.
+ * @param filename The name of the file.
+ * @param ops The operations the descriptor's calls go to.
+ * @return The file descriptor, or -1 if none is left.
+ */
+int32_t allocate_file_descriptor(uint32_t inode_num, const char* filename, const FileOps* ops);
+
+/**
+ * @brief The state of an open file descriptor, for its FileOps to work on.
+ */
+FileDescriptorEntry* file_descriptor(int64_t fd);
+
 /**
  * @brief Reads data from a file.
  * 
@@ -181,6 +432,21 @@ uint64_t read(int64_t fd, const void* buf, uint32_t count);
  */
 uint64_t write(int64_t fd, const void* buf, uint32_t count);
 
+/**
+ * @brief Reads the next entries of an open directory.
+ *
+ * Records are copied straight out of the cached directory blocks, the
+ * descriptor's read position remembers where the next call picks up, so a
+ * directory of any size can be listed a few entries at a time. Entries added
+ * or removed meanwhile may or may not show up.
+ *
+ * @param fd The file descriptor of the directory, from `open`.
+ * @param entries Receives the entries.
+ * @param max The number of records `entries` has room for.
+ * @return The number of records filled, 0 once the directory is exhausted, or -1 on failure.
+ */
+int32_t readdir(int64_t fd, DirRecord* entries, uint32_t max);
+
 /**
  * @brief Deletes a file or directory.
  * 
@@ -189,6 +455,87 @@ uint64_t write(int64_t fd, const void* buf, uint32_t count);
  */
 int32_t unlink(const char* path);
 
+/**
+ * @brief Reserves the blocks backing a range of a file up front.
+ *
+ * Blocks are taken as one contiguous run whenever the disk has one, holes in
+ * the range are filled. The file size is left alone, writes into the range
+ * later on don't allocate.
+ *
+ * @param fd The file descriptor of the file.
+ * @param offset The start of the range, in bytes.
+ * @param length The length of the range, in bytes.
+ * @return -1 if the disk ran out of space, or 0 on success.
+ */
+int32_t fallocate(int64_t fd, uint32_t offset, uint32_t length);
+
+/**
+ * @brief Turns compression on or off for a file or directory.
+ *
+ * Only files that don't own blocks yet can change, the data they hold inline
+ * is written compressed once it outgrows the inode. Files created in a
+ * directory with compression on get it too. Compressed files are kept in
+ * COMPRESS_CLUSTER_BYTES clusters, each rewritten whole by a write to it, and
+ * can't be preallocated or have holes punched.
+ *
+ * @param fd The file descriptor of the file or directory.
+ * @param compressed Whether new data is compressed.
+ * @return -1 if the file already owns blocks, or 0 on success.
+ */
+int32_t set_compression(int64_t fd, bool compressed);
+
+/**
+ * @brief Describes a file without opening it.
+ *
+ * The compression ratio of a file is `size` over `disk_blocks` * BLOCK_BYTES.
+ *
+ * @param path The absolute path of the file or directory.
+ * @param st Receives the description.
+ * @return -1 if the file doesn't exist, or 0 on success.
+ */
+int32_t stat(const char* path, FileStat* st);
+
+/**
+ * @brief Sets the size of a file.
+ *
+ * Shrinking frees the blocks past the new end. Growing doesn't allocate, the
+ * added bytes are a hole reading as zeroes until written.
+ *
+ * @param fd The file descriptor of the file.
+ * @param length The new size, in bytes.
+ * @return -1 on failure, or 0 on success.
+ */
+int32_t ftruncate(int64_t fd, uint32_t length);
+
+/**
+ * @brief Frees the blocks backing a range of a file, leaving a hole.
+ *
+ * The range reads as zeroes afterwards and the file size is left alone. Only
+ * blocks entirely within the range are freed, the bytes of the partial blocks
+ * at its edges are cleared in place.
+ *
+ * @param fd The file descriptor of the file.
+ * @param offset The start of the range, in bytes.
+ * @param length The length of the range, in bytes.
+ * @return -1 on failure, or 0 on success.
+ */
+int32_t punch_hole(int64_t fd, uint32_t offset, uint32_t length);
+
+/**
+ * @brief Moves a file or directory to a new path.
+ *
+ * Only directory entries and the inode change, the data isn't touched, so
+ * the cost doesn't depend on the size of the file or of the subtree being
+ * moved. All of it joins a single journal transaction. A file already at
+ * `new_path` is replaced, its entry pointed at the moved inode in place; a
+ * directory there must be empty.
+ *
+ * @param old_path The absolute path of the file or directory to move.
+ * @param new_path The absolute path it moves to.
+ * @return -1 on failure, or 0 on success.
+ */
+int32_t rename(const char* old_path, const char* new_path);
+
 /**
  * @brief Moves the file cursor to a specific position.
  * 
@@ -198,6 +545,32 @@ int32_t unlink(const char* path);
  */
 int32_t seek(int64_t fd, int32_t offset, uint32_t param);
 
+/**
+ * @brief Copies a regular file by sharing its blocks, copy-on-write.
+ *
+ * Only the inode and extent block are copied, the data blocks gain a
+ * reference each, so this takes no longer for a large file than for a
+ * small one. Either copy writing to a shared block moves it first.
+ *
+ * @param src_path The absolute path of the file to copy.
+ * @param dst_path The absolute path of the copy, which mustn't exist yet.
+ * @return 0 on success, -1 on failure.
+ */
+int32_t reflink(const char* src_path, const char* dst_path);
+
+/**
+ * @brief Takes a read-only snapshot of the whole tree.
+ *
+ * Every directory is copied and every regular file is reflinked, nothing
+ * is read or written of the file data. The copy is marked
+ * INODE_FLAG_READONLY all through. Earlier snapshots and special files are
+ * left out.
+ *
+ * @param path The absolute path of the snapshot, which mustn't exist yet.
+ * @return 0 on success, -1 on failure.
+ */
+int32_t snapshot(const char* path);
+
 /**
  * @brief Creates a new directory.
  * 
@@ -214,22 +587,96 @@ int32_t mkdir(const char* path);
  */
 void list_dir(const char* path, char* buf);
 
+/**
+ * @brief Commits every metadata change since the last sync to the journal,
+ * and returns once it is on the media.
+ *
+ * Dirty file data is written home first. The changed bitmaps, inode table,
+ * directory and extent blocks, superblock and group descriptor blocks are
+ * then logged together as one transaction, the operations batched into it
+ * survive a crash all or nothing. Logged blocks reach their home location
+ * later, as the cache writes them back or the journal fills up.
+ *
+ * The file system calls also commit on their own once SYNC_UPDATE_THRESHOLD
+ * metadata changes pile up, JOURNAL_COMMIT_BLOCKS blocks are logged, or
+ * SYNC_INTERVAL_TICKS after the last sync. Those commits aren't waited on,
+ * the drive's write cache is flushed only here and where the journal needs
+ * a write barrier, so many writes share a single flush.
+ *
+ * @return 0 on success.
+ */
+int32_t sync();
+
+/**
+ * @brief Returns once the file's data and metadata are on the media.
+ *
+ * The journal commits every change together, so this is a `sync`.
+ *
+ * @param fd A file or directory on disk.
+ * @return 0 on success, -1 if fd isn't one.
+ */
+int32_t fsync(int64_t fd);
+
+/**
+ * @brief Reads back every checksummed structure on disk and checks it.
+ *
+ * Syncs and checkpoints first, so the disk holds everything. Then goes group
+ * by group through the bitmaps and the inode table with large sequential
+ * reads, bypassing the cache, and follows each inode in use to its extent
+ * block, directory blocks and compressed clusters. File data stored as is has
+ * no checksum and isn't read. Each mismatch is reported on the console.
+ *
+ * @param report Receives what was checked and found.
+ * @return 0 if everything matched, -1 otherwise.
+ */
+int32_t scrub(ScrubReport* report);
+
+/**
+ * @brief Defragments every regular file and compacts free space.
+ *
+ * Goes through the inodes in order. A file whose data is split over several
+ * runs of blocks is moved into one contiguous run, allocated first fit from
+ * the start of its group, and a file already in one run moves down into a
+ * free run nearer the start, so free space gathers at the end of each
+ * group. Blocks move through the cache under their new numbers, read in
+ * batches and written back in clusters, without being copied. Files that
+ * are inline, compressed or share blocks with another file are left alone.
+ *
+ * @param report Receives the extent counts and free space before and after.
+ * @return 0 on success.
+ */
+int32_t defrag(DefragReport* report);
+
+/**
+ * @brief Turns the background defragmenter on or off.
+ *
+ * While on, `defrag_idle` moves one file as `defrag` would every
+ * DEFRAG_STEP_TICKS, and starts over from the first inode DEFRAG_PASS_TICKS
+ * after finishing a pass.
+ *
+ * @param enabled Whether it runs.
+ */
+void defrag_background(bool enabled);
+
+/**
+ * @brief Lets the background defragmenter take a step, if it is due.
+ *
+ * Called from the shell while it waits for input.
+ */
+void defrag_idle();
+
 /**
  * @brief Gracefully shuts down the system by performing necessary cleanup operations.
  *
  * This function performs the following tasks:
  * 1. Prints a shutdown message to the console.
- * 2. Synchronizes disk metadata by writing critical data structures to disk:
- *    - Writes the superblock to disk.
- *    - Writes the inode bitmap to disk.
- *    - Writes the data bitmap to disk.
- *    - Writes the inode table to disk.
+ * 2. Closes the system files.
+ * 3. Syncs the disk, see `sync`, and checkpoints the journal.
  *
  * It ensures that all metadata changes are saved to persistent storage before the system shuts down.
  */
 void shutdown();
 
 int64_t create_filetype(const char* path, uint8_t file_type, bool allocate_fd);
-char* str_list_dir(const char* path);
 
 #endif // FS_H
\ No newline at end of file
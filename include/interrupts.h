@@ -3,6 +3,7 @@
 
 #include <stddef.h>
 #include <stdint.h>
+#include <stdbool.h>
 #include <asm/cpu_io.h>
 #include <string.h>
 #include <vga.h>
@@ -39,6 +40,18 @@ inline void disable_interrupts() {
 	asm volatile ("cli");
 }
 
+inline bool interrupts_enabled() {
+	uint32_t flags;
+	asm volatile ("pushf; pop %0" : "=r"(flags));
+	return flags & (1 << 9); // IF
+}
+
+// to be called with interrupts disabled, halts until the next one and returns with them disabled again
+// sti only takes effect after the hlt has started, so an interrupt can't slip in between
+inline void wait_for_interrupt() {
+	asm volatile ("sti; hlt; cli");
+}
+
 typedef struct __attribute__((packed)) {
     // In this order
     uint32_t gs, fs, es, ds;
@@ -0,0 +1,161 @@
+#ifndef JOURNAL_H
+#define JOURNAL_H
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <flags.h>
+#include <alloc.h>
+#include <bcache.h>
+
+// Layout of the journal region: a header block, then transactions written one
+// after another, each a descriptor block, a copy of every block it logs and a
+// commit block. The log starts over after the header once it is checkpointed.
+#define JOURNAL_MAGIC 0x4C4E4A59                // "YJNL"
+#define JOURNAL_BLOCKS_MIN (BCACHE_BLOCKS + 3)  // header, descriptor, commit and a transaction filling the cache
+#define JOURNAL_BLOCKS_MAX 1024                 // 4 MiB
+#define JOURNAL_COMMIT_BLOCKS 16                // the running transaction commits once it logs this many blocks
+#define JOURNAL_REVOKES_MAX 128                 // revoked runs in one transaction
+#define JOURNAL_REPLAY_REVOKES_MAX 1024         // revoked runs between two checkpoints
+
+// descriptor tags: a logged block, or a revoked run taking two tags, start then length
+#define JOURNAL_TAG_REVOKE 0x80000000
+#define JOURNAL_TAGS_MAX ((BLOCK_BYTES - 3 * sizeof(uint32_t)) / sizeof(uint32_t))
+
+/**
+ * @brief First block of the journal region, says where replay picks up.
+ */
+typedef struct {
+	uint32_t magic;
+	uint32_t sequence;  // Transaction expected first in the log.
+} JournalHeader;
+
+/**
+ * @brief Opens a transaction, followed by a copy of each logged block in tag order.
+ */
+typedef struct {
+	uint32_t magic;
+	uint32_t sequence;
+	uint32_t tag_count;
+	uint32_t tags[JOURNAL_TAGS_MAX];  // home block numbers, revoked runs marked with JOURNAL_TAG_REVOKE
+} JournalDescriptor;
+
+/**
+ * @brief Closes a transaction, which only counts once this block made it to disk.
+ */
+typedef struct {
+	uint32_t magic;
+	uint32_t sequence;
+	uint32_t checksum;  // CRC-32C over the descriptor and the logged blocks, catches a commit torn from its data
+} JournalCommit;
+
+_Static_assert(sizeof(JournalDescriptor) == BLOCK_BYTES, "descriptor must fill a block");
+
+/**
+ * @brief Stops journaling, `journal_add` and `journal_revoke` do nothing until the journal is set up again.
+ */
+void journal_init();
+
+/**
+ * @brief Sets up an empty journal over a freshly formatted region.
+ *
+ * @param start First block of the journal region.
+ * @param block_count Blocks in the region, at least JOURNAL_BLOCKS_MIN.
+ */
+void journal_format(uint32_t start, uint32_t block_count);
+
+/**
+ * @brief Replays the transactions committed to the journal, then starts journaling.
+ *
+ * Every logged block of a committed transaction is written to its home
+ * location, unless a later transaction revoked it. Must run before anything
+ * of the file system is read through the cache.
+ *
+ * @param start First block of the journal region.
+ * @param block_count Blocks in the region.
+ * @return The number of transactions replayed, -1 if the region holds no journal.
+ */
+int32_t journal_mount(uint32_t start, uint32_t block_count);
+
+/**
+ * @brief Adds a modified metadata block to the running transaction.
+ *
+ * The block stays in the cache and off its home location until the
+ * transaction commits.
+ */
+void journal_add(CacheBlock* block);
+
+/**
+ * @brief Records that a run of blocks was freed.
+ *
+ * Copies of them logged by earlier transactions are no longer replayed, so a
+ * block reused for file data isn't overwritten by its old contents on replay.
+ */
+void journal_revoke(BitRange range);
+
+/**
+ * @brief Sets a function `journal_commit` runs first, to add the blocks it logs to the transaction.
+ *
+ * It runs on every commit, including those the cache forces when the
+ * transaction outgrows it, so it must only use blocks it keeps pinned.
+ * Cleared by `journal_init`.
+ *
+ * @param hook The function, NULL for none.
+ */
+void journal_set_commit_hook(void (*hook)());
+
+/**
+ * @brief Sets or clears, in a block bitmap, the bits of runs freed by transactions not safely on the media yet.
+ *
+ * Until the transaction freeing a run is on the media, a crash brings back
+ * the metadata that pointed at it, so the run must not take new contents.
+ * The allocator sets the bits around its search to skip those runs, and
+ * clears them again after.
+ *
+ * @param bitmap The bitmap, a bit per block.
+ * @param first_block Block of the bitmap's first bit.
+ * @param block_count Blocks the bitmap covers.
+ * @param set Whether to set the bits or clear them.
+ */
+void journal_mask_unsettled(uint32_t* bitmap, uint32_t first_block, uint32_t block_count, bool set);
+
+/**
+ * @brief Whether any run is held back by `journal_mask_unsettled`.
+ *
+ * A commit followed by `journal_barrier` lets go of all of them.
+ */
+bool journal_has_unsettled();
+
+/**
+ * @brief Blocks logged by the running transaction.
+ */
+uint32_t journal_running_blocks();
+
+/**
+ * @brief Writes the running transaction to the journal.
+ *
+ * Dirty file data is written home first, so committed metadata never points
+ * at blocks holding stale data. The logged blocks are left dirty in the cache
+ * and reach their home location whenever the cache writes them back.
+ * A write barrier keeps the data and the log ahead of the commit block, which
+ * may still be in the drive's cache on return.
+ */
+void journal_commit();
+
+/**
+ * @brief Makes sure the last commit block is on the media.
+ *
+ * A commit block is written after a barrier, but may then sit in the drive's
+ * write cache. Committed blocks can only go home once it is out, so the
+ * cache calls this before writing one back, and sync() on the way out.
+ */
+void journal_barrier();
+
+/**
+ * @brief Writes every committed block home and empties the journal.
+ *
+ * Runs on its own when the log runs out of room, and on shutdown so a clean
+ * disk mounts without replay.
+ */
+void journal_checkpoint();
+
+#endif // JOURNAL_H
@@ -0,0 +1,39 @@
+#ifndef LZ4_H
+#define LZ4_H
+
+#include <stdint.h>
+#include <stdbool.h>
+
+// LZ4 block format, without the frame around it
+// Source: https://github.com/lz4/lz4/blob/dev/doc/lz4_Block_format.md
+#define LZ4_INPUT_MAX 65535     // match positions are kept in 16 bits
+#define LZ4_HASH_BITS 12        // entries in the match finder's table, as a power of 2
+
+/**
+ * @brief Compresses a buffer into an LZ4 block.
+ *
+ * Matches are found greedily through a single hash table, fast rather than
+ * thorough.
+ *
+ * @param src The data to compress, at most LZ4_INPUT_MAX bytes.
+ * @param length The number of bytes in `src`.
+ * @param dst Receives the compressed block.
+ * @param capacity The size of `dst`.
+ * @return The size of the compressed block, 0 if it doesn't fit in `capacity`.
+ */
+uint32_t lz4_compress(const uint8_t* src, uint32_t length, uint8_t* dst, uint32_t capacity);
+
+/**
+ * @brief Expands an LZ4 block.
+ *
+ * Every length and offset is checked, a corrupt block can't write outside of `dst`.
+ *
+ * @param src The compressed block.
+ * @param length The size of the compressed block.
+ * @param dst Receives the data.
+ * @param capacity The size of `dst`.
+ * @return The number of bytes written to `dst`, -1 if the block is corrupt or doesn't fit.
+ */
+int32_t lz4_decompress(const uint8_t* src, uint32_t length, uint8_t* dst, uint32_t capacity);
+
+#endif // LZ4_H
@@ -37,5 +37,6 @@ page_table_t* create_page_table();
 int map_page(void* physaddr, void* virtualaddr, unsigned int flags);
 void load_process(uint32_t* process_memory, size_t process_size, uint32_t base_virtual_address);
 void enable_paging(page_directory_t* page_directory);
+void* get_physaddr(void* virtualaddr);
 
 #endif // PAGING_H
@@ -0,0 +1,52 @@
+#ifndef PCI_H
+#define PCI_H
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <asm/cpu_io.h>
+
+// https://wiki.osdev.org/PCI, configuration space access mechanism #1
+#define PCI_CONFIG_ADDRESS     0xCF8
+#define PCI_CONFIG_DATA        0xCFC
+
+// configuration space registers, read 32 bits at a time
+#define PCI_REG_ID             0x00  // vendor, then device
+#define PCI_REG_COMMAND        0x04  // command, then status
+#define PCI_REG_CLASS          0x08  // revision, prog if, subclass, class
+#define PCI_REG_HEADER         0x0C  // header type in bits 16-23
+#define PCI_REG_BAR4           0x20
+
+#define PCI_CMD_IO             0x1
+#define PCI_CMD_BUS_MASTER     0x4
+#define PCI_BAR_IO             0x1   // the BAR holds an I/O port, not a memory address
+#define PCI_HEADER_MULTI       0x80  // the device has functions past 0
+#define PCI_NO_VENDOR          0xFFFF
+
+#define PCI_CLASS_STORAGE      0x01
+#define PCI_SUBCLASS_IDE       0x01
+#define PCI_IDE_BUS_MASTER     0x80  // in the prog if, the controller can do DMA
+
+/**
+ * @brief A function of a device on the PCI bus.
+ */
+typedef struct {
+    uint8_t bus;
+    uint8_t slot;
+    uint8_t function;
+    uint8_t prog_if;    // Programming interface, from PCI_REG_CLASS.
+} PciDevice;
+
+uint32_t pci_config_read(PciDevice device, uint8_t offset);
+void pci_config_write(PciDevice device, uint8_t offset, uint32_t value);
+
+/**
+ * @brief Finds the first device of a class on the PCI bus.
+ *
+ * @param class_code The class of device.
+ * @param subclass The subclass within it.
+ * @param device Receives the device found.
+ * @return true if one was found.
+ */
+bool pci_find_class(uint8_t class_code, uint8_t subclass, PciDevice* device);
+
+#endif // PCI_H
@@ -16,6 +16,7 @@ void* memmove(void* dst, const void* src, size_t count);
 int strcmp(const char* s1, const char* s2);
 char* strcpy(char* dest, const char* src);
 uint32_t strcat(const char* src, char* dst);
+uint32_t strhash(const char* str);
 
 // causes an error because string.h is imported by multiple source files
 // void test_funct() {}
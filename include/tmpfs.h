@@ -0,0 +1,29 @@
+#ifndef TMPFS_H
+#define TMPFS_H
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <vfs.h>
+
+// In-memory file system, nothing in it ever reaches the disk and it starts
+// out empty on every boot. Every tmpfs mount shares one table of nodes and
+// one pool of pages, a file's pages are chained like a FAT.
+#define TMPFS_NODES_MAX 64      // files and directories, a mount's root included
+#define TMPFS_PAGE_BYTES 512
+#define TMPFS_PAGES 128         // 64 KiB for the data of every tmpfs file
+#define TMPFS_NO_PAGE 0xFF      // ends a chain of pages
+
+/**
+ * @brief Forgets every tmpfs file, the mounts have to be gone too.
+ */
+void tmpfs_init();
+
+/**
+ * @brief Mounts a new, empty tmpfs on a directory.
+ *
+ * @param path The absolute path of the mount point, see `mount`.
+ * @return -1 on failure, or 0 on success.
+ */
+int32_t tmpfs_mount(const char* path);
+
+#endif // TMPFS_H
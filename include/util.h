@@ -43,6 +43,21 @@ void panic(const char* msg);
  */
 BitRange alloc_bitrange(uint32_t* bitmap, uint32_t capacity, uint32_t count, bool word_align);
 
+/**
+ * @brief Allocates the longest run of free bits available, up to `count`.
+ *
+ * The search begins at `goal` and wraps around to the start of the bitmap.
+ * The first run of `count` free bits is taken; if no run is that long, the
+ * longest run found is taken instead, so callers may get less than they asked for.
+ *
+ * @param bitmap The bitmap to allocate from.
+ * @param capacity The number of bits within the bitmap.
+ * @param goal The bit to start searching from, to keep allocations close together.
+ * @param count The desired number of contiguous bits.
+ * @return The allocated bit range, with length 0 if the bitmap is full.
+ */
+BitRange alloc_bitrange_near(uint32_t* bitmap, uint32_t capacity, uint32_t goal, uint32_t count);
+
 /**
  * @brief Deallocates a range of bits in a bitmap.
  * 
@@ -0,0 +1,96 @@
+#ifndef VFS_H
+#define VFS_H
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <fs.h>
+
+// Virtual file system: the path calls of fs.h (`create_filetype`, `open`,
+// `unlink`, `stat`, `rename` and the ones built on them) look the path up in
+// a table of mount points and hand it to the file system mounted there. The
+// disk is mounted on "/", file systems mounted on its directories cover them.
+// Source: https://www.kernel.org/doc/html/latest/filesystems/vfs.html
+
+#define MOUNTS_MAX 8
+#define MOUNT_PATH_MAX 32 // longest mount point, with its terminator
+
+struct Mount;
+
+/**
+ * @brief Operations of a kind of file system on the paths within it.
+ *
+ * Each path handed to them is absolute within the file system, the mount
+ * point cut off the front, so a file system mounted on /dev sees "/dev/tty"
+ * as "/tty" and "/dev" as "/". The file descriptors they open carry the
+ * file system's own FileOps.
+ */
+typedef struct FileSystemOps {
+	const char* name;   // shown by the shell's mount command
+	int64_t (*create)(const struct Mount* mount, const char* path, uint8_t file_type, bool allocate_fd);
+	int64_t (*open)(const struct Mount* mount, const char* path);
+	int32_t (*unlink)(const struct Mount* mount, const char* path);
+	int32_t (*stat)(const struct Mount* mount, const char* path, FileStat* st);
+	int32_t (*rename)(const struct Mount* mount, const char* old_path, const char* new_path);
+	int32_t (*unmount)(const struct Mount* mount); // refuses while the file system is in use
+} FileSystemOps;
+
+/**
+ * @brief A file system mounted on a directory.
+ */
+typedef struct Mount {
+	char path[MOUNT_PATH_MAX];  // Mount point without a trailing '/', "" for the root.
+	const FileSystemOps* ops;   // NULL while the slot is unused.
+	uint32_t root;              // The file system's own number for its root directory.
+} Mount;
+
+/**
+ * @brief Empties the mount table.
+ */
+void vfs_init();
+
+/**
+ * @brief Mounts a file system on a directory.
+ *
+ * The first mount has to be on "/". Any later one needs an existing
+ * directory that nothing is mounted on yet, whatever was in it stays hidden
+ * until the file system is unmounted.
+ *
+ * @param path The absolute path of the mount point.
+ * @param ops The kind of file system.
+ * @param root Its root directory, handed back through `Mount` to its operations.
+ * @return -1 on failure, or 0 on success.
+ */
+int32_t mount(const char* path, const FileSystemOps* ops, uint32_t root);
+
+/**
+ * @brief Unmounts the file system mounted on a directory.
+ *
+ * The root stays mounted, and so does a file system with another mounted
+ * within it or that its `unmount` operation holds on to.
+ *
+ * @param path The absolute path of the mount point.
+ * @return -1 on failure, or 0 on success.
+ */
+int32_t umount(const char* path);
+
+/**
+ * @brief Finds the file system a path leads into.
+ *
+ * The mount point with the longest match wins, so paths cross into file
+ * systems mounted within other mounted file systems too.
+ *
+ * @param path An absolute path.
+ * @param rest Receives the path within the file system.
+ * @return The mount the path leads into.
+ */
+const Mount* vfs_resolve(const char* path, const char** rest);
+
+/**
+ * @brief Walks the mount table.
+ *
+ * @param index The slot to look at, from 0 up to MOUNTS_MAX.
+ * @return The mount in the slot, or NULL if the slot is unused.
+ */
+const Mount* vfs_mount_at(uint32_t index);
+
+#endif // VFS_H
@@ -1,67 +1,317 @@
 #include <ata.h>
+#include <pci.h>
+#include <paging.h>
+#include <interrupts.h>
+#include <util.h>
+#include <vga.h>
 
 // https://wiki.osdev.org/ATA_PIO_Mode
+// https://wiki.osdev.org/ATA/ATAPI_using_DMA
+
+// I/O base of the controller's bus master registers, 0 while transfers go through PIO
+static uint16_t bus_master_base = 0;
+
+// what ata_init learned from IDENTIFY
+static bool lba48 = false;            // the drive takes the EXT commands, with 48 bit addresses
+static uint32_t multiple_sectors = 1; // sectors per DRQ block of READ/WRITE MULTIPLE, 1 while those aren't set up
+
+/**
+ * @brief An entry of the PRD table, one physically contiguous piece of a DMA buffer.
+ */
+typedef struct __attribute__((packed)) {
+    uint32_t phys_addr;
+    uint16_t byte_count;    // 0 stands for 64 KiB
+    uint16_t flags;         // ATA_PRD_END on the last entry
+} PhysRegionDesc;
+
+// a 512 byte aligned table of 64 entries can't cross a 64 KiB boundary, which the controller requires
+#define ATA_PRD_ENTRIES 64
+static PhysRegionDesc prd_table[ATA_PRD_ENTRIES] __attribute__((aligned(512)));
+
+// sectors one command can move, the count register is 8 bits wide, 16 with LBA48, and 0 stands for the most
+#define ATA_MAX_SECTORS        256
+#define ATA_MAX_SECTORS_EXT    65536
 
 static void ata_wait_ready() {
     while (inb(ATA_REG_STATUS) & ATA_SR_BSY);
 }
 
-static void ata_cache_flush() {
-    ata_wait_ready();
-    outb(ATA_REG_COMMAND, ATA_CMD_CACHE_FLUSH);
-    ata_wait_ready();
+// whether sectors were written since the drive's cache was last flushed
+static bool write_cache_dirty = false;
+
+// whether IRQ14 reaches ata_irq_handler, until then every wait polls
+static bool irq_installed = false;
+// set by the handler, cleared before each command or data phase that ends with an interrupt
+static volatile bool irq_fired = false;
+
+static void ata_irq_handler(Registers* r) {
+    UNUSED(r);
+    inb(ATA_REG_STATUS); // acknowledges the interrupt on the drive
+    irq_fired = true;
+}
+
+// sleeps until the drive raises IRQ14 after the command or data phase started since irq_fired was cleared
+// polls instead while the interrupt can't come through, early in boot or with interrupts masked by the caller
+static void ata_wait_irq() {
+    if (!irq_installed || !interrupts_enabled()) {
+        ata_wait_ready();
+        return;
+    }
+    disable_interrupts();
+    while (!irq_fired) {
+        wait_for_interrupt(); // the timer, keyboard and serial handlers keep running meanwhile
+    }
+    enable_interrupts();
 }
 
-void ata_read_sectors(uint32_t lba, uint32_t sector_count, const uint8_t* buffer) { 
+// programs the drive, address and sector count of a transfer, the command is left to the caller
+static void ata_setup_transfer(uint64_t lba, uint32_t sector_count) {
     ata_wait_ready();
 
-    // Select drive (Master)
-    outb(ATA_REG_DRIVE_SELECT, 0xE0 | ((lba >> 24) & 0x0F));
+    if (lba48) {
+        outb(ATA_REG_DRIVE_SELECT, 0x40); // Master, LBA
+        outb(ATA_REG_ERROR, 0x00); // Waste time
+
+        // the high bytes go first, each register keeps the byte written before the last one
+        outb(ATA_REG_SECCOUNT, (uint8_t)(sector_count >> 8));
+        outb(ATA_REG_LBA0, (uint8_t)((lba >> 24) & 0xFF));
+        outb(ATA_REG_LBA1, (uint8_t)((lba >> 32) & 0xFF));
+        outb(ATA_REG_LBA2, (uint8_t)((lba >> 40) & 0xFF));
+    } else {
+        // Select drive (Master)
+        outb(ATA_REG_DRIVE_SELECT, 0xE0 | ((lba >> 24) & 0x0F));
 
-    // Waste time
-    outb(ATA_REG_ERROR, 0x00);
+        // Waste time
+        outb(ATA_REG_ERROR, 0x00);
+    }
 
-    outb(ATA_REG_SECCOUNT, sector_count); // Read one sector
+    outb(ATA_REG_SECCOUNT, (uint8_t)sector_count);
     outb(ATA_REG_LBA0, (uint8_t)(lba & 0xFF));
     outb(ATA_REG_LBA1, (uint8_t)((lba >> 8) & 0xFF));
     outb(ATA_REG_LBA2, (uint8_t)((lba >> 16) & 0xFF));
-    outb(ATA_REG_COMMAND, ATA_CMD_READ_SECTORS);
+    irq_fired = false;
+}
 
-    ata_wait_ready();
+// walks the segments of a transfer a sector at a time
+typedef struct {
+    const AtaSegment* segment;
+    uint32_t sector; // within the segment
+} SegmentCursor;
 
-    for (uint8_t sector = 0; sector < sector_count; sector++) {
-        while (!(inb(ATA_REG_STATUS) & ATA_SR_DRQ));
-        // NOTE: If bytes are entered in small endian, does it call it back the right way
-        rep_insw(ATA_REG_DATA, (void*)(&buffer[sector * SECTOR_BYTES]), SECTOR_WORDS); // 256 words (512 bytes)
+// the sector under the cursor, which then moves on to the next one
+static const uint8_t* cursor_next(SegmentCursor* cursor) {
+    const uint8_t* sector = cursor->segment->buffer + cursor->sector * SECTOR_BYTES;
+    if (++cursor->sector == cursor->segment->sector_count) {
+        cursor->segment++;
+        cursor->sector = 0;
     }
+    return sector;
 }
 
-void ata_write_sectors(uint32_t lba, uint32_t sector_count, const uint8_t* buffer) {
+static void cursor_skip(SegmentCursor* cursor, uint32_t sector_count) {
+    while (sector_count--) {
+        cursor_next(cursor);
+    }
+}
+
+// adds `bytes` at `buffer` to the PRD table, one entry per physically contiguous run of its pages
+// false if they can't be, some of them may have gone in
+static bool prd_add(const uint8_t* buffer, uint32_t bytes, uint32_t* entries) {
+    while (bytes) {
+        uint32_t phys = (uint32_t)get_physaddr((void*)buffer);
+        uint32_t length = PAGE_SIZE - ((uint32_t)buffer & (PAGE_SIZE - 1)); // up to the end of the page
+        if (length > bytes) {
+            length = bytes;
+        }
+        if (phys & 1) {
+            return false; // the controller moves whole words
+        }
+
+        PhysRegionDesc* last = *entries ? &prd_table[*entries - 1] : NULL;
+        uint32_t last_bytes = (last && last->byte_count == 0) ? 0x10000 : (last ? last->byte_count : 0);
+        if (last && last->phys_addr + last_bytes == phys && (last->phys_addr >> 16) == ((phys + length - 1) >> 16)) {
+            last->byte_count = last_bytes + length; // 64 KiB wraps to 0, as it should
+        } else {
+            if (*entries == ATA_PRD_ENTRIES) {
+                return false;
+            }
+            prd_table[(*entries)++] = (PhysRegionDesc){.phys_addr = phys, .byte_count = length, .flags = 0};
+        }
+        buffer += length;
+        bytes -= length;
+    }
+    return true;
+}
+
+// describes the next sectors of the transfer to the controller, as many as fit the table
+// returns how many did, 0 if DMA can't move the first one, the transfer then goes through PIO
+static uint32_t build_prd_table(SegmentCursor cursor, uint32_t sector_count) {
+    uint32_t entries = 0;
+    uint32_t sectors = 0;
+    while (sectors < sector_count) {
+        uint32_t entries_before = entries;
+        uint16_t last_count_before = entries ? prd_table[entries - 1].byte_count : 0;
+        if (!prd_add(cursor_next(&cursor), SECTOR_BYTES, &entries)) {
+            // the command ends with the sector before
+            entries = entries_before;
+            if (entries) {
+                prd_table[entries - 1].byte_count = last_count_before;
+            }
+            break;
+        }
+        sectors++;
+    }
+    if (sectors) {
+        prd_table[entries - 1].flags = ATA_PRD_END;
+    }
+    return sectors;
+}
+
+// moves up to `sector_count` sectors with bus master DMA, the CPU only sets the transfer up and waits for the end
+// returns how many it moved, 0 if DMA isn't available for them
+static uint32_t ata_dma_transfer(uint64_t lba, uint32_t sector_count, SegmentCursor cursor, bool write) {
+    if (!bus_master_base || !(sector_count = build_prd_table(cursor, sector_count))) {
+        return 0;
+    }
+    uint8_t direction = write ? 0 : ATA_BM_CMD_READ;
+    outl(bus_master_base + ATA_BM_REG_PRDT, (uint32_t)get_physaddr(prd_table));
+    outb(bus_master_base + ATA_BM_REG_COMMAND, direction);
+    outb(bus_master_base + ATA_BM_REG_STATUS, ATA_BM_SR_ERROR | ATA_BM_SR_IRQ);
+
+    ata_setup_transfer(lba, sector_count);
+    if (lba48) {
+        outb(ATA_REG_COMMAND, write ? ATA_CMD_WRITE_DMA_EXT : ATA_CMD_READ_DMA_EXT);
+    } else {
+        outb(ATA_REG_COMMAND, write ? ATA_CMD_WRITE_DMA : ATA_CMD_READ_DMA);
+    }
+    outb(bus_master_base + ATA_BM_REG_COMMAND, direction | ATA_BM_CMD_START);
+
+    // the controller flags the drive's interrupt once the last sector is through
+    ata_wait_irq();
+    uint8_t bm_status;
+    while (!((bm_status = inb(bus_master_base + ATA_BM_REG_STATUS)) & (ATA_BM_SR_IRQ | ATA_BM_SR_ERROR)));
+    outb(bus_master_base + ATA_BM_REG_COMMAND, direction);
+    outb(bus_master_base + ATA_BM_REG_STATUS, ATA_BM_SR_ERROR | ATA_BM_SR_IRQ);
 
     ata_wait_ready();
+    uint8_t status = inb(ATA_REG_STATUS); // also acknowledges the drive's interrupt
+    if ((bm_status & ATA_BM_SR_ERROR) || (status & ATA_SR_ERR)) {
+        // NOTE: the transfer is redone through PIO, DMA stays off from here on
+        kprintf("ata: DMA transfer failed, falling back to PIO\n");
+        bus_master_base = 0;
+        return 0;
+    }
+    return sector_count;
+}
 
-    // Select drive (Master)
-    outb(ATA_REG_DRIVE_SELECT, 0xE0 | ((lba >> 24) & 0x0F));
+void ata_flush() {
+    if (!write_cache_dirty) {
+        return;
+    }
+    write_cache_dirty = false;
+    ata_wait_ready();
+    irq_fired = false;
+    outb(ATA_REG_COMMAND, lba48 ? ATA_CMD_CACHE_FLUSH_EXT : ATA_CMD_CACHE_FLUSH);
+    ata_wait_irq();
+    ata_wait_ready();
+}
 
-    // Waste time
-    outb(ATA_REG_ERROR, 0x00);
+// the PIO read or write command for the drive, MULTIPLE ones move a DRQ block of several sectors per handshake
+static uint8_t ata_pio_command(bool write) {
+    if (multiple_sectors > 1) {
+        if (lba48) {
+            return write ? ATA_CMD_WRITE_MULTIPLE_EXT : ATA_CMD_READ_MULTIPLE_EXT;
+        }
+        return write ? ATA_CMD_WRITE_MULTIPLE : ATA_CMD_READ_MULTIPLE;
+    }
+    if (lba48) {
+        return write ? ATA_CMD_WRITE_SECTORS_EXT : ATA_CMD_READ_SECTORS_EXT;
+    }
+    return write ? ATA_CMD_WRITE_SECTORS : ATA_CMD_READ_SECTORS;
+}
 
-    outb(ATA_REG_SECCOUNT, (uint8_t)sector_count); // Read one sector
-    outb(ATA_REG_LBA0, (uint8_t)(lba & 0xFF));
-    outb(ATA_REG_LBA1, (uint8_t)((lba >> 8) & 0xFF));
-    outb(ATA_REG_LBA2, (uint8_t)((lba >> 16) & 0xFF));
-    outb(ATA_REG_COMMAND, ATA_CMD_WRITE_SECTORS);
+static void ata_pio_read(uint64_t lba, uint32_t sector_count, SegmentCursor* cursor) {
+    ata_setup_transfer(lba, sector_count);
+    outb(ATA_REG_COMMAND, ata_pio_command(false));
+
+    for (uint32_t sector = 0; sector < sector_count; sector += multiple_sectors) {
+        uint32_t block_sectors = (sector_count - sector < multiple_sectors) ? sector_count - sector : multiple_sectors;
+        // the drive interrupts once each DRQ block is ready, the next one only after this one is read
+        ata_wait_irq();
+        irq_fired = false;
+        while (!(inb(ATA_REG_STATUS) & ATA_SR_DRQ));
+        for (uint32_t i = 0; i < block_sectors; i++) {
+            // NOTE: If bytes are entered in small endian, does it call it back the right way
+            rep_insw(ATA_REG_DATA, (void*)cursor_next(cursor), SECTOR_WORDS); // 256 words (512 bytes)
+        }
+    }
+}
+
+static void ata_pio_write(uint64_t lba, uint32_t sector_count, SegmentCursor* cursor) {
+    ata_setup_transfer(lba, sector_count);
+    outb(ATA_REG_COMMAND, ata_pio_command(true));
 
-    for (uint8_t sector = 0; sector < sector_count; sector++) {
+    // no interrupt for the first DRQ block, then one after each block is taken
+    for (uint32_t sector = 0; sector < sector_count; sector += multiple_sectors) {
+        uint32_t block_sectors = (sector_count - sector < multiple_sectors) ? sector_count - sector : multiple_sectors;
         while (!(inb(ATA_REG_STATUS) & ATA_SR_DRQ));
-        for (uint32_t sw = 0; sw < SECTOR_WORDS; sw++) {
-            // looks like big endian
-            outsw(ATA_REG_DATA, ((uint16_t)buffer[sector * SECTOR_BYTES + sw * 2 + 1]) << 8
-            | (uint16_t)(buffer[sector * SECTOR_BYTES + sw * 2]));
+        irq_fired = false;
+        for (uint32_t i = 0; i < block_sectors; i++) {
+            const uint8_t* data = cursor_next(cursor);
+            for (uint32_t sw = 0; sw < SECTOR_WORDS; sw++) {
+                // looks like big endian
+                outsw(ATA_REG_DATA, ((uint16_t)data[sw * 2 + 1]) << 8 | (uint16_t)(data[sw * 2]));
+            }
         }
+        ata_wait_irq();
+    }
+}
+
+// moves the segments as one run of sectors from `lba` on, in as few commands as the drive allows
+static void ata_transfer(uint64_t lba, const AtaSegment* segments, uint32_t segment_count, bool write) {
+    uint32_t sector_count = 0;
+    for (uint32_t i = 0; i < segment_count; i++) {
+        sector_count += segments[i].sector_count;
     }
+    if (write) {
+        write_cache_dirty = true; // the sectors may sit in the drive's write cache until the next ata_flush
+    }
+
+    SegmentCursor cursor = {.segment = segments, .sector = 0};
+    uint32_t max_sectors = lba48 ? ATA_MAX_SECTORS_EXT : ATA_MAX_SECTORS;
+    while (sector_count) {
+        uint32_t chunk = (sector_count < max_sectors) ? sector_count : max_sectors;
+        uint32_t moved = ata_dma_transfer(lba, chunk, cursor, write);
+        if (moved) {
+            cursor_skip(&cursor, moved);
+        } else if (write) {
+            ata_pio_write(lba, chunk, &cursor);
+            moved = chunk;
+        } else {
+            ata_pio_read(lba, chunk, &cursor);
+            moved = chunk;
+        }
+        lba += moved;
+        sector_count -= moved;
+    }
+}
+
+void ata_read_sectors(uint64_t lba, uint32_t sector_count, const uint8_t* buffer) {
+    AtaSegment segment = {.buffer = buffer, .sector_count = sector_count};
+    ata_transfer(lba, &segment, 1, false);
+}
+
+void ata_write_sectors(uint64_t lba, uint32_t sector_count, const uint8_t* buffer) {
+    AtaSegment segment = {.buffer = buffer, .sector_count = sector_count};
+    ata_transfer(lba, &segment, 1, true);
+}
+
+void ata_read_segments(uint64_t lba, const AtaSegment* segments, uint32_t segment_count) {
+    ata_transfer(lba, segments, segment_count, false);
+}
 
-    ata_cache_flush();
+void ata_write_segments(uint64_t lba, const AtaSegment* segments, uint32_t segment_count) {
+    ata_transfer(lba, segments, segment_count, true);
 }
 
 void ata_select_drive(int is_master) {
@@ -98,15 +348,82 @@ uint64_t ata_get_disk_size() {
     ata_identify();
     ata_wait();
     ata_read_buffer(ata_buffer);
-    uint32_t total_sectors = ((uint32_t)ata_buffer[61] << 16) | ata_buffer[60];
-    return (uint64_t)total_sectors * 512; // Convert to bytes
+    uint64_t total_sectors = ((uint32_t)ata_buffer[61] << 16) | ata_buffer[60];
+    if (ata_buffer[83] & (1 << 10)) {
+        // LBA48 drives count their sectors in words 100 to 103, the LBA28 count stops at 128 GiB
+        total_sectors = ((uint64_t)ata_buffer[103] << 48) | ((uint64_t)ata_buffer[102] << 32)
+            | ((uint64_t)ata_buffer[101] << 16) | ata_buffer[100];
+    }
+    return total_sectors * 512; // Convert to bytes
+}
+
+// READ/WRITE MULTIPLE then move up to `max_sectors` per DRQ block, with one interrupt for all of them
+static void ata_set_multiple(uint32_t max_sectors) {
+    uint32_t sectors = 1;
+    while (sectors * 2 <= max_sectors) {
+        sectors *= 2;
+    }
+    if (sectors == 1) {
+        return;
+    }
+
+    ata_wait_ready();
+    outb(ATA_REG_DRIVE_SELECT, ATA_MASTER);
+    outb(ATA_REG_SECCOUNT, sectors);
+    irq_fired = false;
+    outb(ATA_REG_COMMAND, ATA_CMD_SET_MULTIPLE);
+    ata_wait_irq();
+    if (inb(ATA_REG_STATUS) & ATA_SR_ERR) {
+        kprintf("ata: drive refused %u sectors per DRQ block, moving one at a time\n", sectors);
+        return;
+    }
+    multiple_sectors = sectors;
+}
+
+static void ata_init_dma(const uint16_t* identify) {
+    PciDevice ide;
+    if (!pci_find_class(PCI_CLASS_STORAGE, PCI_SUBCLASS_IDE, &ide) || !(ide.prog_if & PCI_IDE_BUS_MASTER)) {
+        kprintf("ata: no bus master IDE controller, using PIO\n");
+        return;
+    }
+    uint32_t bar4 = pci_config_read(ide, PCI_REG_BAR4);
+    if (!(bar4 & PCI_BAR_IO)) {
+        kprintf("ata: bus master registers aren't in I/O space, using PIO\n");
+        return;
+    }
+
+    if (!(identify[49] & (1 << 8))) {
+        kprintf("ata: drive can't do DMA, using PIO\n");
+        return;
+    }
+
+    // the status half goes back as 0, its bits only clear when written with 1
+    uint32_t command = pci_config_read(ide, PCI_REG_COMMAND) & 0xFFFF;
+    pci_config_write(ide, PCI_REG_COMMAND, command | PCI_CMD_IO | PCI_CMD_BUS_MASTER);
+    bus_master_base = bar4 & 0xFFFC;
+}
+
+void ata_init() {
+    uint16_t ata_buffer[256];
+    ata_identify();
+    ata_wait();
+    ata_read_buffer(ata_buffer);
+    lba48 = ata_buffer[83] & (1 << 10);
+    ata_set_multiple(ata_buffer[47] & 0xFF); // the largest DRQ block the drive takes
+    ata_init_dma(ata_buffer);
+}
+
+void ata_irq_install() {
+    irq_install_handler(ATA_IRQ, ata_irq_handler);
+    irq_installed = true;
+    outb(ATA_REG_CONTROL, 0); // clears nIEN, the drive may interrupt
 }
 
 void ata_read_blocks(uint32_t block_num, const uint8_t* buffer, uint32_t count) {
-    ata_read_sectors(block_num * SECTORS_PER_BLOCK, SECTORS_PER_BLOCK * count, buffer);
+    ata_read_sectors((uint64_t)block_num * SECTORS_PER_BLOCK, SECTORS_PER_BLOCK * count, buffer);
 }
 
 // these are wasteful, just writes past buffer, regardless of length
 void ata_write_blocks(uint32_t block_num, const uint8_t* buffer, uint32_t count) {
-    ata_write_sectors(block_num * SECTORS_PER_BLOCK, SECTORS_PER_BLOCK * count, buffer);
+    ata_write_sectors((uint64_t)block_num * SECTORS_PER_BLOCK, SECTORS_PER_BLOCK * count, buffer);
 }
@@ -0,0 +1,329 @@
+#include <bcache.h>
+#include <ata.h>
+#include <string.h>
+#include <util.h>
+#include <journal.h>
+#include <crc32c.h>
+#include <blkq.h>
+
+// Block buffer cache sitting between the file system and the ATA driver
+// Source: https://pages.cs.wisc.edu/~remzi/OSTEP/file-implementation.pdf (Caching and Buffering)
+
+#define NO_BLOCK 0xFFFFFFFF // block_num of a buffer holding nothing
+#define BUCKET(block_num) ((block_num) & (BCACHE_BUCKETS - 1))
+
+static uint8_t bcache_data[BCACHE_BLOCKS][BLOCK_BYTES];
+static uint8_t bcache_staging[BCACHE_BATCH_BLOCKS * BLOCK_BYTES]; // gathers runs of blocks into one transfer
+static CacheBlock bcache_blocks[BCACHE_BLOCKS];
+static CacheBlock* bcache_buckets[BCACHE_BUCKETS];
+static CacheBlock* lru_head = NULL; // most recently used
+static CacheBlock* lru_tail = NULL; // least recently used
+
+static void lru_unlink(CacheBlock* block) {
+	if (block->lru_prev) {
+		block->lru_prev->lru_next = block->lru_next;
+	} else {
+		lru_head = block->lru_next;
+	}
+	if (block->lru_next) {
+		block->lru_next->lru_prev = block->lru_prev;
+	} else {
+		lru_tail = block->lru_prev;
+	}
+	block->lru_prev = NULL;
+	block->lru_next = NULL;
+}
+
+static void lru_push_front(CacheBlock* block) {
+	block->lru_prev = NULL;
+	block->lru_next = lru_head;
+	if (lru_head) {
+		lru_head->lru_prev = block;
+	}
+	lru_head = block;
+	if (!lru_tail) {
+		lru_tail = block;
+	}
+}
+
+static void lru_push_back(CacheBlock* block) {
+	block->lru_next = NULL;
+	block->lru_prev = lru_tail;
+	if (lru_tail) {
+		lru_tail->lru_next = block;
+	}
+	lru_tail = block;
+	if (!lru_head) {
+		lru_head = block;
+	}
+}
+
+static CacheBlock* hash_lookup(uint32_t block_num) {
+	CacheBlock* block = bcache_buckets[BUCKET(block_num)];
+	while (block && block->block_num != block_num) {
+		block = block->hash_next;
+	}
+	return block;
+}
+
+static void hash_insert(CacheBlock* block) {
+	block->hash_next = bcache_buckets[BUCKET(block->block_num)];
+	bcache_buckets[BUCKET(block->block_num)] = block;
+}
+
+// forgets what the buffer held, it is about to hold another block or nothing
+static void reset_block(CacheBlock* block) {
+	block->valid = false;
+	block->dirty = false;
+	block->writeback = BCACHE_UNJOURNALED;
+	block->unchecked = false;
+	block->checksum_stride = 0;
+	block->checksum_offset = 0;
+}
+
+static void hash_remove(CacheBlock* block) {
+	CacheBlock** link = &bcache_buckets[BUCKET(block->block_num)];
+	while (*link && *link != block) {
+		link = &(*link)->hash_next;
+	}
+	if (*link) {
+		*link = block->hash_next;
+	}
+	block->hash_next = NULL;
+	block->block_num = NO_BLOCK;
+}
+
+// dirty, and allowed on disk
+static bool writable(CacheBlock* block) {
+	return block && block->dirty && (block->writeback == BCACHE_UNJOURNALED || block->writeback == BCACHE_COMMITTED);
+}
+
+// writes a dirty block back together with the dirty blocks adjacent to it on disk
+static void write_cluster(CacheBlock* block) {
+	uint32_t first = block->block_num;
+	while (first > 0 && block->block_num - first < BCACHE_BATCH_BLOCKS - 1 && writable(hash_lookup(first - 1))) {
+		first--;
+	}
+
+	uint32_t count = 0;
+	CacheBlock* neighbour;
+	while (count < BCACHE_BATCH_BLOCKS && writable(neighbour = hash_lookup(first + count))) {
+		if (neighbour->writeback == BCACHE_COMMITTED) {
+			journal_barrier();
+		}
+		bcache_seal(neighbour);
+		memcpy(bcache_staging + count * BLOCK_BYTES, neighbour->data, BLOCK_BYTES);
+		neighbour->dirty = false;
+		neighbour->writeback = BCACHE_UNJOURNALED;
+		count++;
+	}
+	ata_write_blocks(first, bcache_staging, count);
+}
+
+// recycles the least recently used buffer that is neither pinned nor held back,
+// writing it back if needed
+static CacheBlock* evict() {
+	CacheBlock* block = lru_tail;
+	while (block && (block->refcount || block->writeback == BCACHE_RUNNING || block->writeback == BCACHE_DELAYED)) {
+		block = block->lru_prev;
+	}
+	if (!block && journal_running_blocks()) {
+		// NOTE: the transaction outgrew the cache, committing it early gives up on
+		// the current operation being atomic but frees its blocks
+		journal_commit();
+		return evict();
+	}
+	if (!block) {
+		PANIC("bcache: every block is pinned");
+		return NULL;
+	}
+
+	if (block->dirty) {
+		write_cluster(block);
+	}
+	if (block->block_num != NO_BLOCK) {
+		hash_remove(block);
+	}
+	reset_block(block);
+	return block;
+}
+
+void bcache_init() {
+	memset(bcache_buckets, 0, sizeof(bcache_buckets));
+	lru_head = NULL;
+	lru_tail = NULL;
+	for (uint32_t i = 0; i < BCACHE_BLOCKS; i++) {
+		CacheBlock* block = &bcache_blocks[i];
+		block->block_num = NO_BLOCK;
+		reset_block(block);
+		block->refcount = 0;
+		block->hash_next = NULL;
+		block->data = bcache_data[i];
+		lru_push_back(block);
+	}
+}
+
+CacheBlock* bcache_get(uint32_t block_num) {
+	CacheBlock* block = hash_lookup(block_num);
+	if (!block) {
+		block = evict();
+		block->block_num = block_num;
+		hash_insert(block);
+	}
+	block->refcount++;
+	lru_unlink(block);
+	lru_push_front(block);
+	return block;
+}
+
+CacheBlock* bcache_read(uint32_t block_num) {
+	CacheBlock* block = bcache_get(block_num);
+	if (!block->valid) {
+		ata_read_blocks(block_num, block->data, 1);
+		block->valid = true;
+		block->unchecked = true;
+	}
+	return block;
+}
+
+CacheBlock* bcache_lookup(uint32_t block_num) {
+	return hash_lookup(block_num);
+}
+
+void bcache_release(CacheBlock* block) {
+	ASSERT(block->refcount > 0, "bcache: releasing an unpinned block");
+	block->refcount--;
+}
+
+CacheBlock* bcache_block_of(const void* ptr) {
+	uint32_t offset = (const uint8_t*)ptr - &bcache_data[0][0];
+	ASSERT(offset < sizeof(bcache_data), "bcache: pointer outside of the cache");
+	return &bcache_blocks[offset / BLOCK_BYTES];
+}
+
+void bcache_mark_dirty(CacheBlock* block) {
+	block->valid = true;
+	block->dirty = true;
+	block->unchecked = false;
+}
+
+void bcache_set_checksum(CacheBlock* block, uint16_t stride, uint16_t offset) {
+	block->checksum_stride = stride;
+	block->checksum_offset = offset;
+}
+
+void bcache_seal(CacheBlock* block) {
+	if (!block->checksum_stride) {
+		return;
+	}
+	for (uint32_t record = 0; record + block->checksum_stride <= BLOCK_BYTES; record += block->checksum_stride) {
+		crc32c_seal(block->data + record, block->checksum_stride, block->checksum_offset);
+	}
+}
+
+void bcache_mark_valid(CacheBlock* block) {
+	block->valid = true;
+}
+
+void bcache_mark_delayed(CacheBlock* block) {
+	block->valid = true;
+	block->dirty = true;
+	block->writeback = BCACHE_DELAYED;
+}
+
+void bcache_rekey(CacheBlock* block, uint32_t block_num) {
+	// whatever was cached of the block before it was freed is stale
+	CacheBlock* stale = hash_lookup(block_num);
+	if (stale) {
+		ASSERT(stale->refcount == 0, "bcache: rekeying onto a pinned block");
+		hash_remove(stale);
+		reset_block(stale);
+		lru_unlink(stale);
+		lru_push_back(stale);
+	}
+
+	hash_remove(block);
+	block->block_num = block_num;
+	hash_insert(block);
+	block->writeback = BCACHE_UNJOURNALED;
+}
+
+// a read queued by bcache_prefetch landed in the block's buffer
+static void prefetch_done(BlockRequest* request) {
+	CacheBlock* block = request->owner;
+	block->valid = true;
+	block->unchecked = true;
+	bcache_release(block);
+}
+
+void bcache_prefetch(uint32_t block_num, uint32_t count) {
+	// leave room for whatever the caller already has pinned
+	if (count > BCACHE_BLOCKS / 2) {
+		count = BCACHE_BLOCKS / 2;
+	}
+
+	for (uint32_t i = 0; i < count; i++) {
+		CacheBlock* block = hash_lookup(block_num + i);
+		if (block && block->valid) {
+			continue;
+		}
+
+		// pinned until the read lands, the queue merges the missing blocks next to each other
+		block = bcache_get(block_num + i);
+		block->io = (BlockRequest){.block_num = block_num + i, .count = 1, .buffer = block->data,
+			.write = false, .done = prefetch_done, .owner = block};
+		blkq_submit(&block->io);
+	}
+	blkq_unplug();
+}
+
+void bcache_discard(uint32_t block_num, uint32_t count) {
+	for (uint32_t i = 0; i < BCACHE_BLOCKS; i++) {
+		CacheBlock* block = &bcache_blocks[i];
+		if (block->block_num == NO_BLOCK || block->block_num < block_num || block->block_num - block_num >= count) {
+			continue;
+		}
+		// a freed block could come back as file data, it must never be sealed as metadata
+		bcache_set_checksum(block, 0, 0);
+		if (!block->refcount) {
+			hash_remove(block);
+			reset_block(block);
+			lru_unlink(block);
+			lru_push_back(block); // first in line to be reused
+		}
+	}
+}
+
+// a write queued by flush_states made it to the disk
+static void writeback_done(BlockRequest* request) {
+	CacheBlock* block = request->owner;
+	block->dirty = false;
+	block->writeback = BCACHE_UNJOURNALED;
+}
+
+// writes back the dirty blocks in any of the journal states of `state_mask`
+static void flush_states(uint32_t state_mask) {
+	// the queue sorts the blocks and merges adjacent ones into a single transfer, straight from their buffers
+	for (uint32_t i = 0; i < BCACHE_BLOCKS; i++) {
+		CacheBlock* block = &bcache_blocks[i];
+		if (!block->dirty || !(state_mask & (1u << block->writeback))) {
+			continue;
+		}
+		if (block->writeback == BCACHE_COMMITTED) {
+			journal_barrier();
+		}
+		bcache_seal(block);
+		block->io = (BlockRequest){.block_num = block->block_num, .count = 1, .buffer = block->data,
+			.write = true, .done = writeback_done, .owner = block};
+		blkq_submit(&block->io);
+	}
+	blkq_unplug();
+}
+
+void bcache_flush() {
+	flush_states((1u << BCACHE_UNJOURNALED) | (1u << BCACHE_COMMITTED));
+}
+
+void bcache_flush_data() {
+	flush_states(1u << BCACHE_UNJOURNALED);
+}
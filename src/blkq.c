@@ -0,0 +1,85 @@
+#include <blkq.h>
+#include <ata.h>
+#include <util.h>
+
+// Block request queue in front of the ATA driver, with a C-LOOK elevator
+// Source: https://pages.cs.wisc.edu/~remzi/OSTEP/file-disks.pdf (Disk Scheduling)
+
+static BlockRequest* queue = NULL;  // sorted by block_num
+static uint32_t queued = 0;
+static uint32_t head_position = 0;  // block after the last one moved, where the sweep carries on
+static AtaSegment merge_segments[BLKQ_MERGE_MAX];
+
+static bool overlaps(const BlockRequest* a, const BlockRequest* b) {
+	return a->block_num < b->block_num + b->count && b->block_num < a->block_num + a->count;
+}
+
+void blkq_submit(BlockRequest* request) {
+	ASSERT(request->count > 0, "blkq: empty request");
+	for (BlockRequest* other = queue; other; other = other->next) {
+		if ((request->write || other->write) && overlaps(request, other)) {
+			blkq_unplug();
+			break;
+		}
+	}
+
+	// after the requests on the same block, which came first
+	BlockRequest** link = &queue;
+	while (*link && (*link)->block_num <= request->block_num) {
+		link = &(*link)->next;
+	}
+	request->next = *link;
+	*link = request;
+
+	if (++queued == BLKQ_DEPTH) {
+		blkq_unplug();
+	}
+}
+
+void blkq_unplug() {
+	while (queue) {
+		// carry on upwards from where the heads are, back to the lowest block once nothing is left above
+		BlockRequest** link = &queue;
+		while (*link && (*link)->block_num < head_position) {
+			link = &(*link)->next;
+		}
+		if (!*link) {
+			link = &queue;
+		}
+
+		// the requests following on from the first one go along in the same command
+		BlockRequest* first = *link;
+		BlockRequest* last = first;
+		uint32_t merged = 0;
+		merge_segments[merged++] = (AtaSegment){.buffer = first->buffer, .sector_count = first->count * SECTORS_PER_BLOCK};
+		while (last->next && merged < BLKQ_MERGE_MAX && last->next->write == first->write
+			&& last->next->block_num == last->block_num + last->count) {
+			last = last->next;
+			merge_segments[merged++] = (AtaSegment){.buffer = last->buffer, .sector_count = last->count * SECTORS_PER_BLOCK};
+		}
+		*link = last->next;
+		queued -= merged;
+
+		uint64_t lba = (uint64_t)first->block_num * SECTORS_PER_BLOCK;
+		if (first->write) {
+			ata_write_segments(lba, merge_segments, merged);
+		} else {
+			ata_read_segments(lba, merge_segments, merged);
+		}
+		head_position = last->block_num + last->count;
+
+		// a callback may queue more, the run is already off the queue
+		BlockRequest* request = first;
+		for (uint32_t i = 0; i < merged; i++) {
+			BlockRequest* next = request->next;
+			if (request->done) {
+				request->done(request);
+			}
+			request = next;
+		}
+	}
+}
+
+uint32_t blkq_pending() {
+	return queued;
+}
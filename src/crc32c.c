@@ -0,0 +1,92 @@
+#include <crc32c.h>
+#include <string.h>
+
+// Slicing-by-8: table k holds the CRC of a byte followed by k zero bytes,
+// so eight table lookups fold in eight bytes at once
+// Source: https://create.stephan-brumme.com/crc32/ (Slicing-by-8)
+static uint32_t crc_tables[CRC32C_SLICES][256];
+static bool tables_ready = false;
+static bool use_sse42 = false;
+
+static uint32_t read32(const uint8_t* p) {
+	return p[0] | (p[1] << 8) | (p[2] << 16) | ((uint32_t)p[3] << 24);
+}
+
+static bool cpu_has_sse42() {
+	uint32_t eax = 1, ebx, ecx, edx;
+	asm volatile ("cpuid" : "+a"(eax), "=b"(ebx), "=c"(ecx), "=d"(edx));
+	return ecx & (1 << 20);
+}
+
+void crc32c_init() {
+	if (tables_ready) {
+		return;
+	}
+	for (uint32_t byte = 0; byte < 256; byte++) {
+		uint32_t crc = byte;
+		for (uint32_t bit = 0; bit < 8; bit++) {
+			crc = (crc >> 1) ^ ((crc & 1) ? CRC32C_POLY : 0);
+		}
+		crc_tables[0][byte] = crc;
+	}
+	for (uint32_t byte = 0; byte < 256; byte++) {
+		for (uint32_t slice = 1; slice < CRC32C_SLICES; slice++) {
+			uint32_t previous = crc_tables[slice - 1][byte];
+			crc_tables[slice][byte] = (previous >> 8) ^ crc_tables[0][previous & 0xFF];
+		}
+	}
+	use_sse42 = cpu_has_sse42();
+	tables_ready = true;
+}
+
+static uint32_t crc32c_tables(uint32_t crc, const uint8_t* p, uint32_t length) {
+	while (length >= CRC32C_SLICES) {
+		uint32_t low = read32(p) ^ crc;
+		uint32_t high = read32(p + 4);
+		crc = crc_tables[7][low & 0xFF] ^ crc_tables[6][(low >> 8) & 0xFF]
+			^ crc_tables[5][(low >> 16) & 0xFF] ^ crc_tables[4][low >> 24]
+			^ crc_tables[3][high & 0xFF] ^ crc_tables[2][(high >> 8) & 0xFF]
+			^ crc_tables[1][(high >> 16) & 0xFF] ^ crc_tables[0][high >> 24];
+		p += CRC32C_SLICES;
+		length -= CRC32C_SLICES;
+	}
+	while (length--) {
+		crc = (crc >> 8) ^ crc_tables[0][(crc ^ *p++) & 0xFF];
+	}
+	return crc;
+}
+
+static uint32_t crc32c_sse42(uint32_t crc, const uint8_t* p, uint32_t length) {
+	while (length >= 4) {
+		asm ("crc32l %1, %0" : "+r"(crc) : "rm"(read32(p)));
+		p += 4;
+		length -= 4;
+	}
+	while (length--) {
+		asm ("crc32b %1, %0" : "+r"(crc) : "rm"(*p++));
+	}
+	return crc;
+}
+
+uint32_t crc32c(uint32_t crc, const void* data, uint32_t length) {
+	crc = ~crc;
+	crc = use_sse42 ? crc32c_sse42(crc, data, length) : crc32c_tables(crc, data, length);
+	return ~crc;
+}
+
+void crc32c_seal(void* record, uint32_t length, uint32_t offset) {
+	uint32_t* field = (uint32_t*)((uint8_t*)record + offset);
+	*field = 0;
+	*field = crc32c(0, record, length);
+}
+
+bool crc32c_verify(const void* record, uint32_t length, uint32_t offset) {
+	uint32_t stored;
+	memcpy(&stored, (const uint8_t*)record + offset, sizeof(stored));
+	// the record up to the field, four zero bytes in its place, then the rest
+	static const uint8_t zero[sizeof(uint32_t)] = {0};
+	uint32_t crc = crc32c(0, record, offset);
+	crc = crc32c(crc, zero, sizeof(zero));
+	crc = crc32c(crc, (const uint8_t*)record + offset + sizeof(uint32_t), length - offset - sizeof(uint32_t));
+	return crc == stored;
+}
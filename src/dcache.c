@@ -0,0 +1,76 @@
+#include <dcache.h>
+#include <string.h>
+
+// Caches the result of looking up a name within a directory, so resolving a
+// path doesn't have to search every directory along the way. Each name may
+// live in any of DCACHE_WAYS consecutive slots starting at its hash.
+
+static DirCacheEntry dcache[DCACHE_ENTRIES];
+static uint32_t dcache_victim = 0; // rotates which way gets replaced when all are taken
+
+static uint32_t dcache_hash(uint32_t parent_inode_num, const char* name) {
+	return strhash(name) ^ (parent_inode_num * 2654435761u);
+}
+
+static DirCacheEntry* dcache_find(uint32_t hash, uint32_t parent_inode_num, const char* name) {
+	for (uint32_t way = 0; way < DCACHE_WAYS; way++) {
+		DirCacheEntry* entry = &dcache[(hash + way) & (DCACHE_ENTRIES - 1)];
+		if (entry->valid && entry->hash == hash && entry->parent_inode_num == parent_inode_num
+			&& strcmp(entry->name, name) == 0) {
+			return entry;
+		}
+	}
+	return NULL;
+}
+
+void dcache_init() {
+	memset(dcache, 0, sizeof(dcache));
+}
+
+bool dcache_lookup(uint32_t parent_inode_num, const char* name, uint32_t* inode_num) {
+	DirCacheEntry* entry = dcache_find(dcache_hash(parent_inode_num, name), parent_inode_num, name);
+	if (!entry) {
+		return false;
+	}
+	*inode_num = entry->inode_num;
+	return true;
+}
+
+void dcache_insert(uint32_t parent_inode_num, const char* name, uint32_t inode_num) {
+	if (strlen(name) >= sizeof(dcache[0].name)) {
+		return; // can't be a real entry anyway
+	}
+
+	uint32_t hash = dcache_hash(parent_inode_num, name);
+	DirCacheEntry* entry = dcache_find(hash, parent_inode_num, name);
+	for (uint32_t way = 0; !entry && way < DCACHE_WAYS; way++) {
+		DirCacheEntry* slot = &dcache[(hash + way) & (DCACHE_ENTRIES - 1)];
+		if (!slot->valid) {
+			entry = slot;
+		}
+	}
+	if (!entry) {
+		entry = &dcache[(hash + dcache_victim++ % DCACHE_WAYS) & (DCACHE_ENTRIES - 1)];
+	}
+
+	entry->valid = true;
+	entry->hash = hash;
+	entry->parent_inode_num = parent_inode_num;
+	entry->inode_num = inode_num;
+	strcpy(entry->name, name);
+}
+
+void dcache_invalidate(uint32_t parent_inode_num, const char* name) {
+	DirCacheEntry* entry = dcache_find(dcache_hash(parent_inode_num, name), parent_inode_num, name);
+	if (entry) {
+		entry->valid = false;
+	}
+}
+
+void dcache_invalidate_dir(uint32_t parent_inode_num) {
+	for (uint32_t i = 0; i < DCACHE_ENTRIES; i++) {
+		if (dcache[i].parent_inode_num == parent_inode_num) {
+			dcache[i].valid = false;
+		}
+	}
+}
@@ -7,33 +7,40 @@ void empty_initiazer(int32_t fd) {
     UNUSED(fd);
 }
 
-uint64_t tty_handler(bool read, int64_t fd, const void* buf, uint32_t count) {
+uint64_t tty_read(int64_t fd, const void* buf, uint32_t count) {
     UNUSED(fd);
     uint8_t* small_buf = (uint8_t*)buf;
-    // kprintf("yes");
-    if (read) {
-        // read from keyboard input buffer
-        uint32_t read = 0;
-        for (size_t byte = 0; byte < count; byte++) {
-            if (keyboard_input_buffer.out_index == keyboard_input_buffer.in_index) {
-                break;
-            }
-            small_buf[read] = keyboard_input_buffer.char_buffer[keyboard_input_buffer.out_index];
-            keyboard_input_buffer.out_index = (keyboard_input_buffer.out_index + 1) % RING_BUFFER_CAPACITY;
-            read++;
+    // read from keyboard input buffer
+    uint32_t read = 0;
+    for (size_t byte = 0; byte < count; byte++) {
+        if (keyboard_input_buffer.out_index == keyboard_input_buffer.in_index) {
+            break;
         }
-        return read;
-    } else {
-        // write to terminal 
-        uint32_t written = 0;
-        for (size_t byte = 0; byte < count; byte++) {
-            char c = ((uint8_t*)buf)[written++];
-            term.tty_buffer[term.index] = c;
-            term.index = (term.index + 1) % TERMINAL_BUFFER_SIZE;
-        }
-        render_terminal();
-        return written;
-    }    
+        small_buf[read] = keyboard_input_buffer.char_buffer[keyboard_input_buffer.out_index];
+        keyboard_input_buffer.out_index = (keyboard_input_buffer.out_index + 1) % RING_BUFFER_CAPACITY;
+        read++;
+    }
+    return read;
+}
+
+uint64_t tty_write(int64_t fd, const void* buf, uint32_t count) {
+    UNUSED(fd);
+    // write to terminal 
+    uint32_t written = 0;
+    for (size_t byte = 0; byte < count; byte++) {
+        char c = ((uint8_t*)buf)[written++];
+        term.tty_buffer[term.index] = c;
+        term.index = (term.index + 1) % TERMINAL_BUFFER_SIZE;
+    }
+    render_terminal();
+    return written;
+}
+
+// devices are streams, there is no position to move
+int32_t device_seek(int64_t fd, int32_t offset, uint32_t param) {
+    UNUSED(fd); UNUSED(offset); UNUSED(param);
+    PUSH_ERROR("can't seek on a device");
+    return -1;
 }
 
 void serial_initializer(int32_t fd) {
@@ -41,30 +48,32 @@ void serial_initializer(int32_t fd) {
     init_serial();
 }
 
-uint64_t serial_handler(bool read, int64_t fd, const void* buf, uint32_t count) {
+uint64_t serial_read(int64_t fd, const void* buf, uint32_t count) {
     uint8_t* small_buf = (uint8_t*)buf;
     UNUSED(count); UNUSED(fd);
-    if (read) {
-        if (serial_received()) {
-            small_buf[0] = inb(COM1);
-            return 1;
-        } 
-    } else {
-        // if (is_transmit_empty() == 0);
-        if (is_transmit_empty()) {
-            outb(COM1, small_buf[0]);
-            return 1;
-        }
-    }
+    if (serial_received()) {
+        small_buf[0] = inb(COM1);
+        return 1;
+    } 
     return 0;
 }
 
-void create_system_files() {
-
-    if (mkdir("/dev") == 1) {
-        panic(error_msg); // this should just go through 
+uint64_t serial_write(int64_t fd, const void* buf, uint32_t count) {
+    uint8_t* small_buf = (uint8_t*)buf;
+    UNUSED(count); UNUSED(fd);
+    // if (is_transmit_empty() == 0);
+    if (is_transmit_empty()) {
+        outb(COM1, small_buf[0]);
+        return 1;
     }
+    return 0;
+}
+
+static const FileOps tty_ops = {tty_read, tty_write, device_seek, release_file_descriptor, NULL};
+static const FileOps serial_ops = {serial_read, serial_write, device_seek, release_file_descriptor, NULL};
 
+void create_system_files() {
+    // /dev is a tmpfs, filled in again on every boot
     for (size_t file = 0; file < sizeof(system_files) / sizeof(SpecialFile); file++) {
         char whole_name[48] = "/dev/";
         strcat(system_files[file].filename, whole_name + 5);
@@ -86,6 +95,15 @@ void open_system_files() {
 }
 
 SpecialFile system_files[2] = {
-    {"tty", tty_handler, empty_initiazer, -1},
-    {"ttyS", serial_handler, serial_initializer, -1}
-};
\ No newline at end of file
+    {"tty", &tty_ops, empty_initiazer, -1},
+    {"ttyS", &serial_ops, serial_initializer, -1}
+};
+
+const struct FileOps* special_file_ops(const char* filename) {
+    for (size_t file = 0; file < sizeof(system_files) / sizeof(SpecialFile); file++) {
+        if (strcmp(system_files[file].filename, filename) == 0) {
+            return system_files[file].ops;
+        }
+    }
+    return NULL;
+}
\ No newline at end of file
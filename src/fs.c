@@ -1,9 +1,17 @@
 #include <ata.h>
+#include <bcache.h>
+#include <crc32c.h>
+#include <dcache.h>
+#include <journal.h>
+#include <lz4.h>
 #include <stdbool.h>
 #include <string.h>
 #include <util.h>
 #include <fs.h>
+#include <io.h>
 #include <file_handlers.h>
+#include <vfs.h>
+#include <tmpfs.h>
 
 // Source:
 // https://pages.cs.wisc.edu/~remzi/OSTEP/file-implementation.pdf
@@ -12,586 +20,3112 @@ char error_msg[128] = {0};
 
 // will be updated through the runtime, and periodically synced on disk, perhaps on closing
 static FileSystemSuper global_super;
-static uint32_t global_ibmap[BLOCK_BYTES/4] = {0}; // inode occupation bitmap
-static uint32_t global_dbmap[BLOCK_BYTES/4] = {0}; // data block occuption bitmap
-static FileSystemInode global_inode_table[(BLOCK_BYTES * INODE_TABLE_SIZE) / sizeof(FileSystemInode)];
+static FileSystemGroupDesc global_groups[FS_MAX_GROUPS]; // group descriptor table
 static FileDescriptorTable global_fd_table = {0}; // clear bitmap
 
-// we will format the disk on new disk
-// on startup we will read and store the metadata from it, mount the disk
-bool initalize_file_system(bool force_format) {
+// which of the tables above changed since the last commit, logged by sync()
+// the bitmaps, the inode table and directories are kept in the block cache and logged from there
+static bool super_dirty = false;
+static uint32_t group_desc_dirty[(GROUP_DESC_BLOCKS_MAX + 31) / 32] = {0}; // bit per descriptor block
+static uint32_t metadata_updates = 0; // since the last sync
+static uint64_t last_sync_tick = 0;
+
+static BitRange extent_scratch[INODE_EXTENTS_MAX + 2]; // an extent list being rebuilt, splitting one adds two
+static uint8_t cluster_plain[COMPRESS_CLUSTER_BYTES];  // a cluster of a compressed file being read or rewritten
+static uint8_t cluster_packed[COMPRESS_CLUSTER_BYTES]; // the same cluster as stored on disk
+
+// scrub reads the disk past the cache, the bitmaps and inode table stream through scrub_buffer
+// while the blocks of each inode in use are read into scrub_follow
+static uint8_t scrub_buffer[SCRUB_BATCH_BLOCKS * BLOCK_BYTES];
+static uint8_t scrub_follow[SCRUB_BATCH_BLOCKS * BLOCK_BYTES];
+static uint8_t scrub_inode_bitmap[BLOCK_BYTES];
+static BitRange scrub_extents[EXTENTS_PER_BLOCK + 1]; // extent block of the inode being followed
+
+_Static_assert(GROUP_DESC_BLOCKS_MAX <= SCRUB_BATCH_BLOCKS, "scrub reads the descriptor table at once");
+_Static_assert(REFCOUNT_TABLE_BLOCKS <= SCRUB_BATCH_BLOCKS, "scrub reads a reference count table at once");
+
+static DelayedRun delayed_runs[DELAYED_FILES_MAX];
+static uint32_t delayed_blocks = 0; // held back across all runs
+
+// the background defragmenter goes through the inodes a file at a time while the shell idles
+static bool defrag_enabled = false;
+static uint32_t defrag_cursor = 0;     // inode it looks at next
+static uint64_t defrag_next_tick = 0;  // when it may take its next step
+
+void mark_super_dirty() {
+	super_dirty = true;
+	metadata_updates++;
+}
 
-	// TODO: instead of limiting the size of the directory entry table
-	// just make the struct, and then reference different parts of the 
-	// pointer as the right values 
+void mark_group_dirty(uint32_t group) {
+	uint32_t block = group / GROUP_DESCS_PER_BLOCK;
+	group_desc_dirty[block / 32] |= 1u << (31 - block % 32);
+	metadata_updates++;
+}
 
-	uint8_t buffer[512] = {0};
-	ata_read_sectors(0, 1, buffer); // NOTE: doesn't work when I use read block, because it overflows
-	
-	global_super = *(FileSystemSuper*)buffer;
-	if (!force_format && strcmp(global_super.format_indicator, "Yorha") == 0) {
-		kprintf("Disk Recognized\n");
-		ata_read_blocks(global_super.i_bmap_start, (uint8_t*)global_ibmap, INODE_BITMAP_SIZE);
-		ata_read_blocks(global_super.d_bmap_start, (uint8_t*)global_dbmap, DATA_BITMAP_SIZE);
-		ata_read_blocks(global_super.inode_table_start, (uint8_t*)global_inode_table, INODE_TABLE_SIZE);
-		open_system_files();
-		return true;	// disk formatted
+bool group_desc_block_dirty(uint32_t block) {
+	return group_desc_dirty[block / 32] & (1u << (31 - block % 32));
+}
+
+// a modified bitmap, inode table, directory or extent block, logged with the running transaction
+void mark_metadata_dirty(CacheBlock* block) {
+	bcache_mark_dirty(block);
+	journal_add(block);
+}
+
+void commit_metadata();
+
+// bounds how much is lost on a crash, called on the way into the syscalls
+// between operations, so each of them commits whole
+// the commit isn't waited on, it reaches the media with the next barrier
+void sync_if_due() {
+	if (metadata_updates >= SYNC_UPDATE_THRESHOLD || journal_running_blocks() >= JOURNAL_COMMIT_BLOCKS
+		|| (metadata_updates && timer_counter - last_sync_tick >= SYNC_INTERVAL_TICKS)) {
+		commit_metadata();
 	}
+}
 
-	// formatting disk
-	kprintf("Formatting Disk...\n");
-	
-	// fill super
-	strcpy(global_super.format_indicator, "Yorha");
-	global_super.disk_size = ata_get_disk_size();
-	global_super.sector_count = global_super.disk_size / SECTOR_BYTES;
-	global_super.block_count = 64; // only starting with 64
-	global_super.i_bmap_start = SUPER_SIZE; // only 1 block for Super
-	global_super.d_bmap_start = global_super.i_bmap_start + INODE_BITMAP_SIZE;
-	global_super.inode_table_start = global_super.d_bmap_start + DATA_BITMAP_SIZE;
-	global_super.data_start = global_super.inode_table_start + INODE_TABLE_SIZE;
-	global_super.used_inodes = 1;
-	ata_write_blocks(0, (uint8_t*)&global_super, 1); // unsafe
-
-	// clear occupation bitmaps
-	global_ibmap[0] |= 1 << 31;
-	alloc_bitrange(global_dbmap, BLOCK_BYTES * 8, DATA_REGION_START + 1, false); // NOTE: permanently allocates all blocks used for metadata, and the first
-	ata_write_blocks(global_super.i_bmap_start, (uint8_t*)global_ibmap, 1);
-	ata_write_blocks(global_super.d_bmap_start, (uint8_t*)global_dbmap, 1);
+uint32_t group_desc_blocks() {
+	return (global_super.group_count + GROUP_DESCS_PER_BLOCK - 1) / GROUP_DESCS_PER_BLOCK;
+}
 
-	// TODO: add . and .. to directory
+uint32_t inode_table_blocks() {
+	return global_super.inodes_per_group / INODES_PER_BLOCK;
+}
 
-	// create root dir at inode 0
-	// will have no contents within it, but it exists
-	int16_t inode_table_length = global_super.data_start - global_super.inode_table_start; // in blocks
-	FileSystemInode root_inode = {.name = "", .file_type = 0, .size = 0, .data_block_start = global_super.data_start, .parent_inode_num = 0};
-	global_inode_table[0] = root_inode;
-	ata_write_blocks(global_super.inode_table_start, (uint8_t*)global_inode_table, inode_table_length);
+// blocks within the group, only the last one may fall short of blocks_per_group
+uint32_t group_block_count(uint32_t group) {
+	uint32_t remaining = global_super.block_count - group * global_super.blocks_per_group;
+	return (remaining < global_super.blocks_per_group) ? remaining : global_super.blocks_per_group;
+}
 
-	// write empty directory
-	ata_write_blocks(global_super.data_start, NULL, 1);
+uint32_t free_block_total() {
+	uint32_t total = 0;
+	for (uint32_t group = 0; group < global_super.group_count; group++) {
+		total += global_groups[group].free_blocks;
+	}
+	return total;
+}
 
-	create_system_files();
-	open_system_files();
+// whether bit `index` of a bitmap is set, bits run from the top of each 32 bit word
+bool bitmap_test(const uint8_t* bitmap, uint32_t index) {
+	return ((const uint32_t*)bitmap)[index / 32] & (1u << (31 - index % 32));
+}
+
+// reports metadata failing its checksum on the way in, it is used regardless
+void report_checksum_error(const char* what, uint32_t number) {
+	kprintf("fs: %s %u fails its checksum\n", what, number);
+}
+
+// reads a directory or extent block, checking it when it comes from disk
+CacheBlock* read_checked_block(uint32_t block_num) {
+	CacheBlock* block = bcache_read(block_num);
+	bcache_set_checksum(block, BLOCK_BYTES, BLOCK_CHECKSUM_OFFSET);
+	if (block->unchecked) {
+		block->unchecked = false;
+		if (!crc32c_verify(block->data, BLOCK_BYTES, BLOCK_CHECKSUM_OFFSET)) {
+			report_checksum_error("block", block_num);
+		}
+	}
+	return block;
+}
+
+// the inode table block holding the inode, pinned, with its checksum layout set
+CacheBlock* inode_table_block(uint32_t inode_num) {
+	FileSystemGroupDesc* group = &global_groups[inode_num / global_super.inodes_per_group];
+	uint32_t index = inode_num % global_super.inodes_per_group;
+	CacheBlock* block = bcache_read(group->inode_table + index / INODES_PER_BLOCK);
+	bcache_set_checksum(block, sizeof(FileSystemInode), offsetof(FileSystemInode, checksum));
+	return block;
+}
+
+// checks the inodes in use of an inode table block fresh from disk, free slots may hold anything
+// `skip` is an inode just allocated, its slot isn't written yet
+void check_inode_block(CacheBlock* block, uint32_t inode_num, uint32_t skip) {
+	block->unchecked = false;
+	uint32_t first = inode_num - inode_num % INODES_PER_BLOCK;
+	uint32_t group = first / global_super.inodes_per_group;
+	CacheBlock* bitmap = bcache_read(global_groups[group].inode_bitmap);
+	for (uint32_t i = 0; i < INODES_PER_BLOCK; i++) {
+		uint32_t index = first % global_super.inodes_per_group + i;
+		if (first + i != skip && bitmap_test(bitmap->data, index)
+			&& !crc32c_verify(block->data + i * sizeof(FileSystemInode), sizeof(FileSystemInode), offsetof(FileSystemInode, checksum))) {
+			report_checksum_error("inode", first + i);
+		}
+	}
+	bcache_release(bitmap);
+}
+
+// returns the inode pinned in its inode table block, hand it back with inode_put
+FileSystemInode* inode_get(uint32_t inode_num) {
+	CacheBlock* block = inode_table_block(inode_num);
+	if (block->unchecked) {
+		check_inode_block(block, inode_num, -1);
+	}
+	return &((FileSystemInode*)block->data)[inode_num % INODES_PER_BLOCK];
+}
+
+void inode_put(FileSystemInode* inode) {
+	bcache_release(bcache_block_of(inode));
+}
+
+void mark_inode_dirty(FileSystemInode* inode) {
+	mark_metadata_dirty(bcache_block_of(inode));
+	metadata_updates++;
+}
+
+// returns a copy of the inode, for callers that only look at it
+FileSystemInode inode_read(uint32_t inode_num) {
+	FileSystemInode* inode = inode_get(inode_num);
+	FileSystemInode copy = *inode;
+	inode_put(inode);
+	return copy;
+}
+
+// refuses changes to a file or directory that is part of a snapshot
+bool check_writable(uint32_t inode_num) {
+	if (inode_read(inode_num).flags & INODE_FLAG_READONLY) {
+		PUSH_ERROR("part of a read-only snapshot");
+		return false;
+	}
 	return true;
 }
 
-// returns the inode_num corresponding to the directory
-int32_t seek_directory(const char* dir_path) {
+// allocates from the first group from `goal`'s on with a free run, see alloc_blocks
+BitRange search_free_blocks(uint32_t goal, uint32_t count) {
+	if (goal >= global_super.block_count) {
+		goal = 0;
+	}
 
-	// must end and begin with '/' (absolute path to directory)
-	char next_dir[32] = ""; // maximum 32 character name
-	uint32_t current_inode_num = 0; // root directory
-	// char* current_char = dir_path + 1; // skip the '/'
-	size_t current_char = 1; // skip the '/'
+	uint32_t goal_group = goal / global_super.blocks_per_group;
+	for (uint32_t i = 0; i < global_super.group_count; i++) {
+		uint32_t group = (goal_group + i) % global_super.group_count;
+		FileSystemGroupDesc* desc = &global_groups[group];
+		if (desc->free_blocks == 0) {
+			continue;
+		}
 
-	uint8_t current_dir_buf[BLOCK_BYTES];
-	FileSystemDirDataBlock* dir_ptr = (FileSystemDirDataBlock*)current_dir_buf;
-	
-	if (dir_path[0] != '/') {
-		PUSH_ERROR("relative indexing not implemented");
-		return -1;
+		uint32_t group_start = group * global_super.blocks_per_group;
+		uint32_t group_goal = (group == goal_group) ? goal - group_start : 0;
+		CacheBlock* bitmap = bcache_read(desc->block_bitmap);
+		journal_mask_unsettled((uint32_t*)bitmap->data, group_start, group_block_count(group), true);
+		BitRange range = alloc_bitrange_near((uint32_t*)bitmap->data, group_block_count(group), group_goal, count);
+		journal_mask_unsettled((uint32_t*)bitmap->data, group_start, group_block_count(group), false);
+		if (range.length) {
+			mark_metadata_dirty(bitmap);
+			desc->free_blocks -= range.length;
+			mark_group_dirty(group);
+			range.start += group_start;
+		}
+		bcache_release(bitmap);
+		if (range.length) {
+			return range;
+		}
 	}
- 
-	uint16_t char_index = 0;
-	while (dir_path[current_char]) {
-		if (dir_path[current_char] == '/' || dir_path[current_char + 1] == '\0') { // done with writing next directory name
-			// TODO: conserving the syntax of referencing the directory like `/dir_name` without the last `/`
-			// NOTE: ignoring root, maybe rethink abstraction
-			if (dir_path[current_char] != '/' && dir_path[current_char + 1] == '\0') {
-				next_dir[char_index++] = dir_path[current_char];
+	return (BitRange){.start = 0, .length = 0};
+}
+
+// allocates up to `count` contiguous blocks, starting the search at `goal`
+// and moving on through the following groups when its group is full
+// blocks freed by a transaction not yet on the media are passed over, a crash could hand them back to their old file
+BitRange alloc_blocks(uint32_t goal, uint32_t count) {
+	BitRange range = search_free_blocks(goal, count);
+	if (range.length == 0 && journal_has_unsettled()) {
+		// NOTE: only blocks waiting on a commit are left, committing in the middle of
+		// the current operation gives up on it being atomic
+		journal_commit();
+		journal_barrier();
+		range = search_free_blocks(goal, count);
+	}
+	return range;
+}
+
+// returns a run of blocks to its group, dropping whatever the cache and the journal hold of them
+void release_block_run(BitRange range) {
+	uint32_t group = range.start / global_super.blocks_per_group;
+	ASSERT((range.start + range.length - 1) / global_super.blocks_per_group == group, "block run crosses groups");
+	journal_revoke(range);
+	bcache_discard(range.start, range.length);
+
+	CacheBlock* bitmap = bcache_read(global_groups[group].block_bitmap);
+	range.start -= group * global_super.blocks_per_group;
+	dealloc_bitrange((uint32_t*)bitmap->data, range);
+	mark_metadata_dirty(bitmap);
+	bcache_release(bitmap);
+	global_groups[group].free_blocks += range.length;
+	mark_group_dirty(group);
+}
+
+// the reference count of a data block, pinned in its table block, hand it back with refcount_put
+uint8_t* refcount_get(uint32_t block_num) {
+	FileSystemGroupDesc* desc = &global_groups[block_num / global_super.blocks_per_group];
+	uint32_t index = block_num % global_super.blocks_per_group;
+	CacheBlock* table = read_checked_block(desc->refcount_table + index / REFCOUNTS_PER_BLOCK);
+	return table->data + index % REFCOUNTS_PER_BLOCK;
+}
+
+void refcount_put(uint8_t* refcount) {
+	bcache_release(bcache_block_of(refcount));
+}
+
+// counts the blocks from `block_num` on, up to `count`, that are shared, or that aren't if `shared` is false
+uint32_t shared_prefix(uint32_t block_num, uint32_t count, bool shared) {
+	if (!global_groups[block_num / global_super.blocks_per_group].shared_blocks) {
+		return shared ? 0 : count;
+	}
+	uint32_t length = 0;
+	while (length < count) {
+		uint8_t* refcount = refcount_get(block_num + length);
+		bool is_shared = *refcount != 0;
+		refcount_put(refcount);
+		if (is_shared != shared) {
+			break;
+		}
+		length++;
+	}
+	return length;
+}
+
+// gives every block of the run one more owner, or none of them if one can't take another
+bool share_blocks(BitRange range) {
+	uint32_t group = range.start / global_super.blocks_per_group;
+	for (uint32_t i = 0; i < range.length; i++) {
+		uint8_t* refcount = refcount_get(range.start + i);
+		bool full = *refcount == REFCOUNT_MAX;
+		refcount_put(refcount);
+		if (full) {
+			PUSH_ERROR("block is shared too many times");
+			return false;
+		}
+	}
+	for (uint32_t i = 0; i < range.length; i++) {
+		uint8_t* refcount = refcount_get(range.start + i);
+		if ((*refcount)++ == 0) {
+			global_groups[group].shared_blocks++;
+		}
+		mark_metadata_dirty(bcache_block_of(refcount));
+		refcount_put(refcount);
+	}
+	mark_group_dirty(group);
+	return true;
+}
+
+// lets go of a run of blocks, the shared ones lose an owner and the rest is freed
+void free_blocks(BitRange range) {
+	uint32_t group = range.start / global_super.blocks_per_group;
+	while (range.length) {
+		uint32_t length = shared_prefix(range.start, range.length, false);
+		if (length) {
+			release_block_run((BitRange){.start = range.start, .length = length});
+		} else {
+			uint8_t* refcount = refcount_get(range.start);
+			if (--(*refcount) == 0) {
+				global_groups[group].shared_blocks--;
 			}
+			mark_metadata_dirty(bcache_block_of(refcount));
+			refcount_put(refcount);
+			mark_group_dirty(group);
+			length = 1;
+		}
+		range.start += length;
+		range.length -= length;
+	}
+}
 
-			next_dir[char_index] = '\0'; // end directory name
-			// gather previous dir data
-			FileSystemInode dir_inode = global_inode_table[current_inode_num];
-			ata_read_blocks(dir_inode.data_block_start, current_dir_buf, 1); // only 1 for now
-			// look at the current_inode directory for current_char
-			// NOTE: calculating files_contained
-			uint32_t files_contained = dir_inode.size / sizeof(FileSystemDirEntry); 
-			int32_t file_inode_number = -1;
-			// for (uint32_t file = 0; file < dir_ptr->files_contained; file++) {
-			for (uint32_t file = 0; file < files_contained; file++) {
-				if (strcmp(dir_ptr->contents[file].name, next_dir) == 0) {
-					// TODO: must ensure this is a valid inode being used
-					file_inode_number = dir_ptr->contents[file].inode_num;
-					break;
+// picks an inode for a new file, in the group of its parent directory when possible
+// a new directory moves to the emptiest group once its parent's group has less room
+// than average, so each directory keeps space to grow its files next to it
+int32_t alloc_inode_num(uint32_t parent_inode_num, uint8_t file_type) {
+	uint32_t first_group = parent_inode_num / global_super.inodes_per_group;
+	if (file_type == FILE_TYPE_DIR) {
+		if (global_groups[first_group].free_blocks < free_block_total() / global_super.group_count) {
+			for (uint32_t group = 0; group < global_super.group_count; group++) {
+				if (global_groups[group].free_inodes && global_groups[group].free_blocks > global_groups[first_group].free_blocks) {
+					first_group = group;
 				}
 			}
-			if (file_inode_number == -1) {
-				PUSH_ERROR("couldn't trace path");
-				return -1; // couldn't trace the path
+		}
+	}
+
+	for (uint32_t i = 0; i < global_super.group_count; i++) {
+		uint32_t group = (first_group + i) % global_super.group_count;
+		FileSystemGroupDesc* desc = &global_groups[group];
+		if (desc->free_inodes == 0) {
+			continue;
+		}
+
+		CacheBlock* bitmap = bcache_read(desc->inode_bitmap);
+		BitRange range = alloc_bitrange_near((uint32_t*)bitmap->data, global_super.inodes_per_group, 0, 1);
+		if (range.length) {
+			mark_metadata_dirty(bitmap);
+		}
+		bcache_release(bitmap);
+		if (range.length == 0) {
+			continue;
+		}
+
+		uint32_t inode_num = group * global_super.inodes_per_group + range.start;
+		CacheBlock* table = inode_table_block(inode_num);
+		if (table->unchecked) {
+			check_inode_block(table, inode_num, inode_num);
+		}
+		bcache_release(table);
+
+		desc->free_inodes--;
+		if (file_type == FILE_TYPE_DIR) {
+			desc->dir_count++;
+		}
+		mark_group_dirty(group);
+		global_super.used_inodes++;
+		mark_super_dirty();
+		return inode_num;
+	}
+	PUSH_ERROR("no free inodes");
+	return -1;
+}
+
+void free_inode_num(uint32_t inode_num, uint8_t file_type) {
+	uint32_t group = inode_num / global_super.inodes_per_group;
+	BitRange range = {.start = inode_num % global_super.inodes_per_group, .length = 1};
+	CacheBlock* bitmap = bcache_read(global_groups[group].inode_bitmap);
+	dealloc_bitrange((uint32_t*)bitmap->data, range);
+	mark_metadata_dirty(bitmap);
+	bcache_release(bitmap);
+
+	global_groups[group].free_inodes++;
+	if (file_type == FILE_TYPE_DIR) {
+		global_groups[group].dir_count--;
+	}
+	mark_group_dirty(group);
+	global_super.used_inodes--;
+	mark_super_dirty();
+}
+
+BitRange get_extent(FileSystemInode* inode, uint32_t index) {
+	if (index < INODE_DIRECT_EXTENTS) {
+		return inode->extents[index];
+	}
+	CacheBlock* block = read_checked_block(inode->extent_block);
+	BitRange extent = ((BitRange*)block->data)[index - INODE_DIRECT_EXTENTS];
+	bcache_release(block);
+	return extent;
+}
+
+void set_extent(FileSystemInode* inode, uint32_t index, BitRange extent) {
+	if (index < INODE_DIRECT_EXTENTS) {
+		inode->extents[index] = extent;
+		return;
+	}
+	CacheBlock* block = read_checked_block(inode->extent_block);
+	((BitRange*)block->data)[index - INODE_DIRECT_EXTENTS] = extent;
+	mark_metadata_dirty(block);
+	bcache_release(block);
+}
+
+// number of file blocks covered by the inode's extents, holes included
+uint32_t inode_block_count(FileSystemInode* inode) {
+	uint32_t blocks = 0;
+	for (uint32_t extent = 0; extent < inode->extent_count; extent++) {
+		blocks += get_extent(inode, extent).length;
+	}
+	return blocks;
+}
+
+// returns the disk block backing `file_block` of the inode, or 0 if it has none
+// `run_length` receives how many blocks from there on are contiguous on disk,
+// or left in the hole, 0 past the last extent
+uint32_t map_file_block(FileSystemInode* inode, uint32_t file_block, uint32_t* run_length) {
+	uint32_t extent_base = 0; // file block at which the current extent begins
+	for (uint32_t index = 0; index < inode->extent_count; index++) {
+		BitRange extent = get_extent(inode, index);
+		if (file_block < extent_base + extent.length) {
+			if (run_length) {
+				*run_length = extent.length - (file_block - extent_base);
 			}
-			current_inode_num = file_inode_number;
-			char_index = 0;
-		} else {
-			next_dir[char_index++] = dir_path[current_char];
+			return EXTENT_IS_HOLE(extent) ? 0 : extent.start + (file_block - extent_base);
 		}
-		current_char++;
+		extent_base += extent.length;
+	}
+	if (run_length) {
+		*run_length = 0;
 	}
+	return 0;
+}
 
-	if (global_inode_table[current_inode_num].file_type != 0) {
-		PUSH_ERROR("file is not a directory");
-		return -1;
+// allocates the overflow extent block, near `goal`, once the inode is to hold more than its direct extents
+bool ensure_extent_block(FileSystemInode* inode, uint32_t extent_count, uint32_t goal) {
+	if (extent_count <= INODE_DIRECT_EXTENTS || inode->extent_block) {
+		return true;
 	}
+	BitRange overflow = alloc_blocks(goal, 1);
+	if (overflow.length == 0) {
+		PUSH_ERROR("no space for extent block");
+		return false;
+	}
+	inode->extent_block = overflow.start;
+	CacheBlock* block = bcache_get(inode->extent_block);
+	memset(block->data, 0, BLOCK_BYTES);
+	bcache_set_checksum(block, BLOCK_BYTES, BLOCK_CHECKSUM_OFFSET);
+	mark_metadata_dirty(block);
+	bcache_release(block);
+	return true;
+}
 
-	return current_inode_num;
+// frees the overflow extent block once the direct extents are enough again
+void trim_extent_block(FileSystemInode* inode) {
+	if (inode->extent_count <= INODE_DIRECT_EXTENTS && inode->extent_block) {
+		free_blocks((BitRange){.start = inode->extent_block, .length = 1});
+		inode->extent_block = 0;
+	}
 }
 
-void parse_path(const char* path, char* dir_path, char* filename) {
+// adds a run of blocks to the end of the inode, merging with the last extent when adjacent
+bool append_extent(FileSystemInode* inode, BitRange range) {
+	if (inode->extent_count) {
+		BitRange last = get_extent(inode, inode->extent_count - 1);
+		if (EXTENT_IS_HOLE(last) ? EXTENT_IS_HOLE(range) : last.start + last.length == range.start) {
+			last.length += range.length;
+			set_extent(inode, inode->extent_count - 1, last);
+			return true;
+		}
+	}
 
-	strcpy(dir_path, path);
-	size_t i = 0;
+	if (inode->extent_count == INODE_EXTENTS_MAX) {
+		PUSH_ERROR("file is too fragmented");
+		return false;
+	}
 
-	uint32_t last_slash = 0;
-	while (path[i]) {
-		if (path[i] == '/') {
-			last_slash = i;
+	if (!ensure_extent_block(inode, inode->extent_count + 1, range.start + range.length)) {
+		return false;
+	}
+	set_extent(inode, inode->extent_count, range);
+	inode->extent_count++;
+	return true;
+}
+
+// grows the inode until it owns at least `block_count` data blocks
+// runs are taken as long as possible, starting right after the file's last block,
+// or at the start of the inode's group for an empty file
+bool reserve_file_blocks(uint32_t inode_num, FileSystemInode* inode, uint32_t block_count) {
+	uint32_t owned = inode_block_count(inode);
+	while (owned < block_count) {
+		uint32_t goal = global_groups[inode_num / global_super.inodes_per_group].data_start;
+		if (inode->extent_count) {
+			BitRange last = get_extent(inode, inode->extent_count - 1);
+			if (!EXTENT_IS_HOLE(last)) {
+				goal = last.start + last.length;
+			}
 		}
-		i++;
+
+		BitRange range = alloc_blocks(goal, block_count - owned);
+		if (range.length == 0) {
+			PUSH_ERROR("no free data blocks");
+			return false;
+		}
+		if (!append_extent(inode, range)) {
+			free_blocks(range);
+			return false;
+		}
+		owned += range.length;
 	}
+	return true;
+}
 
-	strcpy(filename, dir_path + last_slash + 1); // copy tail
-	dir_path[last_slash + 1] = '\0'; // end at slash
+// makes the blocks from the last extent up to `first_block`, and on up to `end_block` while inside the file, a hole
+// they read as zeroes without a block, `reserve_file_blocks` would hand them one with whatever the disk held there
+bool append_file_hole(FileSystemInode* inode, uint32_t first_block, uint32_t end_block) {
+	uint32_t hole_end = ((uint64_t)inode->size + BLOCK_BYTES - 1) / BLOCK_BYTES;
+	if (hole_end > end_block) {
+		hole_end = end_block;
+	}
+	if (hole_end < first_block) {
+		hole_end = first_block;
+	}
+	uint32_t span = inode_block_count(inode);
+	return hole_end <= span || append_extent(inode, (BitRange){.start = 0, .length = hole_end - span});
 }
 
-// return -1 if can't find file
-// returns the inode corresponding to the file within a given
-// directory
-int32_t search_dir(uint32_t dir_inode_num, char* filename) {
-	
-	uint8_t current_dir_buf[BLOCK_BYTES] = {0};
-	FileSystemDirDataBlock* dir_ptr = (FileSystemDirDataBlock*)current_dir_buf;
-	
-	FileSystemInode dir_inode = global_inode_table[dir_inode_num];
-	ASSERT(dir_inode.file_type == 0, "must be a directory"); 
-	ata_read_blocks(dir_inode.data_block_start, current_dir_buf, 1); // only 1 for now
-	// kprintf("[search] dir_inode_num.start: %u\n", dir_inode.data_block_start);
-
-	// NOTE: Also calculating files_contained
-	uint32_t files_contained = dir_inode.size / sizeof(FileSystemDirEntry); 
-	// kprintf("files_contained: %u\n", files_contained);
-	// look at the current_inode directory for current_char
-	for (uint32_t file = 0; file < files_contained; file++) {
-		// kprintf("found: %s, looking_for: %s\n", dir_ptr->contents[file].name, filename);
-		if (strcmp(dir_ptr->contents[file].name, filename) == 0) {
-			// TODO: must ensure this is a valid inode being used
-			// kprintf("found\n");
-			return dir_ptr->contents[file].inode_num;
-		}
-	}
-	PUSH_ERROR("couldn't trace path");
-	return -1;
+// brings file blocks [`from`, `to`) of the inode into the cache, one transfer per extent
+void prefetch_file_blocks(FileSystemInode* inode, uint32_t from, uint32_t to) {
+	while (from < to) {
+		uint32_t run_length;
+		uint32_t disk_block = map_file_block(inode, from, &run_length);
+		if (!run_length) {
+			return;
+		}
+		if (run_length > to - from) {
+			run_length = to - from;
+		}
+		if (disk_block) {
+			bcache_prefetch(disk_block, run_length); // holes read as zeroes, nothing to fetch
+		}
+		from += run_length;
+	}
 }
 
-// Remember to free con
-ParsedPath Path(const char* path) {
-	ParsedPath parsed_path;
-	size_t path_length = strlen(path) + 1; // ONLY TO THE NULL
-	parsed_path.dir_path = kmalloc(path_length);
-	parsed_path.filename = kmalloc(path_length);
-	// parse_path(path, parsed_path.dir_path, parsed_path.filename);
+// -- COMPRESSED FILES --
 
-	strcpy(parsed_path.dir_path, path);
-	size_t i = 0;
-	uint32_t last_slash = 0;
-	while (path[i]) {
-		if (path[i] == '/') {
-			last_slash = i;
+// name a decompressed block of the packed cluster goes by in the cache
+uint32_t decompressed_block_name(BitRange extent, uint32_t index) {
+	return COMPRESSED_BLOCK_BASE + extent.start * COMPRESS_CLUSTER_BLOCKS + index;
+}
+
+// frees the blocks of a cluster along with its decompressed copy in the cache
+void free_cluster(BitRange extent) {
+	if (EXTENT_IS_HOLE(extent)) {
+		return;
+	}
+	if (extent.length & CLUSTER_PACKED) {
+		bcache_discard(decompressed_block_name(extent, 0), COMPRESS_CLUSTER_BLOCKS);
+	}
+	extent.length &= ~CLUSTER_PACKED;
+	free_blocks(extent);
+}
+
+// loads cluster `cluster` of the compressed file into cluster_plain, zeroed past its data
+bool load_cluster(FileSystemInode* inode, uint32_t cluster) {
+	memset(cluster_plain, 0, COMPRESS_CLUSTER_BYTES);
+	BitRange extent = (cluster < inode->extent_count) ? get_extent(inode, cluster) : (BitRange){0};
+	if (EXTENT_IS_HOLE(extent)) {
+		return true;
+	}
+
+	uint32_t blocks = extent.length & ~CLUSTER_PACKED;
+	uint8_t* data = (extent.length & CLUSTER_PACKED) ? cluster_packed : cluster_plain;
+	bcache_prefetch(extent.start, blocks);
+	for (uint32_t i = 0; i < blocks; i++) {
+		CacheBlock* block = bcache_read(extent.start + i);
+		memcpy(data + i * BLOCK_BYTES, block->data, BLOCK_BYTES);
+		bcache_release(block);
+	}
+	if (!(extent.length & CLUSTER_PACKED)) {
+		return true;
+	}
+
+	ClusterHeader header = *(ClusterHeader*)cluster_packed;
+	if (header.packed_bytes > blocks * BLOCK_BYTES - sizeof(ClusterHeader)
+		|| crc32c(0, cluster_packed + sizeof(ClusterHeader), header.packed_bytes) != header.checksum
+		|| lz4_decompress(cluster_packed + sizeof(ClusterHeader), header.packed_bytes, cluster_plain, COMPRESS_CLUSTER_BYTES) != (int32_t)header.plain_bytes) {
+		memset(cluster_plain, 0, COMPRESS_CLUSTER_BYTES);
+		PUSH_ERROR("corrupt compressed cluster");
+		return false;
+	}
+	return true;
+}
+
+// writes the first `plain_bytes` of cluster_plain back as cluster `cluster` of the compressed file,
+// packed if that saves a block, over its old blocks only when it keeps their format and length and they
+// are not shared, otherwise the committed extent would describe blocks holding something else
+bool store_cluster(uint32_t inode_num, FileSystemInode* inode, uint32_t cluster, uint32_t plain_bytes) {
+	uint32_t plain_blocks = (plain_bytes + BLOCK_BYTES - 1) / BLOCK_BYTES;
+	uint32_t packed_capacity = (plain_blocks - 1) * BLOCK_BYTES;
+	uint32_t packed_bytes = 0;
+	if (packed_capacity > sizeof(ClusterHeader)) {
+		packed_bytes = lz4_compress(cluster_plain, plain_bytes, cluster_packed + sizeof(ClusterHeader), packed_capacity - sizeof(ClusterHeader));
+	}
+	uint32_t length = plain_blocks;
+	const uint8_t* data = cluster_plain;
+	if (packed_bytes) {
+		ClusterHeader* header = (ClusterHeader*)cluster_packed;
+		header->packed_bytes = packed_bytes;
+		header->plain_bytes = plain_bytes;
+		header->checksum = crc32c(0, cluster_packed + sizeof(ClusterHeader), packed_bytes);
+		length = (sizeof(ClusterHeader) + packed_bytes + BLOCK_BYTES - 1) / BLOCK_BYTES;
+		memset(cluster_packed + sizeof(ClusterHeader) + packed_bytes, 0, length * BLOCK_BYTES - sizeof(ClusterHeader) - packed_bytes);
+		data = cluster_packed;
+	}
+
+	// clusters skipped over are holes
+	uint32_t goal = global_groups[inode_num / global_super.inodes_per_group].data_start;
+	while (inode->extent_count <= cluster) {
+		if (inode->extent_count == INODE_EXTENTS_MAX) {
+			PUSH_ERROR("compressed file is too large");
+			return false;
 		}
-		i++;
+		if (!ensure_extent_block(inode, inode->extent_count + 1, goal)) {
+			return false;
+		}
+		set_extent(inode, inode->extent_count, (BitRange){0});
+		inode->extent_count++;
 	}
 
-	strcpy(parsed_path.filename, parsed_path.dir_path + last_slash + 1); // copy tail
-	parsed_path.dir_path[last_slash + 1] = '\0'; // end at slash
+	BitRange old = get_extent(inode, cluster);
+	uint32_t old_length = old.length & ~CLUSTER_PACKED;
+	BitRange range = {.start = old.start, .length = length};
+	bool same_format = (old.length & CLUSTER_PACKED) == (packed_bytes ? CLUSTER_PACKED : 0) && old_length == length;
+	if (EXTENT_IS_HOLE(old) || !same_format || shared_prefix(old.start, old_length, false) < old_length) {
+		// a cluster is contiguous, right after the one before it when there is room
+		if (cluster) {
+			BitRange previous = get_extent(inode, cluster - 1);
+			if (!EXTENT_IS_HOLE(previous)) {
+				goal = previous.start + (previous.length & ~CLUSTER_PACKED);
+			}
+		}
+		range = alloc_blocks(goal, length);
+		if (range.length < length) {
+			if (range.length) {
+				free_blocks(range);
+			}
+			PUSH_ERROR("no free run for cluster");
+			return false;
+		}
+		free_cluster(old); // not reused before the new extent commits
+	} else if (old.length & CLUSTER_PACKED) {
+		bcache_discard(decompressed_block_name(old, 0), COMPRESS_CLUSTER_BLOCKS);
+	}
 
-	return parsed_path;
+	for (uint32_t i = 0; i < length; i++) {
+		CacheBlock* block = bcache_get(range.start + i);
+		memcpy(block->data, data + i * BLOCK_BYTES, BLOCK_BYTES);
+		bcache_mark_dirty(block);
+		bcache_release(block);
+	}
+	if (packed_bytes) {
+		range.length |= CLUSTER_PACKED;
+	}
+	set_extent(inode, cluster, range);
+	return true;
 }
 
-// allocate inode for a non-existent file
-DirInodePair allocate_inode(ParsedPath parsed_path, uint8_t file_type, bool alloc_data) {
+// reads from the compressed file up to byte `request_end`, packed clusters are decompressed into the cache
+uint32_t compressed_read(FileDescriptorEntry* fd_entry, FileSystemInode* inode, const void* buf, uint32_t request_end) {
+	uint32_t bytes_read = 0;
+	while (fd_entry->read_pos < request_end) {
+		uint32_t file_block = fd_entry->read_pos / BLOCK_BYTES;
+		uint32_t block_offset = fd_entry->read_pos % BLOCK_BYTES;
+		uint32_t chunk = BLOCK_BYTES - block_offset;
+		if (chunk > request_end - fd_entry->read_pos) {
+			chunk = request_end - fd_entry->read_pos;
+		}
 
-	DirInodePair pair;
+		uint32_t cluster = file_block / COMPRESS_CLUSTER_BLOCKS;
+		uint32_t index = file_block % COMPRESS_CLUSTER_BLOCKS;
+		BitRange extent = (cluster < inode->extent_count) ? get_extent(inode, cluster) : (BitRange){0};
+		uint32_t blocks = extent.length & ~CLUSTER_PACKED;
+		CacheBlock* block = NULL;
+		if (extent.length & CLUSTER_PACKED) {
+			block = bcache_get(decompressed_block_name(extent, index));
+			if (!block->valid) {
+				if (!load_cluster(inode, cluster)) {
+					bcache_release(block);
+					break;
+				}
+				// the rest of the cluster is likely next
+				for (uint32_t i = 0; i < COMPRESS_CLUSTER_BLOCKS; i++) {
+					CacheBlock* decompressed = bcache_get(decompressed_block_name(extent, i));
+					memcpy(decompressed->data, cluster_plain + i * BLOCK_BYTES, BLOCK_BYTES);
+					bcache_mark_valid(decompressed);
+					bcache_release(decompressed);
+				}
+			}
+		} else if (!EXTENT_IS_HOLE(extent) && index < blocks) {
+			bcache_prefetch(extent.start + index, blocks - index);
+			block = bcache_read(extent.start + index);
+		}
 
-	// NOTE: for these functions that return signed, check
-	int32_t dir_inode_num = seek_directory(parsed_path.dir_path);
-	if (dir_inode_num == -1) {
-		pair.valid = false;
-		return pair;
-		// panic(error_msg);
+		if (block) {
+			memcpy((uint8_t*)buf + bytes_read, block->data + block_offset, chunk);
+			bcache_release(block);
+		} else {
+			memset((uint8_t*)buf + bytes_read, 0, chunk); // a hole
+		}
+		fd_entry->read_pos += chunk;
+		bytes_read += chunk;
 	}
-	pair.dir_inode_num = dir_inode_num; 
+	return bytes_read;
+}
 
-	// TODO: ensure that file doesn't already exist
-	// FileSystemInode dir_inode = global_inode_table[dir_inode_num];
+// writes to the compressed file, rewriting each cluster it touches whole
+uint32_t compressed_write(FileDescriptorEntry* fd_entry, uint32_t inode_num, FileSystemInode* inode, const void* buf, uint32_t count) {
+	uint32_t bytes_written = 0;
+	while (bytes_written < count) {
+		uint32_t cluster = fd_entry->write_pos / COMPRESS_CLUSTER_BYTES;
+		uint32_t offset = fd_entry->write_pos % COMPRESS_CLUSTER_BYTES;
+		uint32_t chunk = COMPRESS_CLUSTER_BYTES - offset;
+		if (chunk > count - bytes_written) {
+			chunk = count - bytes_written;
+		}
+
+		uint32_t cluster_start = cluster * COMPRESS_CLUSTER_BYTES;
+		uint32_t plain_bytes = (inode->size > cluster_start) ? inode->size - cluster_start : 0;
+		if (plain_bytes > COMPRESS_CLUSTER_BYTES) {
+			plain_bytes = COMPRESS_CLUSTER_BYTES;
+		}
+		if (chunk < COMPRESS_CLUSTER_BYTES && !load_cluster(inode, cluster)) {
+			break;
+		}
+		memcpy(cluster_plain + offset, (uint8_t*)buf + bytes_written, chunk);
+		if (offset + chunk > plain_bytes) {
+			plain_bytes = offset + chunk;
+		}
+		if (!store_cluster(inode_num, inode, cluster, plain_bytes)) {
+			break;
+		}
+
+		fd_entry->write_pos += chunk;
+		bytes_written += chunk;
+		if (fd_entry->write_pos > inode->size) {
+			inode->size = fd_entry->write_pos;
+		}
+	}
+	mark_inode_dirty(inode);
+	return bytes_written;
+}
+
+// cuts the compressed file down to `length` bytes
+bool truncate_compressed(uint32_t inode_num, FileSystemInode* inode, uint32_t length) {
+	uint32_t clusters = (length + COMPRESS_CLUSTER_BYTES - 1) / COMPRESS_CLUSTER_BYTES;
+	uint32_t cut = length % COMPRESS_CLUSTER_BYTES;
+	if (cut && clusters <= inode->extent_count && !EXTENT_IS_HOLE(get_extent(inode, clusters - 1))) {
+		// the last cluster kept loses its tail, cleared for a later extension
+		if (!load_cluster(inode, clusters - 1)) {
+			return false;
+		}
+		memset(cluster_plain + cut, 0, COMPRESS_CLUSTER_BYTES - cut);
+		if (!store_cluster(inode_num, inode, clusters - 1, cut)) {
+			return false;
+		}
+	}
+	for (uint32_t cluster = clusters; cluster < inode->extent_count; cluster++) {
+		free_cluster(get_extent(inode, cluster));
+	}
+	if (inode->extent_count > clusters) {
+		inode->extent_count = clusters;
+		trim_extent_block(inode);
+	}
+	return true;
+}
+
+// frees every data block of the inode, including the overflow extent block
+void release_file_blocks(FileSystemInode* inode) {
+	for (uint32_t extent = 0; extent < inode->extent_count; extent++) {
+		BitRange range = get_extent(inode, extent);
+		if (inode->flags & INODE_FLAG_COMPRESSED) {
+			free_cluster(range);
+		} else if (!EXTENT_IS_HOLE(range)) {
+			free_blocks(range);
+		}
+	}
+	if (inode->extent_block) {
+		BitRange overflow = {.start = inode->extent_block, .length = 1};
+		free_blocks(overflow);
+	}
+	inode->extent_count = 0;
+	inode->extent_block = 0;
+	inode->size = 0;
+}
+
+// adds a run to the extent list being rebuilt, merging it into the previous one when it continues it
+void push_scratch_extent(uint32_t* count, BitRange range) {
+	if (range.length == 0) {
+		return;
+	}
+	if (*count) {
+		BitRange* last = &extent_scratch[*count - 1];
+		if (EXTENT_IS_HOLE(*last) ? EXTENT_IS_HOLE(range) : last->start + last->length == range.start) {
+			last->length += range.length;
+			return;
+		}
+	}
+	extent_scratch[(*count)++] = range;
+}
+
+// the part of the extent from `offset` on, `length` blocks long
+BitRange slice_extent(BitRange extent, uint32_t offset, uint32_t length) {
+	return (BitRange){.start = EXTENT_IS_HOLE(extent) ? 0 : extent.start + offset, .length = length};
+}
+
+// maps file blocks [`first_block`, `first_block` + range.length) of the inode to `range`, a hole if it starts at 0,
+// freeing the blocks they were mapped to; a hole left at the end of the file is dropped
+bool replace_file_range(FileSystemInode* inode, uint32_t first_block, BitRange range) {
+	uint32_t end_block = first_block + range.length;
+	uint32_t count = 0;
+	uint32_t extent_base = 0;
+	bool placed = false;
+	for (uint32_t index = 0; index < inode->extent_count; index++) {
+		BitRange extent = get_extent(inode, index);
+		uint32_t extent_end = extent_base + extent.length;
+		if (extent_base < first_block) {
+			uint32_t kept = (extent_end < first_block) ? extent.length : first_block - extent_base;
+			push_scratch_extent(&count, slice_extent(extent, 0, kept));
+		}
+		if (!placed && extent_end > first_block) {
+			push_scratch_extent(&count, range);
+			placed = true;
+		}
+		if (extent_end > end_block) {
+			uint32_t skipped = (end_block > extent_base) ? end_block - extent_base : 0;
+			push_scratch_extent(&count, slice_extent(extent, skipped, extent.length - skipped));
+		}
+		extent_base = extent_end;
+	}
+	if (!placed) {
+		push_scratch_extent(&count, (BitRange){.start = 0, .length = first_block - extent_base});
+		push_scratch_extent(&count, range);
+	}
+	while (count && EXTENT_IS_HOLE(extent_scratch[count - 1])) {
+		count--;
+	}
+	if (count > INODE_EXTENTS_MAX) {
+		PUSH_ERROR("file is too fragmented");
+		return false;
+	}
+
+	if (!ensure_extent_block(inode, count, range.start ? range.start + range.length : global_groups[0].data_start)) {
+		return false;
+	}
+
+	// the new list is settled, let go of what the range was mapped to
+	uint32_t file_block = first_block;
+	while (file_block < end_block) {
+		uint32_t run_length;
+		uint32_t disk_block = map_file_block(inode, file_block, &run_length);
+		if (!run_length) {
+			break;
+		}
+		if (run_length > end_block - file_block) {
+			run_length = end_block - file_block;
+		}
+		if (disk_block) {
+			free_blocks((BitRange){.start = disk_block, .length = run_length});
+		}
+		file_block += run_length;
+	}
+
+	for (uint32_t index = 0; index < count; index++) {
+		set_extent(inode, index, extent_scratch[index]);
+	}
+	inode->extent_count = count;
+	trim_extent_block(inode);
+	return true;
+}
+
+// gives the holes among file blocks [`from`, `to`) blocks of their own, zeroed
+// returns the first file block left a hole once the disk is full, `to` if none
+uint32_t fill_file_holes(uint32_t inode_num, FileSystemInode* inode, uint32_t from, uint32_t to) {
+	while (from < to) {
+		uint32_t run_length;
+		uint32_t disk_block = map_file_block(inode, from, &run_length);
+		if (!run_length) {
+			break; // past the last extent, nothing to fill
+		}
+		if (run_length > to - from) {
+			run_length = to - from;
+		}
+		if (disk_block) {
+			from += run_length;
+			continue;
+		}
+
+		// continue the blocks just before the hole if there is room
+		uint32_t goal = from ? map_file_block(inode, from - 1, NULL) + 1 : 0;
+		if (goal <= 1) {
+			goal = global_groups[inode_num / global_super.inodes_per_group].data_start;
+		}
+		BitRange range = alloc_blocks(goal, run_length);
+		if (range.length == 0) {
+			PUSH_ERROR("no free data blocks");
+			return from;
+		}
+		if (!replace_file_range(inode, from, range)) {
+			free_blocks(range);
+			return from;
+		}
+		for (uint32_t i = 0; i < range.length; i++) {
+			CacheBlock* block = bcache_get(range.start + i);
+			memset(block->data, 0, BLOCK_BYTES);
+			bcache_mark_dirty(block);
+			bcache_release(block);
+		}
+		mark_inode_dirty(inode);
+		from += range.length;
+	}
+	return to;
+}
+
+// gives the file blocks of its own in place of the shared ones backing bytes [`from`, `to`), which are about to change
+// their data is copied over, but for blocks the range covers whole
+bool unshare_file_range(FileSystemInode* inode, uint64_t from, uint64_t to) {
+	uint32_t file_block = from / BLOCK_BYTES;
+	uint32_t end_block = (to + BLOCK_BYTES - 1) / BLOCK_BYTES;
+	while (file_block < end_block) {
+		uint32_t run_length;
+		uint32_t disk_block = map_file_block(inode, file_block, &run_length);
+		if (!run_length) {
+			break; // past the last extent, nothing there to share
+		}
+		if (run_length > end_block - file_block) {
+			run_length = end_block - file_block;
+		}
+		uint32_t unshared = disk_block ? shared_prefix(disk_block, run_length, false) : run_length;
+		if (unshared) {
+			file_block += unshared;
+			continue;
+		}
+
+		uint32_t shared = shared_prefix(disk_block, run_length, true);
+		BitRange range = alloc_blocks(disk_block, shared);
+		if (range.length == 0) {
+			PUSH_ERROR("no free data blocks to copy shared ones");
+			return false;
+		}
+		bcache_prefetch(disk_block, range.length);
+		for (uint32_t i = 0; i < range.length; i++) {
+			uint64_t block_start = (uint64_t)(file_block + i) * BLOCK_BYTES;
+			CacheBlock* copy = bcache_get(range.start + i);
+			if (block_start >= from && block_start + BLOCK_BYTES <= to) {
+				memset(copy->data, 0, BLOCK_BYTES);
+			} else {
+				CacheBlock* original = bcache_read(disk_block + i);
+				memcpy(copy->data, original->data, BLOCK_BYTES);
+				bcache_release(original);
+			}
+			bcache_mark_dirty(copy);
+			bcache_release(copy);
+		}
+		if (!replace_file_range(inode, file_block, range)) {
+			free_blocks(range);
+			return false;
+		}
+		mark_inode_dirty(inode);
+		file_block += range.length;
+	}
+	return true;
+}
+
+// zeroes bytes [`from`, `to`) of the file where blocks back them, holes read as zeroes already
+// false if shared blocks in the range couldn't be copied
+bool zero_file_range(FileSystemInode* inode, uint32_t from, uint32_t to) {
+	uint64_t span = (uint64_t)inode_block_count(inode) * BLOCK_BYTES;
+	if (to > span) {
+		to = span;
+	}
+	if (from < to && !unshare_file_range(inode, from, to)) {
+		return false;
+	}
+	while (from < to) {
+		uint32_t offset = from % BLOCK_BYTES;
+		uint32_t chunk = BLOCK_BYTES - offset;
+		if (chunk > to - from) {
+			chunk = to - from;
+		}
+		uint32_t disk_block = map_file_block(inode, from / BLOCK_BYTES, NULL);
+		if (disk_block) {
+			CacheBlock* block = (chunk == BLOCK_BYTES) ? bcache_get(disk_block) : bcache_read(disk_block);
+			memset(block->data + offset, 0, chunk);
+			bcache_mark_dirty(block);
+			bcache_release(block);
+		}
+		from += chunk;
+	}
+	return true;
+}
+
+// zeroes every data block of the directory inode through the cache
+void clear_file_blocks(FileSystemInode* inode) {
+	uint32_t blocks = inode_block_count(inode);
+	for (uint32_t file_block = 0; file_block < blocks; file_block++) {
+		CacheBlock* block = bcache_get(map_file_block(inode, file_block, NULL));
+		memset(block->data, 0, BLOCK_BYTES);
+		bcache_set_checksum(block, BLOCK_BYTES, BLOCK_CHECKSUM_OFFSET);
+		mark_metadata_dirty(block);
+		bcache_release(block);
+	}
+}
+
+// moves the data of an inline file out into a block, once a write no longer fits in the inode
+bool promote_inline_data(uint32_t inode_num, FileSystemInode* inode) {
+	uint8_t data[INODE_INLINE_BYTES];
+	memcpy(data, inode->inline_data, sizeof(data));
+	inode->flags &= ~INODE_FLAG_INLINE;
+	memset(inode->extents, 0, sizeof(inode->extents));
+	if (inode->size == 0) {
+		return true;
+	}
+
+	bool stored;
+	if (inode->flags & INODE_FLAG_COMPRESSED) {
+		memset(cluster_plain, 0, COMPRESS_CLUSTER_BYTES);
+		memcpy(cluster_plain, data, inode->size);
+		stored = store_cluster(inode_num, inode, 0, inode->size);
+	} else if ((stored = reserve_file_blocks(inode_num, inode, 1))) {
+		CacheBlock* block = bcache_get(map_file_block(inode, 0, NULL));
+		memset(block->data, 0, BLOCK_BYTES);
+		memcpy(block->data, data, inode->size);
+		bcache_mark_dirty(block);
+		bcache_release(block);
+	}
+	if (!stored) {
+		uint32_t size = inode->size;
+		release_file_blocks(inode);
+		memcpy(inode->inline_data, data, sizeof(data));
+		inode->flags |= INODE_FLAG_INLINE;
+		inode->size = size;
+	}
+	return stored;
+}
+
+// name the block of the run at `index` goes by in the cache until it is allocated
+uint32_t delayed_block_name(DelayedRun* run, uint32_t index) {
+	return DELAYED_BLOCK_BASE + (run - delayed_runs) * DELAYED_BLOCKS_MAX + index;
+}
+
+DelayedRun* find_delayed_run(uint32_t inode_num) {
+	for (uint32_t i = 0; i < DELAYED_FILES_MAX; i++) {
+		if (delayed_runs[i].count && delayed_runs[i].inode_num == inode_num) {
+			return &delayed_runs[i];
+		}
+	}
+	return NULL;
+}
+
+// gives the file's delayed blocks their place on disk, one run after its last extent when there is room
+void allocate_delayed_run(DelayedRun* run) {
+	FileSystemInode* inode = inode_get(run->inode_num);
+	bool reserved = reserve_file_blocks(run->inode_num, inode, run->first_block + run->count);
+	uint32_t allocated = inode_block_count(inode);
+	for (uint32_t index = 0; index < run->count && run->first_block + index < allocated; index++) {
+		CacheBlock* block = bcache_get(delayed_block_name(run, index));
+		ASSERT(block->valid, "delayed block must be cached");
+		bcache_rekey(block, map_file_block(inode, run->first_block + index, NULL));
+		bcache_release(block);
+	}
+	if (!reserved) {
+		// NOTE: the space was there when the data was written, only a file too fragmented
+		// for its extents ends up here, and loses what doesn't fit
+		bcache_discard(delayed_block_name(run, 0), run->count);
+		if (inode->size > allocated * BLOCK_BYTES) {
+			inode->size = allocated * BLOCK_BYTES;
+		}
+	}
+	mark_inode_dirty(inode);
+	inode_put(inode);
+	delayed_blocks -= run->count;
+	run->count = 0;
+}
+
+void allocate_delayed_blocks() {
+	for (uint32_t i = 0; i < DELAYED_FILES_MAX; i++) {
+		if (delayed_runs[i].count) {
+			allocate_delayed_run(&delayed_runs[i]);
+		}
+	}
+}
+
+// forgets the delayed blocks of a file being removed
+void drop_delayed_run(uint32_t inode_num) {
+	DelayedRun* run = find_delayed_run(inode_num);
+	if (run) {
+		bcache_discard(delayed_block_name(run, 0), run->count);
+		delayed_blocks -= run->count;
+		run->count = 0;
+	}
+}
+
+// holds back picking blocks for a write reaching up to file block `blocks_needed`,
+// returns the file's run to write the blocks past its last extent through,
+// or NULL when the write should allocate right away
+DelayedRun* delay_file_blocks(uint32_t inode_num, FileSystemInode* inode, uint32_t first_block, uint32_t blocks_needed) {
+	uint32_t allocated = inode_block_count(inode);
+	DelayedRun* run = find_delayed_run(inode_num);
+	uint32_t pending_end = allocated + (run ? run->count : 0);
+	if (blocks_needed <= allocated) {
+		return run;
+	}
+
+	// a large write is contiguous already, and one past a gap would leave a hole in the run
+	if (blocks_needed - allocated > DELAYED_BLOCKS_MAX || first_block > pending_end) {
+		if (run) {
+			allocate_delayed_run(run);
+		}
+		return NULL;
+	}
+	if (blocks_needed <= pending_end) {
+		return run;
+	}
+
+	// out of room, place everything held back so far
+	uint32_t free_run = DELAYED_FILES_MAX;
+	for (uint32_t i = 0; i < DELAYED_FILES_MAX && !run && free_run == DELAYED_FILES_MAX; i++) {
+		if (!delayed_runs[i].count) {
+			free_run = i;
+		}
+	}
+	if (delayed_blocks + (blocks_needed - pending_end) > DELAYED_BLOCKS_MAX || (!run && free_run == DELAYED_FILES_MAX)) {
+		allocate_delayed_blocks();
+		allocated = inode_block_count(inode);
+		run = NULL;
+		pending_end = allocated;
+		free_run = 0;
+		if (blocks_needed <= allocated) {
+			return NULL;
+		}
+	}
+
+	// the blocks have to be there once the run is allocated
+	uint32_t extra = blocks_needed - pending_end;
+	if (free_block_total() < delayed_blocks + extra) {
+		if (run) {
+			allocate_delayed_run(run);
+		}
+		return NULL;
+	}
+
+	if (!run) {
+		run = &delayed_runs[free_run];
+		run->inode_num = inode_num;
+		run->first_block = allocated;
+	}
+	run->count += extra;
+	delayed_blocks += extra;
+	return run;
+}
+
+void seal_super() {
+	crc32c_seal(&global_super, sizeof(FileSystemSuper), offsetof(FileSystemSuper, checksum));
+}
+
+// takes the checksum of a bitmap as cached, it runs while committing so nothing is read in
+// a bitmap the cache let go of is as the last seal found it, a changed one stays in the
+// running transaction, unrecyclable, until the commit sealing it
+void seal_bitmap(uint32_t block_num, uint32_t* checksum) {
+	CacheBlock* bitmap = bcache_lookup(block_num);
+	if (bitmap && bitmap->valid) {
+		*checksum = crc32c(0, bitmap->data, BLOCK_BYTES);
+	}
+}
+
+// takes the checksums of the group's bitmaps, then of its descriptor
+void seal_group_desc(uint32_t group) {
+	FileSystemGroupDesc* desc = &global_groups[group];
+	seal_bitmap(desc->block_bitmap, &desc->block_bitmap_checksum);
+	seal_bitmap(desc->inode_bitmap, &desc->inode_bitmap_checksum);
+	crc32c_seal(desc, sizeof(FileSystemGroupDesc), offsetof(FileSystemGroupDesc, checksum));
+}
+
+// whether the running transaction changed the bitmap, even if its descriptor isn't marked dirty yet
+bool bitmap_running(uint32_t block_num) {
+	CacheBlock* bitmap = bcache_lookup(block_num);
+	return bitmap && bitmap->writeback == BCACHE_RUNNING;
+}
+
+// brings the superblock and the group descriptors into the transaction, journal_commit runs it first
+// so the transactions the cache commits early carry the descriptors sealing their bitmaps as well
+void log_super_and_groups() {
+	if (super_dirty) {
+		seal_super();
+		CacheBlock* block = bcache_get(0);
+		memset(block->data, 0, BLOCK_BYTES);
+		memcpy(block->data, &global_super, sizeof(FileSystemSuper));
+		mark_metadata_dirty(block);
+		bcache_release(block);
+	}
+	for (uint32_t desc_block = 0; desc_block < group_desc_blocks(); desc_block++) {
+		uint32_t first_group = desc_block * GROUP_DESCS_PER_BLOCK;
+		uint32_t end_group = (first_group + GROUP_DESCS_PER_BLOCK < global_super.group_count) ? first_group + GROUP_DESCS_PER_BLOCK : global_super.group_count;
+		bool dirty = group_desc_block_dirty(desc_block);
+		for (uint32_t group = first_group; group < end_group && !dirty; group++) {
+			dirty = bitmap_running(global_groups[group].block_bitmap) || bitmap_running(global_groups[group].inode_bitmap);
+		}
+		if (dirty) {
+			for (uint32_t group = first_group; group < end_group; group++) {
+				seal_group_desc(group);
+			}
+			CacheBlock* block = bcache_get(global_super.group_desc_start + desc_block);
+			memcpy(block->data, (uint8_t*)global_groups + desc_block * BLOCK_BYTES, BLOCK_BYTES);
+			mark_metadata_dirty(block);
+			bcache_release(block);
+		}
+	}
+	super_dirty = false;
+	memset(group_desc_dirty, 0, sizeof(group_desc_dirty));
+}
+
+// keeps the superblock and the group descriptor blocks pinned in the cache while mounted, one descriptor
+// block covers GROUP_DESCS_PER_BLOCK groups, so log_super_and_groups never has to make room for them
+void pin_super_and_groups() {
+	bcache_get(0);
+	for (uint32_t desc_block = 0; desc_block < group_desc_blocks(); desc_block++) {
+		bcache_get(global_super.group_desc_start + desc_block);
+	}
+	journal_set_commit_hook(log_super_and_groups);
+}
+
+// lays out the block groups over the whole disk and creates the root directory
+bool format_file_system() {
+	strcpy(global_super.format_indicator, "Yorha");
+	global_super.disk_size = ata_get_disk_size();
+	global_super.sector_count = global_super.disk_size / SECTOR_BYTES;
+	global_super.version = FS_VERSION;
+	global_super.used_inodes = 0;
+	global_super.group_desc_start = SUPER_SIZE;
+
+	uint64_t block_count = global_super.disk_size / BLOCK_BYTES;
+	if (block_count > (uint64_t)FS_MAX_GROUPS * BLOCKS_PER_GROUP) {
+		block_count = (uint64_t)FS_MAX_GROUPS * BLOCKS_PER_GROUP;
+	}
+	global_super.block_count = block_count;
+	global_super.blocks_per_group = BLOCKS_PER_GROUP;
+	global_super.group_count = (global_super.block_count + BLOCKS_PER_GROUP - 1) / BLOCKS_PER_GROUP;
+
+	// inodes are sized off a full group, or off the whole disk when it doesn't fill one
+	uint32_t inode_blocks = (global_super.block_count < BLOCKS_PER_GROUP) ? global_super.block_count : BLOCKS_PER_GROUP;
+	global_super.inodes_per_group = (inode_blocks / BLOCKS_PER_INODE + INODES_PER_BLOCK - 1) / INODES_PER_BLOCK * INODES_PER_BLOCK;
+
+	// leave out a trailing group too short for its metadata and a few data blocks
+	uint32_t group_overhead = 2 + REFCOUNT_TABLE_BLOCKS + inode_table_blocks(); // bitmaps, reference counts and inode table
+	if (global_super.group_count > 1 && group_block_count(global_super.group_count - 1) < group_overhead + FS_MIN_GROUP_DATA) {
+		global_super.group_count--;
+		global_super.block_count = global_super.group_count * BLOCKS_PER_GROUP;
+	}
+
+	// the journal follows the group descriptors
+	global_super.journal_start = global_super.group_desc_start + group_desc_blocks();
+	global_super.journal_blocks = global_super.block_count / JOURNAL_FRACTION;
+	if (global_super.journal_blocks < JOURNAL_BLOCKS_MIN) {
+		global_super.journal_blocks = JOURNAL_BLOCKS_MIN;
+	} else if (global_super.journal_blocks > JOURNAL_BLOCKS_MAX) {
+		global_super.journal_blocks = JOURNAL_BLOCKS_MAX;
+	}
+	if (global_super.block_count < global_super.journal_start + global_super.journal_blocks + group_overhead + FS_MIN_GROUP_DATA) {
+		PUSH_ERROR("disk is too small to format");
+		return false;
+	}
+
+	for (uint32_t group = 0; group < global_super.group_count; group++) {
+		uint32_t group_start = group * BLOCKS_PER_GROUP;
+		uint32_t metadata_start = group_start + ((group == 0) ? global_super.journal_start + global_super.journal_blocks : 0);
+		FileSystemGroupDesc* desc = &global_groups[group];
+		memset(desc, 0, sizeof(FileSystemGroupDesc));
+		desc->block_bitmap = metadata_start;
+		desc->inode_bitmap = metadata_start + 1;
+		desc->refcount_table = metadata_start + 2;
+		desc->inode_table = desc->refcount_table + REFCOUNT_TABLE_BLOCKS;
+		desc->data_start = desc->inode_table + inode_table_blocks();
+		desc->free_blocks = group_block_count(group) - (desc->data_start - group_start);
+		desc->free_inodes = global_super.inodes_per_group;
+		mark_group_dirty(group);
+
+		// NOTE: permanently allocates all blocks used for metadata
+		CacheBlock* bitmap = bcache_get(desc->block_bitmap);
+		memset(bitmap->data, 0, BLOCK_BYTES);
+		BitRange metadata = {.start = 0, .length = desc->data_start - group_start};
+		apply_bitrange((uint32_t*)bitmap->data, metadata, true);
+		bcache_mark_dirty(bitmap);
+		bcache_release(bitmap);
+
+		bitmap = bcache_get(desc->inode_bitmap);
+		memset(bitmap->data, 0, BLOCK_BYTES);
+		bcache_mark_dirty(bitmap);
+		bcache_release(bitmap);
+		seal_group_desc(group); // before the bitmaps can leave the cache
+
+		for (uint32_t i = 0; i < REFCOUNT_TABLE_BLOCKS; i++) {
+			CacheBlock* table = bcache_get(desc->refcount_table + i);
+			memset(table->data, 0, BLOCK_BYTES);
+			bcache_set_checksum(table, BLOCK_BYTES, BLOCK_CHECKSUM_OFFSET);
+			bcache_mark_dirty(table);
+			bcache_release(table);
+		}
+	}
+	mark_super_dirty();
+
+	// TODO: add . and .. to directory
+
+	// create root dir at inode 0
+	// will have no contents within it, but it exists
+	int32_t root_inode_num = alloc_inode_num(0, FILE_TYPE_DIR);
+	ASSERT(root_inode_num == 0, "root directory must be inode 0");
+	FileSystemInode* root_inode = inode_get(0);
+	memset(root_inode, 0, sizeof(FileSystemInode));
+	root_inode->file_type = FILE_TYPE_DIR;
+	if (!reserve_file_blocks(0, root_inode, 1)) {
+		inode_put(root_inode);
+		return false;
+	}
+	clear_file_blocks(root_inode); // write empty directory
+	mark_inode_dirty(root_inode);
+	inode_put(root_inode);
+
+	// nothing is journaled before the journal exists, the new file system goes straight to disk
+	seal_group_desc(0); // the root directory took from the first group
+	seal_super();
+	bcache_flush();
+	uint8_t super_sector[SECTOR_BYTES] = {0};
+	memcpy(super_sector, &global_super, sizeof(FileSystemSuper));
+	ata_write_sectors(0, 1, super_sector);
+	ata_write_blocks(global_super.group_desc_start, (uint8_t*)global_groups, group_desc_blocks());
+	super_dirty = false;
+	memset(group_desc_dirty, 0, sizeof(group_desc_dirty));
+	metadata_updates = 0;
+
+	journal_format(global_super.journal_start, global_super.journal_blocks);
+	return true;
+}
+
+// we will format the disk on new disk
+// on startup we will read and store the metadata from it, mount the disk
+void mount_file_systems();
+
+bool initalize_file_system(bool force_format) {
+
+	crc32c_init();
+	bcache_init();
+	dcache_init();
+	journal_init();
+	memset(delayed_runs, 0, sizeof(delayed_runs));
+	delayed_blocks = 0;
+	super_dirty = false;
+	memset(group_desc_dirty, 0, sizeof(group_desc_dirty));
+	metadata_updates = 0;
+	last_sync_tick = timer_counter;
+
+	uint8_t buffer[512] = {0};
+	ata_read_sectors(0, 1, buffer); // NOTE: doesn't work when I use read block, because it overflows
+	
+	global_super = *(FileSystemSuper*)buffer;
+	if (!force_format && strcmp(global_super.format_indicator, "Yorha") == 0 && global_super.version == FS_VERSION
+		&& global_super.group_count <= FS_MAX_GROUPS
+		&& journal_mount(global_super.journal_start, global_super.journal_blocks) != -1) {
+		kprintf("Disk Recognized\n");
+		ata_read_sectors(0, 1, buffer); // replaying the journal may have brought a newer one home
+		global_super = *(FileSystemSuper*)buffer;
+		if (!crc32c_verify(&global_super, sizeof(FileSystemSuper), offsetof(FileSystemSuper, checksum))) {
+			report_checksum_error("superblock", 0);
+		}
+		ata_read_blocks(global_super.group_desc_start, (uint8_t*)global_groups, group_desc_blocks());
+		for (uint32_t group = 0; group < global_super.group_count; group++) {
+			if (!crc32c_verify(&global_groups[group], sizeof(FileSystemGroupDesc), offsetof(FileSystemGroupDesc, checksum))) {
+				report_checksum_error("group descriptor", group);
+			}
+		}
+		pin_super_and_groups();
+		mount_file_systems();
+		return true;	// disk formatted
+	}
+
+	// formatting disk
+	kprintf("Formatting Disk...\n");
+	memset(&global_super, 0, sizeof(FileSystemSuper));
+	if (!format_file_system()) {
+		return false;
+	}
+
+	pin_super_and_groups();
+	mount_file_systems();
+	return true;
+}
+
+// directory slots, see FileSystemDirDataBlock
+uint32_t dir_slot_count(FileSystemInode* dir_inode) {
+	return inode_block_count(dir_inode) * DIR_FILE_COUNT_MAX;
+}
+
+// returns the entry in `slot` of the directory, pinned in `block` until released
+FileSystemDirEntry* dir_slot_entry(FileSystemInode* dir_inode, uint32_t slot, CacheBlock** block) {
+	*block = read_checked_block(map_file_block(dir_inode, slot / DIR_FILE_COUNT_MAX, NULL));
+	return &((FileSystemDirDataBlock*)(*block)->data)->contents[slot % DIR_FILE_COUNT_MAX];
+}
+
+// follows the probe sequence of `filename`, returns its slot or -1 if it isn't in the directory
+// `inode_num` (optional) receives the inode of the entry found
+// `free_slot` (optional) receives the first slot along the way a new entry could take, or -1
+int32_t dir_find_slot(FileSystemInode* dir_inode, const char* filename, uint32_t* inode_num, int32_t* free_slot) {
+	uint32_t slot_count = dir_slot_count(dir_inode);
+	if (free_slot) {
+		*free_slot = -1;
+	}
+	if (slot_count == 0) {
+		return -1;
+	}
+
+	int32_t found = -1;
+	uint32_t slot = strhash(filename) % slot_count;
+	CacheBlock* block = NULL;
+	for (uint32_t probe = 0; probe < slot_count; probe++, slot = (slot + 1) % slot_count) {
+		// only go back to the cache when the probe crosses into another block
+		if (!block || slot % DIR_FILE_COUNT_MAX == 0) {
+			if (block) {
+				bcache_release(block);
+			}
+			dir_slot_entry(dir_inode, slot, &block);
+		}
+
+		FileSystemDirEntry* entry = &((FileSystemDirDataBlock*)block->data)->contents[slot % DIR_FILE_COUNT_MAX];
+		if (entry->name[0] == '\0') {
+			if (free_slot && *free_slot == -1) {
+				*free_slot = slot;
+			}
+			if (entry->inode_num != DIR_TOMBSTONE) {
+				break; // never used, the name would have been placed here
+			}
+		} else if (strcmp(entry->name, filename) == 0) {
+			if (inode_num) {
+				*inode_num = entry->inode_num;
+			}
+			found = slot;
+			break;
+		}
+	}
+	if (block) {
+		bcache_release(block);
+	}
+	return found;
+}
+// places an entry in the first free slot along the probe sequence of `filename`
+// the caller makes sure the name isn't taken and the table has room
+void dir_insert_entry(FileSystemInode* dir_inode, const char* filename, uint32_t inode_num, uint8_t file_type) {
+	int32_t free_slot;
+	dir_find_slot(dir_inode, filename, NULL, &free_slot);
+	ASSERT(free_slot != -1, "directory table is full");
+
+	CacheBlock* block;
+	FileSystemDirEntry* entry = dir_slot_entry(dir_inode, free_slot, &block);
+	if (entry->inode_num == DIR_TOMBSTONE) {
+		dir_inode->dir_tombstones--; // reused
+	}
+	strcpy(entry->name, filename);
+	entry->inode_num = inode_num;
+	entry->file_type = file_type;
+	mark_metadata_dirty(block);
+	bcache_release(block);
+}
+
+// rebuilds the directory's table over `block_count` fresh blocks, dropping its tombstones
+bool rehash_dir(uint32_t dir_inode_num, FileSystemInode* dir_inode, uint32_t block_count) {
+	FileSystemInode rebuilt = {.file_type = FILE_TYPE_DIR, .size = dir_inode->size};
+	if (!reserve_file_blocks(dir_inode_num, &rebuilt, block_count)) {
+		release_file_blocks(&rebuilt);
+		return false;
+	}
+	clear_file_blocks(&rebuilt);
+
+	uint32_t slot_count = dir_slot_count(dir_inode);
+	for (uint32_t slot = 0; slot < slot_count; slot++) {
+		CacheBlock* block;
+		FileSystemDirEntry entry = *dir_slot_entry(dir_inode, slot, &block);
+		bcache_release(block);
+		if (entry.name[0] != '\0') {
+			dir_insert_entry(&rebuilt, entry.name, entry.inode_num, entry.file_type);
+		}
+	}
+
+	release_file_blocks(dir_inode);
+	dir_inode->extent_count = rebuilt.extent_count;
+	dir_inode->extent_block = rebuilt.extent_block;
+	memcpy(dir_inode->extents, rebuilt.extents, sizeof(rebuilt.extents));
+	dir_inode->size = rebuilt.size;
+	dir_inode->dir_tombstones = 0;
+	return true;
+}
+
+// return -1 if can't find file
+// returns the inode corresponding to the file within a given
+// directory
+int32_t search_dir(uint32_t dir_inode_num, const char* filename) {
+
+	// names looked up before, found or not, don't need the directory at all
+	uint32_t cached_inode_num;
+	if (dcache_lookup(dir_inode_num, filename, &cached_inode_num)) {
+		if (cached_inode_num == DCACHE_NEGATIVE) {
+			PUSH_ERROR("couldn't trace path");
+			return -1;
+		}
+		return cached_inode_num;
+	}
+	
+	FileSystemInode* dir_inode = inode_get(dir_inode_num);
+	ASSERT(dir_inode->file_type == FILE_TYPE_DIR, "must be a directory"); 
+
+	uint32_t inode_num;
+	int32_t slot = dir_find_slot(dir_inode, filename, &inode_num, NULL);
+	inode_put(dir_inode);
+	if (slot == -1) {
+		dcache_insert(dir_inode_num, filename, DCACHE_NEGATIVE);
+		PUSH_ERROR("couldn't trace path");
+		return -1;
+	}
+	dcache_insert(dir_inode_num, filename, inode_num);
+	return inode_num;
+}
+
+// returns the inode_num corresponding to the directory
+int32_t seek_directory(const char* dir_path) {
+
+	// must end and begin with '/' (absolute path to directory)
+	char next_dir[32] = ""; // maximum 32 character name
+	uint32_t current_inode_num = 0; // root directory
+	// char* current_char = dir_path + 1; // skip the '/'
+	size_t current_char = 1; // skip the '/'
+
+	if (dir_path[0] != '/') {
+		PUSH_ERROR("relative indexing not implemented");
+		return -1;
+	}
+ 
+	uint16_t char_index = 0;
+	while (dir_path[current_char]) {
+		if (dir_path[current_char] == '/' || dir_path[current_char + 1] == '\0') { // done with writing next directory name
+			// TODO: conserving the syntax of referencing the directory like `/dir_name` without the last `/`
+			// NOTE: ignoring root, maybe rethink abstraction
+			if (dir_path[current_char] != '/' && dir_path[current_char + 1] == '\0') {
+				next_dir[char_index++] = dir_path[current_char];
+			}
+
+			next_dir[char_index] = '\0'; // end directory name
+			if (inode_read(current_inode_num).file_type != FILE_TYPE_DIR) {
+				PUSH_ERROR("file is not a directory");
+				return -1;
+			}
+			// look at the current_inode directory for next_dir
+			int32_t file_inode_number = search_dir(current_inode_num, next_dir);
+			if (file_inode_number == -1) {
+				PUSH_ERROR("couldn't trace path");
+				return -1; // couldn't trace the path
+			}
+			current_inode_num = file_inode_number;
+			char_index = 0;
+		} else {
+			next_dir[char_index++] = dir_path[current_char];
+		}
+		current_char++;
+	}
+
+	if (inode_read(current_inode_num).file_type != FILE_TYPE_DIR) {
+		PUSH_ERROR("file is not a directory");
+		return -1;
+	}
+
+	return current_inode_num;
+}
+
+void parse_path(const char* path, char* dir_path, char* filename) {
+
+	strcpy(dir_path, path);
+	size_t i = 0;
+
+	uint32_t last_slash = 0;
+	while (path[i]) {
+		if (path[i] == '/') {
+			last_slash = i;
+		}
+		i++;
+	}
+
+	strcpy(filename, dir_path + last_slash + 1); // copy tail
+	dir_path[last_slash + 1] = '\0'; // end at slash
+}
+
+// Remember to free con
+ParsedPath Path(const char* path) {
+	ParsedPath parsed_path;
+	size_t path_length = strlen(path) + 1; // ONLY TO THE NULL
+	parsed_path.dir_path = kmalloc(path_length);
+	parsed_path.filename = kmalloc(path_length);
+	// parse_path(path, parsed_path.dir_path, parsed_path.filename);
+
+	strcpy(parsed_path.dir_path, path);
+	size_t i = 0;
+	uint32_t last_slash = 0;
+	while (path[i]) {
+		if (path[i] == '/') {
+			last_slash = i;
+		}
+		i++;
+	}
+
+	strcpy(parsed_path.filename, parsed_path.dir_path + last_slash + 1); // copy tail
+	parsed_path.dir_path[last_slash + 1] = '\0'; // end at slash
+
+	return parsed_path;
+}
+
+// allocate inode for a non-existent file
+DirInodePair allocate_inode(ParsedPath parsed_path, uint8_t file_type, bool alloc_data) {
+
+	DirInodePair pair;
+
+	// the name is kept in the inode and the directory entry, as rename() does
+	if (strlen(parsed_path.filename) >= sizeof(((FileSystemDirEntry*)0)->name)) {
+		PUSH_ERROR("name is too long");
+		pair.valid = false;
+		return pair;
+	}
+
+	// NOTE: for these functions that return signed, check
+	int32_t dir_inode_num = seek_directory(parsed_path.dir_path);
+	if (dir_inode_num == -1) {
+		pair.valid = false;
+		return pair;
+		// panic(error_msg);
+	}
+	pair.dir_inode_num = dir_inode_num; 
+	if (!check_writable(dir_inode_num)) {
+		pair.valid = false;
+		return pair;
+	}
+
+	// TODO: ensure that file doesn't already exist
 	if (search_dir(dir_inode_num, parsed_path.filename) != -1) {
 		PUSH_ERROR("can't create file under same name");
 		pair.valid = false;
 		return pair; // can't create file under same name
 	}
 
-	// NOTE: we assign a file_inode to a directory as soon as its made
-	FileSystemInode file_inode = {.file_type = file_type, .parent_inode_num = dir_inode_num, .size = 0};
-	strcpy(file_inode.name, parsed_path.filename);
-
-	// allocate inode for file
-	BitRange ib_range = alloc_bitrange(global_ibmap, BLOCK_BYTES * 8, 1, false);
-	if (ib_range.length == 0) { // can't allocate inode
-		// shouldn't need to dealloc
-		PANIC("allocate_inode: can't allocate inode");
-		pair.valid = false;
-		return pair;
+	// allocate inode for file, close to its directory
+	int32_t file_inode_num = alloc_inode_num(dir_inode_num, file_type);
+	if (file_inode_num == -1) { // can't allocate inode
+		pair.valid = false;
+		return pair;
+	}
+	pair.file_inode_num = file_inode_num;
+
+	// NOTE: we assign a file_inode to a directory as soon as its made
+	FileSystemInode* file_inode = inode_get(file_inode_num);
+	memset(file_inode, 0, sizeof(FileSystemInode));
+	file_inode->file_type = file_type;
+	file_inode->flags = (file_type == FILE_TYPE_NORMAL) ? INODE_FLAG_INLINE : 0;
+	if (file_type != FILE_TYPE_SPECIAL) {
+		file_inode->flags |= inode_read(dir_inode_num).flags & INODE_FLAG_COMPRESSED;
+	}
+	file_inode->parent_inode_num = dir_inode_num;
+	strcpy(file_inode->name, parsed_path.filename);
+	mark_inode_dirty(file_inode);
+
+	if (alloc_data) {
+		// allocate data blocks for file
+		if (!reserve_file_blocks(file_inode_num, file_inode, 1)) {
+			release_file_blocks(file_inode);
+			inode_put(file_inode);
+			free_inode_num(file_inode_num, file_type);
+			pair.valid = false;
+			return pair;
+		}
+		if (file_type == FILE_TYPE_DIR) {
+			clear_file_blocks(file_inode); // every slot starts out never used
+		}
+	}
+	inode_put(file_inode);
+
+	pair.valid = true;
+	return pair;
+}
+
+// changes both of their state such that the file is within the other directory
+int32_t link_file_in_dir(uint32_t dir_inode_num, uint32_t file_inode_num) {
+
+	FileSystemInode* dir_inode = inode_get(dir_inode_num);
+	char filename[sizeof(dir_inode->name)];
+	FileSystemInode* file_inode = inode_get(file_inode_num);
+	memcpy(filename, file_inode->name, sizeof(filename) - 1); // bounded, the inode may come off a corrupt disk
+	filename[sizeof(filename) - 1] = '\0';
+	uint8_t file_type = file_inode->file_type;
+	inode_put(file_inode);
+
+	// keep at least a quarter of the slots unused so probes stay short
+	// tombstones are cleared out in place, unless the live entries alone pass half the table
+	uint32_t entries = dir_inode->size / sizeof(FileSystemDirEntry) + 1;
+	uint32_t slot_count = dir_slot_count(dir_inode);
+	if ((entries + dir_inode->dir_tombstones) * 4 > slot_count * 3) {
+		uint32_t block_count = inode_block_count(dir_inode);
+		if (entries * 2 > slot_count) {
+			block_count *= 2;
+		}
+		if (!rehash_dir(dir_inode_num, dir_inode, block_count)) {
+			inode_put(dir_inode);
+			return -1;
+		}
+	}
+
+	dir_insert_entry(dir_inode, filename, file_inode_num, file_type);
+	dir_inode->size += sizeof(FileSystemDirEntry);
+	mark_inode_dirty(dir_inode);
+	inode_put(dir_inode);
+	dcache_invalidate(dir_inode_num, filename); // drop the negative entry
+
+	return 0;
+}
+
+void unlink_file_in_dir(uint32_t dir_inode_num, const char* filename) {
+	dcache_invalidate(dir_inode_num, filename);
+
+	// NOTE: should do nothing if the file doesn't exist in the dir
+	FileSystemInode* dir_inode = inode_get(dir_inode_num);
+	int32_t slot = dir_find_slot(dir_inode, filename, NULL, NULL);
+	if (slot == -1) {
+		inode_put(dir_inode);
+		return;
+	}
+
+	// leave a tombstone, so the entries probed past this slot can still be found
+	CacheBlock* block;
+	FileSystemDirEntry* entry = dir_slot_entry(dir_inode, slot, &block);
+	memset(entry->name, 0, sizeof(entry->name));
+	entry->inode_num = DIR_TOMBSTONE;
+	mark_metadata_dirty(block);
+	bcache_release(block);
+	dir_inode->size -= sizeof(FileSystemDirEntry); // reduce the size
+	dir_inode->dir_tombstones++;
+	mark_inode_dirty(dir_inode);
+	inode_put(dir_inode);
+}
+
+// points the existing entry `filename` of the directory at another inode
+void relink_file_in_dir(uint32_t dir_inode_num, const char* filename, uint32_t file_inode_num, uint8_t file_type) {
+	FileSystemInode* dir_inode = inode_get(dir_inode_num);
+	int32_t slot = dir_find_slot(dir_inode, filename, NULL, NULL);
+	ASSERT(slot != -1, "entry to relink must exist");
+
+	CacheBlock* block;
+	FileSystemDirEntry* entry = dir_slot_entry(dir_inode, slot, &block);
+	entry->inode_num = file_inode_num;
+	entry->file_type = file_type;
+	mark_metadata_dirty(block);
+	bcache_release(block);
+	inode_put(dir_inode);
+	dcache_invalidate(dir_inode_num, filename);
+}
+
+// operations on regular files, defined with the syscalls below
+uint64_t file_read(int64_t fd, const void* buf, uint32_t count);
+uint64_t file_write(int64_t fd, const void* buf, uint32_t count);
+int32_t file_seek(int64_t fd, int32_t offset, uint32_t param);
+int64_t file_close(int64_t fd);
+uint64_t dir_io(int64_t fd, const void* buf, uint32_t count);
+
+int32_t dir_readdir(int64_t fd, DirRecord* entries, uint32_t max);
+
+static const FileOps regular_file_ops = {file_read, file_write, file_seek, file_close, NULL};
+static const FileOps dir_file_ops = {dir_io, dir_io, file_seek, release_file_descriptor, dir_readdir};
+
+int32_t allocate_file_descriptor(uint32_t inode_num, const char* filename, const FileOps* ops) {
+	BitRange fd_range = alloc_bitrange(global_fd_table.bitmap, BLOCK_BYTES * 8, 1, false);
+	if (fd_range.length == 0) {
+		return -1;
+	}
+	uint32_t fd_index = fd_range.start;
+	FileDescriptorEntry file_descriptor = {.write_pos = 0, .read_pos = 0, .inode_num = inode_num, .index = fd_index, .ops = ops};
+	strcpy(file_descriptor.name, filename);
+	global_fd_table.entries[fd_index] = file_descriptor;
+	// NOTE: we don't keep track of the number of used file descriptors
+	return fd_index;
+}
+
+// opens a file on disk, its operations picked from the kind of file
+int32_t open_inode(uint32_t file_inode_num, char* filename) {
+	// the kind of file is settled here, so the I/O calls don't have to look again
+	FileSystemInode inode = inode_read(file_inode_num);
+	const FileOps* ops = &regular_file_ops;
+	if (inode.file_type == FILE_TYPE_DIR) {
+		ops = &dir_file_ops;
+	} else if (inode.file_type == FILE_TYPE_SPECIAL) {
+		ops = special_file_ops(inode.name);
+		if (!ops) {
+			PUSH_ERROR("no driver for special file");
+			return -1;
+		}
+	}
+	return allocate_file_descriptor(file_inode_num, filename, ops);
+}
+
+int64_t disk_create(const Mount* mount, const char* path, uint8_t file_type, bool allocate_fd) {
+	UNUSED(mount);
+	sync_if_due();
+	
+	ParsedPath parsed_path = Path(path);
+	DirInodePair inode_pair = allocate_inode(parsed_path, file_type, file_type == FILE_TYPE_DIR); // files start inline
+	if (!inode_pair.valid) {
+		kfree(parsed_path.dir_path);
+		kfree(parsed_path.filename);
+		PUSH_ERROR("Couldn't allocate inode");
+		return -1;
+	}
+
+	int32_t fd_index = link_file_in_dir(inode_pair.dir_inode_num, inode_pair.file_inode_num);
+	if (fd_index != -1 && allocate_fd) {
+		fd_index = open_inode(inode_pair.file_inode_num, parsed_path.filename);
+		if (fd_index == -1) {
+			unlink_file_in_dir(inode_pair.dir_inode_num, parsed_path.filename);
+		}
+	}
+	
+	kfree(parsed_path.dir_path);
+	kfree(parsed_path.filename);
+
+	// cleanup
+	if (fd_index == -1) {
+		FileSystemInode* file_inode = inode_get(inode_pair.file_inode_num);
+		release_file_blocks(file_inode);
+		mark_inode_dirty(file_inode);
+		inode_put(file_inode);
+		free_inode_num(inode_pair.file_inode_num, file_type);
+	}
+	
+	return fd_index; // file descriptor index
+}
+
+// -- FILE SYSTEM SYSCALLS --
+int64_t disk_open(const Mount* mount, const char* path) {
+	UNUSED(mount);
+	// this will open up some process related state keeping track of the cursor
+	// can't open directories
+
+	// follow path to target directory
+	ParsedPath parsed_path = Path(path);
+
+	// char dir_path[strlen(path)];
+	// char filename[32];
+	// parse_path(path, dir_path, filename);
+
+	int32_t dir_inode_num = seek_directory(parsed_path.dir_path);
+	if (dir_inode_num == -1) {
+		kfree(parsed_path.dir_path);
+		kfree(parsed_path.filename);
+		return -1;
+	}
+
+	// read directory for files, a trailing '/' opens the directory itself
+	int32_t file_inode_num = (parsed_path.filename[0] == '\0') ? dir_inode_num : search_dir(dir_inode_num, parsed_path.filename);
+	if (file_inode_num == -1) {
+		PUSH_ERROR("file doesn't exist");
+		kfree(parsed_path.dir_path);
+		kfree(parsed_path.filename);
+		return -1; // file doesn't exist
+	} 
+
+	// kprintf("[open] file_inode_num: %u\n", file_inode_num);
+	// kprintf("Start: %u\n", global_inode_table[file_inode_num].extents[0].start);
+	// create file descriptor
+	int32_t fd_index = open_inode(file_inode_num, parsed_path.filename);
+	
+	kfree(parsed_path.dir_path);
+	kfree(parsed_path.filename);
+
+	// BitRange range = alloc_bitrange(global_fd_table.bitmap, BLOCK_BYTES * 8, 1, false);
+	// uint32_t fd_index = range.start;
+	// FileDescriptorEntry file_descriptor = {.write_pos = 0, .read_pos = 0, .inode_num = file_inode_num, .index = fd_index};
+	// strcpy(file_descriptor.name, parsed_path.filename);
+	// global_fd_table.entries[fd_index] = file_descriptor;
+
+	return fd_index;
+}
+
+int64_t release_file_descriptor(int64_t fd) {
+	BitRange fd_bitmap_range = {.start = fd, .length = 1};
+	dealloc_bitrange(global_fd_table.bitmap, fd_bitmap_range);
+	return 0;
+}
+
+// the operations of an open file descriptor, NULL if it isn't open
+const FileOps* fd_ops(int64_t fd) {
+	if (fd < 0 || fd >= (int64_t)(sizeof(global_fd_table.entries) / sizeof(FileDescriptorEntry))
+		|| !(global_fd_table.bitmap[0] & (1u << (31 - fd)))) {
+		PUSH_ERROR("file descriptor is not allocated");
+		return NULL;
+	}
+	return global_fd_table.entries[fd].ops;
+}
+
+FileDescriptorEntry* file_descriptor(int64_t fd) {
+	return &global_fd_table.entries[fd];
+}
+
+// whether `fd` is a file or directory of the disk, the calls on its blocks and inode need one
+bool fd_on_disk(int64_t fd) {
+	const FileOps* ops = fd_ops(fd);
+	if (ops && ops != &regular_file_ops && ops != &dir_file_ops) {
+		PUSH_ERROR("not a file on disk");
+		return false;
+	}
+	return ops != NULL;
+}
+
+int64_t close(int64_t fd) {
+	const FileOps* ops = fd_ops(fd);
+	return ops ? ops->close(fd) : -1;
+}
+
+uint64_t read(int64_t fd, const void* buf, uint32_t count) {
+	sync_if_due();
+	const FileOps* ops = fd_ops(fd);
+	return ops ? ops->read(fd, buf, count) : 0;
+}
+
+uint64_t write(int64_t fd, const void* buf, uint32_t count) {
+	sync_if_due();
+	const FileOps* ops = fd_ops(fd);
+	return ops ? ops->write(fd, buf, count) : 0;
+}
+
+int32_t seek(int64_t fd, int32_t offset, uint32_t param) {
+	const FileOps* ops = fd_ops(fd);
+	return ops ? ops->seek(fd, offset, param) : -1;
+}
+
+int64_t file_close(int64_t fd) {
+	// done growing, the file's delayed blocks can be placed
+	DelayedRun* run = find_delayed_run(global_fd_table.entries[fd].inode_num);
+	if (run) {
+		allocate_delayed_run(run);
+	}
+	return release_file_descriptor(fd);
+}
+
+uint64_t file_read(int64_t fd, const void* buf, uint32_t count) {
+	// get inode from fd table
+	FileDescriptorEntry* fd_entry = &global_fd_table.entries[fd]; 
+	uint32_t fd_inode_num = fd_entry->inode_num;
+	DelayedRun* run = find_delayed_run(fd_inode_num);
+	if (run) {
+		allocate_delayed_run(run); // so every block read has a place on disk
+	}
+	FileSystemInode fd_inode = inode_read(fd_inode_num);
+
+	uint64_t request_end = fd_entry->read_pos + count;
+	if (request_end > fd_inode.size) {
+		request_end = fd_inode.size;
+	}
+
+	// inline, the data came along with the inode
+	if (fd_inode.flags & INODE_FLAG_INLINE) {
+		if (fd_entry->read_pos >= request_end) {
+			return 0;
+		}
+		uint32_t bytes_read = request_end - fd_entry->read_pos;
+		memcpy((uint8_t*)buf, fd_inode.inline_data + fd_entry->read_pos, bytes_read);
+		fd_entry->read_pos = request_end;
+		fd_entry->ra_expected = request_end;
+		return bytes_read;
+	}
+	if (fd_inode.flags & INODE_FLAG_COMPRESSED) {
+		uint32_t bytes_read = compressed_read(fd_entry, &fd_inode, buf, request_end);
+		fd_entry->ra_expected = fd_entry->read_pos;
+		return bytes_read;
+	}
+	uint32_t end_block = (request_end + BLOCK_BYTES - 1) / BLOCK_BYTES;
+	uint32_t file_blocks = (fd_inode.size + BLOCK_BYTES - 1) / BLOCK_BYTES;
+
+	// random access only fetches what was asked for
+	bool sequential = fd_entry->read_pos == fd_entry->ra_expected;
+	if (!sequential) {
+		fd_entry->ra_window = 0;
+		fd_entry->ra_end = 0;
+	}
+
+	// copy into buf, from cursor position, until cursor == size
+	uint32_t bytes_read = 0;
+	while (fd_entry->read_pos < request_end) {
+		uint32_t file_block = fd_entry->read_pos / BLOCK_BYTES;
+		uint32_t block_offset = fd_entry->read_pos % BLOCK_BYTES;
+		uint32_t remaining = request_end - fd_entry->read_pos;
+
+		// past what the cache was filled with, fetch the rest of the request
+		// plus a window that grows each time a sequential reader catches up with it
+		if (file_block >= fd_entry->ra_end) {
+			uint32_t to = end_block;
+			if (sequential) {
+				if (fd_entry->ra_window == 0) {
+					fd_entry->ra_window = READ_AHEAD_MIN;
+				} else if (fd_entry->ra_window < READ_AHEAD_MAX) {
+					fd_entry->ra_window *= 2;
+				}
+				to += fd_entry->ra_window;
+			}
+			if (to > file_block + BCACHE_BLOCKS / 2) {
+				to = file_block + BCACHE_BLOCKS / 2; // leave room to copy it out before it is evicted
+			}
+			if (to > file_blocks) {
+				to = file_blocks;
+			}
+			if (to - file_block > 1) {
+				prefetch_file_blocks(&fd_inode, file_block, to);
+			}
+			fd_entry->ra_end = to;
+		}
+
+		uint32_t chunk = BLOCK_BYTES - block_offset;
+		if (chunk > remaining) {
+			chunk = remaining;
+		}
+		uint32_t disk_block = map_file_block(&fd_inode, file_block, NULL);
+		if (disk_block) {
+			CacheBlock* block = bcache_read(disk_block);
+			memcpy((uint8_t*)buf + bytes_read, block->data + block_offset, chunk);
+			bcache_release(block);
+		} else {
+			memset((uint8_t*)buf + bytes_read, 0, chunk); // a hole
+		}
+		fd_entry->read_pos += chunk;
+		bytes_read += chunk;
+	}
+	fd_entry->ra_expected = fd_entry->read_pos;
+	return bytes_read;
+}
+
+uint64_t file_write(int64_t fd, const void* buf, uint32_t count) {
+	// get inode from fd table
+	FileDescriptorEntry* fd_entry = &global_fd_table.entries[fd]; 
+	uint32_t fd_inode_num = fd_entry->inode_num;
+	if (count == 0) {
+		return 0; // nothing to place, a delayed run stretched over the block would never see it written
+	}
+	FileSystemInode* fd_inode = inode_get(fd_inode_num);
+	if (fd_inode->flags & INODE_FLAG_READONLY) {
+		inode_put(fd_inode);
+		PUSH_ERROR("part of a read-only snapshot");
+		return 0;
+	}
+
+	// small enough to stay inline
+	if (fd_inode->flags & INODE_FLAG_INLINE) {
+		if (fd_entry->write_pos + count <= INODE_INLINE_BYTES) {
+			if (fd_entry->write_pos > fd_inode->size) {
+				memset(fd_inode->inline_data + fd_inode->size, 0, fd_entry->write_pos - fd_inode->size);
+			}
+			memcpy(fd_inode->inline_data + fd_entry->write_pos, buf, count);
+			fd_entry->write_pos += count;
+			if (fd_entry->write_pos > fd_inode->size) {
+				fd_inode->size = fd_entry->write_pos;
+			}
+			mark_inode_dirty(fd_inode);
+			inode_put(fd_inode);
+			return count;
+		}
+		if (!promote_inline_data(fd_inode_num, fd_inode)) {
+			inode_put(fd_inode);
+			return 0;
+		}
+		mark_inode_dirty(fd_inode);
+	}
+	if (fd_inode->flags & INODE_FLAG_COMPRESSED) {
+		uint32_t bytes_written = compressed_write(fd_entry, fd_inode_num, fd_inode, buf, count);
+		inode_put(fd_inode);
+		return bytes_written;
+	}
+
+	// shared blocks about to change are swapped for blocks of the file's own
+	// blocks already there between the end of the file and the write may hold anything
+	uint32_t change_from = (fd_entry->write_pos < fd_inode->size) ? fd_entry->write_pos : fd_inode->size;
+	if (!unshare_file_range(fd_inode, change_from, (uint64_t)fd_entry->write_pos + count)
+		|| (fd_entry->write_pos > fd_inode->size && !zero_file_range(fd_inode, fd_inode->size, fd_entry->write_pos))) {
+		inode_put(fd_inode);
+		return 0;
+	}
+
+	// make sure the blocks being written to exist, if the disk fills up, write what fits
+	uint32_t first_block = fd_entry->write_pos / BLOCK_BYTES;
+	uint32_t blocks_needed = (fd_entry->write_pos + count + BLOCK_BYTES - 1) / BLOCK_BYTES;
+	uint16_t extent_count = fd_inode->extent_count;
+	BitRange last_extent = extent_count ? get_extent(fd_inode, extent_count - 1) : (BitRange){0};
+	uint32_t size = fd_inode->size;
+	DelayedRun* delayed = delay_file_blocks(fd_inode_num, fd_inode, first_block, blocks_needed);
+	if (!delayed) {
+		// the blocks skipped over by a write past the end are left a hole,
+		// those written inside the file past its last extent are filled in zeroed below
+		if (!append_file_hole(fd_inode, first_block, blocks_needed)) {
+			inode_put(fd_inode);
+			return 0;
+		}
+		reserve_file_blocks(fd_inode_num, fd_inode, blocks_needed);
+	}
+	uint32_t allocated = inode_block_count(fd_inode); // blocks past this belong to the delayed run
+	uint32_t mapped_end = (blocks_needed < allocated) ? blocks_needed : allocated;
+	uint32_t filled = fill_file_holes(fd_inode_num, fd_inode, first_block, mapped_end);
+	if (filled < mapped_end || (!delayed && allocated < blocks_needed)) {
+		uint64_t capacity = (uint64_t)filled * BLOCK_BYTES;
+		count = (capacity > fd_entry->write_pos) ? capacity - fd_entry->write_pos : 0;
+	}
+
+	// stage the data in the cache, it reaches the disk when the blocks are flushed or evicted
+	uint32_t bytes_written = 0;
+	while (bytes_written < count) {
+		uint32_t file_block = fd_entry->write_pos / BLOCK_BYTES;
+		uint32_t block_offset = fd_entry->write_pos % BLOCK_BYTES;
+		uint32_t chunk = BLOCK_BYTES - block_offset;
+		if (chunk > count - bytes_written) {
+			chunk = count - bytes_written;
+		}
+
+		CacheBlock* block;
+		if (file_block >= allocated) {
+			// no block picked yet, earlier data of the block is still in the cache if there was any
+			block = bcache_get(delayed_block_name(delayed, file_block - delayed->first_block));
+			if (!block->valid) {
+				memset(block->data, 0, BLOCK_BYTES);
+			}
+		} else if (chunk == BLOCK_BYTES) {
+			block = bcache_get(map_file_block(fd_inode, file_block, NULL)); // overwritten whole, no need to read it
+		} else if ((uint64_t)file_block * BLOCK_BYTES < fd_inode->size) {
+			block = bcache_read(map_file_block(fd_inode, file_block, NULL)); // partial block, merge with what is already there
+		} else {
+			block = bcache_get(map_file_block(fd_inode, file_block, NULL)); // past the end, nothing to keep
+			if (!block->valid) {
+				memset(block->data, 0, BLOCK_BYTES);
+			}
+		}
+		memcpy(block->data + block_offset, (uint8_t*)buf + bytes_written, chunk);
+		if (file_block >= allocated) {
+			bcache_mark_delayed(block);
+		} else {
+			bcache_mark_dirty(block);
+		}
+		bcache_release(block);
+		fd_entry->write_pos += chunk;
+		bytes_written += chunk;
+		if (fd_entry->write_pos > fd_inode->size) {
+			fd_inode->size = fd_entry->write_pos;
+		}
+	}
+
+	// overwriting in place leaves the inode alone
+	BitRange new_last_extent = fd_inode->extent_count ? get_extent(fd_inode, fd_inode->extent_count - 1) : (BitRange){0};
+	if (fd_inode->size != size || fd_inode->extent_count != extent_count || new_last_extent.length != last_extent.length) {
+		mark_inode_dirty(fd_inode);
+	}
+	inode_put(fd_inode);
+	return bytes_written;
+}
+
+int32_t file_seek(int64_t fd, int32_t offset, uint32_t param) {
+	switch (param)
+	{
+	case SEEK_SET:
+		global_fd_table.entries[fd].read_pos = offset;
+		global_fd_table.entries[fd].write_pos = offset;
+		break;
+	case SEEK_CUR:
+		global_fd_table.entries[fd].read_pos += offset;
+		global_fd_table.entries[fd].write_pos += offset;
+		break;
+	case SEEK_END:
+		global_fd_table.entries[fd].read_pos = inode_read(global_fd_table.entries[fd].inode_num).size - offset;
+		global_fd_table.entries[fd].write_pos = inode_read(global_fd_table.entries[fd].inode_num).size - offset;
+		break;
+	}
+	return global_fd_table.entries[fd].read_pos; // TODO: figure out what this should really be doing
+}
+
+// outputs directories to the buffer
+void list_dir(const char* path, char* buf) {
+	
+	char dir_path[strlen(path) + 1];
+	char filename[32];
+	parse_path(path, dir_path, filename);
+
+	uint32_t dir_inode_num = seek_directory(dir_path);
+	// kprintf("Dir inode: %x\n", dir_inode_num);
+	FileSystemInode* dir_inode = inode_get(dir_inode_num);
+	uint32_t slot_count = dir_slot_count(dir_inode);
+	for (uint32_t slot = 0; slot < slot_count; slot++) {
+		CacheBlock* dir_block;
+		FileSystemDirEntry* entry = dir_slot_entry(dir_inode, slot, &dir_block);
+		if (entry->name[0] != '\0') {
+			buf += strcat(path, buf);
+			buf += strcat(entry->name, buf);
+			*(buf++) = '\n';
+		}
+		bcache_release(dir_block);
+	}
+	inode_put(dir_inode);
+}
+
+// directory contents are only handed out through readdir
+uint64_t dir_io(int64_t fd, const void* buf, uint32_t count) {
+	UNUSED(fd); UNUSED(buf); UNUSED(count);
+	PUSH_ERROR("is a directory");
+	return 0;
+}
+
+int32_t readdir(int64_t fd, DirRecord* entries, uint32_t max) {
+	const FileOps* ops = fd_ops(fd);
+	if (!ops) {
+		return -1;
+	}
+	if (!ops->readdir) {
+		PUSH_ERROR("file is not a directory");
+		return -1;
+	}
+	return ops->readdir(fd, entries, max);
+}
+
+int32_t dir_readdir(int64_t fd, DirRecord* entries, uint32_t max) {
+	FileDescriptorEntry* fd_entry = &global_fd_table.entries[fd];
+	FileSystemInode* dir_inode = inode_get(fd_entry->inode_num);
+	if (dir_inode->file_type != FILE_TYPE_DIR) {
+		inode_put(dir_inode);
+		PUSH_ERROR("file is not a directory");
+		return -1;
+	}
+
+	// read_pos is the next slot to look at
+	uint32_t slot_count = dir_slot_count(dir_inode);
+	uint32_t filled = 0;
+	CacheBlock* block = NULL;
+	while (filled < max && fd_entry->read_pos < slot_count) {
+		uint32_t slot = fd_entry->read_pos++;
+		if (!block || slot % DIR_FILE_COUNT_MAX == 0) {
+			if (block) {
+				bcache_release(block);
+			}
+			dir_slot_entry(dir_inode, slot, &block);
+		}
+
+		FileSystemDirEntry* entry = &((FileSystemDirDataBlock*)block->data)->contents[slot % DIR_FILE_COUNT_MAX];
+		if (entry->name[0] != '\0') {
+			strcpy(entries[filled].name, entry->name);
+			entries[filled].inode_num = entry->inode_num;
+			entries[filled].file_type = entry->file_type;
+			filled++;
+		}
+	}
+	if (block) {
+		bcache_release(block);
+	}
+	inode_put(dir_inode);
+	return filled;
+}
+
+int32_t disk_unlink(const Mount* mount, const char* path) {
+	UNUSED(mount);
+
+	char dir_path[strlen(path) + 1];
+	char filename[32];
+	parse_path(path, dir_path, filename);
+	int32_t dir_inode_num = seek_directory(dir_path);
+	if (dir_inode_num == -1 || !check_writable(dir_inode_num)) {
+		return -1;
+	}
+
+	// read directory for files
+	int32_t file_inode_num = search_dir(dir_inode_num, filename);
+	if (file_inode_num == -1) {
+		PUSH_ERROR("file doesn't exist");
+		return -1; // file doesn't exist
+	} 
+	sync_if_due();
+
+	FileSystemInode file_inode = inode_read(file_inode_num);
+	if (file_inode.file_type == FILE_TYPE_DIR && file_inode.size) {
+		PUSH_ERROR("directory not empty");
+		return -1;
+	}
+
+	unlink_file_in_dir(dir_inode_num, filename);
+	if (file_inode.file_type == FILE_TYPE_DIR) {
+		dcache_invalidate_dir(file_inode_num);
+	}
+
+	// unallocate data blocks 
+	drop_delayed_run(file_inode_num);
+	FileSystemInode* inode = inode_get(file_inode_num);
+	release_file_blocks(inode);
+	mark_inode_dirty(inode);
+	inode_put(inode);
+
+	// unallocate inode
+	free_inode_num(file_inode_num, file_inode.file_type); // don't need to clear the entry
+	
+	return 0;
+}
+
+// pins the regular file behind `fd` for a change to its blocks, with its delayed blocks placed
+// and its data out of the inode unless it is inline and `keep_inline` allows it
+FileSystemInode* get_file_for_resize(int64_t fd, bool keep_inline) {
+	if (!fd_on_disk(fd)) {
+		return NULL;
+	}
+	uint32_t inode_num = global_fd_table.entries[fd].inode_num;
+	sync_if_due();
+
+	FileSystemInode* inode = inode_get(inode_num);
+	if (inode->file_type != FILE_TYPE_NORMAL) {
+		inode_put(inode);
+		PUSH_ERROR("can only change the blocks of regular files");
+		return NULL;
+	}
+	if (inode->flags & INODE_FLAG_READONLY) {
+		inode_put(inode);
+		PUSH_ERROR("part of a read-only snapshot");
+		return NULL;
+	}
+	// whatever was held back goes first, so the blocks placed now follow it
+	DelayedRun* run = find_delayed_run(inode_num);
+	if (run) {
+		allocate_delayed_run(run);
+	}
+	if ((inode->flags & INODE_FLAG_INLINE) && !keep_inline) {
+		if (!promote_inline_data(inode_num, inode)) {
+			inode_put(inode);
+			return NULL;
+		}
+		mark_inode_dirty(inode);
+	}
+	return inode;
+}
+
+int32_t fallocate(int64_t fd, uint32_t offset, uint32_t length) {
+	FileSystemInode* inode = get_file_for_resize(fd, false);
+	if (!inode) {
+		return -1;
+	}
+	if (inode->flags & INODE_FLAG_COMPRESSED) {
+		inode_put(inode);
+		PUSH_ERROR("can't preallocate a compressed file");
+		return -1;
+	}
+	uint32_t inode_num = global_fd_table.entries[fd].inode_num;
+
+	uint32_t first_block = offset / BLOCK_BYTES;
+	uint32_t blocks = ((uint64_t)offset + length + BLOCK_BYTES - 1) / BLOCK_BYTES;
+	// blocks inside the file past its last extent are preallocated through a hole, so they come zeroed
+	bool reserved = append_file_hole(inode, first_block, blocks);
+	reserved = reserved && reserve_file_blocks(inode_num, inode, blocks);
+	reserved = reserved && fill_file_holes(inode_num, inode, first_block, blocks) == blocks;
+	mark_inode_dirty(inode);
+	inode_put(inode);
+	return reserved ? 0 : -1;
+}
+
+int32_t ftruncate(int64_t fd, uint32_t length) {
+	FileSystemInode* inode = get_file_for_resize(fd, length <= INODE_INLINE_BYTES);
+	if (!inode) {
+		return -1;
+	}
+
+	if (inode->flags & INODE_FLAG_INLINE) {
+		if (length > inode->size) {
+			memset(inode->inline_data + inode->size, 0, length - inode->size);
+		}
+	} else if (inode->flags & INODE_FLAG_COMPRESSED) {
+		// clusters past the end read as zeroes, growing has nothing to do
+		if (length < inode->size && !truncate_compressed(global_fd_table.entries[fd].inode_num, inode, length)) {
+			inode_put(inode);
+			return -1;
+		}
+	} else if (length < inode->size) {
+		// the blocks past the new end go back to the disk, the rest of the last one is cleared for a later extension
+		uint32_t blocks = ((uint64_t)length + BLOCK_BYTES - 1) / BLOCK_BYTES;
+		uint32_t span = inode_block_count(inode);
+		if ((blocks < span && !replace_file_range(inode, blocks, (BitRange){.start = 0, .length = span - blocks}))
+			|| !zero_file_range(inode, length, blocks * BLOCK_BYTES)) {
+			inode_put(inode);
+			return -1;
+		}
+	} else if (!zero_file_range(inode, inode->size, length)) {
+		// growing adds a hole, except over blocks preallocated past the old end
+		inode_put(inode);
+		return -1;
+	}
+	inode->size = length;
+	mark_inode_dirty(inode);
+	inode_put(inode);
+	return 0;
+}
+
+int32_t punch_hole(int64_t fd, uint32_t offset, uint32_t length) {
+	FileSystemInode* inode = get_file_for_resize(fd, true);
+	if (!inode) {
+		return -1;
+	}
+	if ((inode->flags & (INODE_FLAG_COMPRESSED | INODE_FLAG_INLINE)) == INODE_FLAG_COMPRESSED) {
+		inode_put(inode);
+		PUSH_ERROR("can't punch holes in a compressed file");
+		return -1;
+	}
+
+	uint32_t end = ((uint64_t)offset + length < inode->size) ? offset + length : inode->size;
+	if (inode->flags & INODE_FLAG_INLINE) {
+		if (offset < end) {
+			memset(inode->inline_data + offset, 0, end - offset);
+			mark_inode_dirty(inode);
+		}
+		inode_put(inode);
+		return 0;
 	}
-	pair.file_inode_num = ib_range.start;
 
-	if (alloc_data) {
-		// allocate data blocks for file
-		BitRange db_range = alloc_bitrange(global_dbmap, BLOCK_BYTES * 8, 1, false);
-		if (db_range.length == 0) {
-			PANIC("can't allocate data blocks");
-			dealloc_bitrange(global_ibmap, ib_range);
-			pair.valid = false;
-			return pair;
-		}
-		file_inode.data_block_start = db_range.start;
+	// whole blocks in the range are freed, the partial ones at its edges cleared
+	uint32_t first_block = ((uint64_t)offset + BLOCK_BYTES - 1) / BLOCK_BYTES;
+	uint32_t end_block = end / BLOCK_BYTES;
+	bool punched;
+	if (first_block >= end_block) {
+		punched = zero_file_range(inode, offset, end);
 	} else {
-		file_inode.data_block_start = 0; // place-holder
+		punched = replace_file_range(inode, first_block, (BitRange){.start = 0, .length = end_block - first_block})
+			&& zero_file_range(inode, offset, first_block * BLOCK_BYTES)
+			&& zero_file_range(inode, end_block * BLOCK_BYTES, end);
 	}
+	mark_inode_dirty(inode);
+	inode_put(inode);
+	return punched ? 0 : -1;
+}
 
-	// finally add into inodes
-	global_inode_table[pair.file_inode_num] = file_inode;
-	global_super.used_inodes++;
-
-	pair.valid = true;
-	return pair;
+int32_t set_compression(int64_t fd, bool compressed) {
+	if (!fd_on_disk(fd)) {
+		return -1;
+	}
+	FileSystemInode* inode = inode_get(global_fd_table.entries[fd].inode_num);
+	if (inode->flags & INODE_FLAG_READONLY) {
+		inode_put(inode);
+		PUSH_ERROR("part of a read-only snapshot");
+		return -1;
+	}
+	if (inode->file_type == FILE_TYPE_SPECIAL || (inode->file_type == FILE_TYPE_NORMAL && !(inode->flags & INODE_FLAG_INLINE))) {
+		inode_put(inode);
+		PUSH_ERROR("file already has blocks laid out");
+		return -1;
+	}
+	if (compressed) {
+		inode->flags |= INODE_FLAG_COMPRESSED;
+	} else {
+		inode->flags &= ~INODE_FLAG_COMPRESSED;
+	}
+	mark_inode_dirty(inode);
+	inode_put(inode);
+	return 0;
 }
 
-// changes both of their state such that the file is within the other directory
-int32_t link_file_in_dir(uint32_t dir_inode_num, uint32_t file_inode_num) {
+int32_t disk_stat(const Mount* mount, const char* path, FileStat* st) {
+	UNUSED(mount);
+	ParsedPath parsed_path = Path(path);
+	int32_t inode_num = seek_directory(parsed_path.dir_path);
+	if (inode_num != -1 && parsed_path.filename[0] != '\0') {
+		inode_num = search_dir(inode_num, parsed_path.filename);
+	}
+	kfree(parsed_path.dir_path);
+	kfree(parsed_path.filename);
+	if (inode_num == -1) {
+		PUSH_ERROR("file doesn't exist");
+		return -1;
+	}
 
-	uint8_t current_dir_buf[BLOCK_BYTES] = {0};
-	FileSystemDirDataBlock* dir_ptr = (FileSystemDirDataBlock*)current_dir_buf;
+	FileSystemInode inode = inode_read(inode_num);
+	st->inode_num = inode_num;
+	st->file_type = inode.file_type;
+	st->flags = inode.flags;
+	st->size = inode.size;
+	st->disk_blocks = 0;
+	if (!(inode.flags & INODE_FLAG_INLINE)) {
+		for (uint32_t index = 0; index < inode.extent_count; index++) {
+			BitRange extent = get_extent(&inode, index);
+			if (!EXTENT_IS_HOLE(extent)) {
+				st->disk_blocks += extent.length & ~CLUSTER_PACKED;
+			}
+		}
+		st->disk_blocks += inode.extent_block ? 1 : 0;
+	}
+	DelayedRun* run = find_delayed_run(inode_num);
+	if (run) {
+		st->disk_blocks += run->count; // as good as allocated
+	}
+	return 0;
+}
 
-	FileSystemInode* dir_inode = &global_inode_table[dir_inode_num];
-	FileSystemInode* file_inode = &global_inode_table[file_inode_num];
+int32_t disk_rename(const Mount* mount, const char* old_path, const char* new_path) {
+	UNUSED(mount);
+	sync_if_due(); // so the whole move lands in one transaction
+
+	char old_dir_path[strlen(old_path) + 1];
+	char old_name[strlen(old_path) + 1];
+	parse_path(old_path, old_dir_path, old_name);
+	char new_dir_path[strlen(new_path) + 1];
+	char new_name[strlen(new_path) + 1];
+	parse_path(new_path, new_dir_path, new_name);
+	if (old_name[0] == '\0' || new_name[0] == '\0') {
+		PUSH_ERROR("can't rename without a name");
+		return -1;
+	}
+	if (strlen(new_name) >= sizeof(((FileSystemDirEntry*)0)->name)) {
+		PUSH_ERROR("name is too long");
+		return -1;
+	}
 
-	// NOTE: we copy dir_inode here from the global table, instead of as reference, 
-	// there may be some bugs where we don't write anything, but we've only been reading
-	// so far until increasing size so this may be ok
-	ata_read_blocks(dir_inode->data_block_start, current_dir_buf, 1); // NOTE: only 1 for now
-	
-	FileSystemDirEntry* new_entry = &(dir_ptr->contents[dir_inode->size / sizeof(FileSystemDirEntry)]);
-	new_entry->inode_num = file_inode_num;
-	strcpy(new_entry->name, file_inode->name);
+	int32_t old_dir_inode_num = seek_directory(old_dir_path);
+	if (old_dir_inode_num == -1) {
+		return -1;
+	}
+	int32_t file_inode_num = search_dir(old_dir_inode_num, old_name);
+	if (file_inode_num == -1) {
+		PUSH_ERROR("file doesn't exist");
+		return -1;
+	}
+	int32_t new_dir_inode_num = seek_directory(new_dir_path);
+	if (new_dir_inode_num == -1) {
+		return -1;
+	}
+	if (old_dir_inode_num == new_dir_inode_num && strcmp(old_name, new_name) == 0) {
+		return 0;
+	}
+	if (!check_writable(old_dir_inode_num) || !check_writable(new_dir_inode_num) || !check_writable(file_inode_num)) {
+		return -1;
+	}
 
-	dir_inode->size += sizeof(FileSystemDirEntry);
-	ata_write_blocks(dir_inode->data_block_start, current_dir_buf, 1); // NOTE: this can break things, if data_block_start is incorrect
+	// a directory can't move beneath itself
+	uint8_t file_type = inode_read(file_inode_num).file_type;
+	if (file_type == FILE_TYPE_DIR) {
+		uint32_t ancestor = new_dir_inode_num;
+		while (true) {
+			if (ancestor == (uint32_t)file_inode_num) {
+				PUSH_ERROR("can't move a directory into itself");
+				return -1;
+			}
+			if (ancestor == 0) {
+				break;
+			}
+			ancestor = inode_read(ancestor).parent_inode_num;
+		}
+	}
 
+	// an existing file under the new name is replaced in place, so the name never goes missing
+	int32_t replaced_inode_num = search_dir(new_dir_inode_num, new_name);
+	if (replaced_inode_num != -1) {
+		FileSystemInode replaced = inode_read(replaced_inode_num);
+		if (replaced.file_type == FILE_TYPE_DIR && file_type != FILE_TYPE_DIR) {
+			PUSH_ERROR("can't replace a directory with a file");
+			return -1;
+		}
+		if (replaced.file_type != FILE_TYPE_DIR && file_type == FILE_TYPE_DIR) {
+			PUSH_ERROR("can't replace a file with a directory");
+			return -1;
+		}
+		if (replaced.file_type == FILE_TYPE_DIR && replaced.size) {
+			PUSH_ERROR("directory not empty");
+			return -1;
+		}
+		relink_file_in_dir(new_dir_inode_num, new_name, file_inode_num, file_type);
+	} else {
+		// link_file_in_dir takes the name from the inode
+		FileSystemInode* file_inode = inode_get(file_inode_num);
+		strcpy(file_inode->name, new_name);
+		inode_put(file_inode);
+		if (link_file_in_dir(new_dir_inode_num, file_inode_num) == -1) {
+			file_inode = inode_get(file_inode_num);
+			strcpy(file_inode->name, old_name);
+			inode_put(file_inode);
+			return -1;
+		}
+	}
+	unlink_file_in_dir(old_dir_inode_num, old_name);
+
+	// the data stays where it is, only the inode learns its new place
+	FileSystemInode* file_inode = inode_get(file_inode_num);
+	strcpy(file_inode->name, new_name);
+	file_inode->parent_inode_num = new_dir_inode_num;
+	mark_inode_dirty(file_inode);
+	inode_put(file_inode);
+
+	if (replaced_inode_num != -1) {
+		drop_delayed_run(replaced_inode_num);
+		FileSystemInode* replaced = inode_get(replaced_inode_num);
+		uint8_t replaced_type = replaced->file_type;
+		release_file_blocks(replaced);
+		mark_inode_dirty(replaced);
+		inode_put(replaced);
+		free_inode_num(replaced_inode_num, replaced_type);
+		if (replaced_type == FILE_TYPE_DIR) {
+			dcache_invalidate_dir(replaced_inode_num);
+		}
+	}
 	return 0;
 }
 
-void unlink_file_in_dir(uint32_t dir_inode_num, uint32_t file_inode_num) {
-	uint8_t current_dir_buf[BLOCK_BYTES] = {0};
-	FileSystemInode* dir_inode = &global_inode_table[dir_inode_num];
-	ata_read_blocks(dir_inode->data_block_start, current_dir_buf, 1); // NOTE: only 1 for now
-	FileSystemDirDataBlock* data_block = (FileSystemDirDataBlock*)current_dir_buf;
+// the root file system stays mounted
+int32_t disk_unmount(const Mount* mount) {
+	UNUSED(mount);
+	PUSH_ERROR("the disk stays mounted");
+	return -1;
+}
 
-	// NOTE: should do nothing if the file doesn't exist in the dir
-	// shift all the entries back by 1
-	for (uint32_t entry = 0; entry < dir_inode->size / sizeof(FileSystemDirEntry); entry++) {
-		if(data_block->contents[entry].inode_num == (uint32_t)file_inode_num) {
-			while (entry < dir_inode->size / sizeof(FileSystemDirEntry)) {
-				data_block->contents[entry] = data_block->contents[entry+1];
-				entry++;
-			}
-			dir_inode->size -= sizeof(FileSystemDirEntry); // reduce the size
-			break;
+static const FileSystemOps disk_fs_ops = {"disk", disk_create, disk_open, disk_unlink, disk_stat, disk_rename, disk_unmount};
+
+// mounts the disk on /, then tmpfs on the directories kept in memory, and brings up the devices of /dev
+void mount_file_systems() {
+	static const char* const memory_dirs[] = {"/dev", "/tmp"};
+	vfs_init();
+	tmpfs_init();
+	mount("/", &disk_fs_ops, 0);
+	for (size_t dir = 0; dir < sizeof(memory_dirs) / sizeof(memory_dirs[0]); dir++) {
+		FileStat st;
+		if ((stat(memory_dirs[dir], &st) == -1 && mkdir(memory_dirs[dir]) == -1) || tmpfs_mount(memory_dirs[dir]) == -1) {
+			panic(error_msg);
 		}
 	}
-	ata_write_blocks(dir_inode->data_block_start, current_dir_buf, 1); // NOTE: this can break things, if data_block_start is incorrect
+	create_system_files();
+	open_system_files();
 }
 
-int32_t allocate_file_descriptor(uint32_t file_inode_num, char* filename) {
-	BitRange fd_range = alloc_bitrange(global_fd_table.bitmap, BLOCK_BYTES * 8, 1, false);
-	if (fd_range.length == 0) {
-		return -1;
+// whether the path leads to the disk, not into a file system mounted over part of it
+bool path_on_disk(const char* path) {
+	const char* rest;
+	if (path[0] != '/' || vfs_resolve(path, &rest)->ops != &disk_fs_ops) {
+		PUSH_ERROR("only files on disk can share blocks");
+		return false;
 	}
-	uint32_t fd_index = fd_range.start;
-	FileDescriptorEntry file_descriptor = {.write_pos = 0, .read_pos = 0, .inode_num = file_inode_num, .index = fd_index};
-	strcpy(file_descriptor.name, filename);
-	global_fd_table.entries[fd_index] = file_descriptor;
-	// NOTE: we don't keep track of the number of used file descriptors
-	return fd_index;
+	return true;
 }
 
-int64_t create_filetype(const char* path, uint8_t file_type, bool allocate_fd) {
+// turns the fresh inode `inode` into a copy of regular file `source_num`, sharing its data blocks
+bool clone_file(FileSystemInode* inode, uint32_t source_num) {
+	// blocks the source holds back are placed first, so all of its data can be shared
+	DelayedRun* run = find_delayed_run(source_num);
+	if (run) {
+		allocate_delayed_run(run);
+	}
+	FileSystemInode source = inode_read(source_num);
+
+	// the direct extents, or the inline data in their place, come along with the inode
+	inode->flags = source.flags & ~INODE_FLAG_READONLY;
+	inode->size = source.size;
+	memcpy(inode->inline_data, source.inline_data, INODE_INLINE_BYTES);
+	if (source.extent_block) {
+		BitRange overflow = alloc_blocks(source.extent_block, 1);
+		if (overflow.length == 0) {
+			PUSH_ERROR("no space for extent block");
+			return false;
+		}
+		CacheBlock* original = read_checked_block(source.extent_block);
+		CacheBlock* copy = bcache_get(overflow.start);
+		memcpy(copy->data, original->data, BLOCK_BYTES);
+		bcache_set_checksum(copy, BLOCK_BYTES, BLOCK_CHECKSUM_OFFSET);
+		mark_metadata_dirty(copy);
+		bcache_release(copy);
+		bcache_release(original);
+		inode->extent_block = overflow.start;
+	}
+
+	for (uint32_t index = 0; index < source.extent_count; index++) {
+		BitRange extent = get_extent(&source, index);
+		extent.length &= ~CLUSTER_PACKED;
+		if (!EXTENT_IS_HOLE(extent) && !share_blocks(extent)) {
+			// let go of the extents shared so far
+			inode->extent_count = index;
+			release_file_blocks(inode);
+			mark_inode_dirty(inode);
+			return false;
+		}
+	}
+	inode->extent_count = source.extent_count;
+	mark_inode_dirty(inode);
+	return true;
+}
 
-	if (path[0] != '/') {
-		PUSH_ERROR("Relative addressing unimplmented");
+int32_t reflink(const char* src_path, const char* dst_path) {
+	FileStat source;
+	if (!path_on_disk(src_path) || !path_on_disk(dst_path) || stat(src_path, &source) == -1) {
 		return -1;
 	}
-	
-	ParsedPath parsed_path = Path(path);
-	DirInodePair inode_pair = allocate_inode(parsed_path, file_type, (file_type == 2) ? false : true);
-	if (!inode_pair.valid) {
-		kfree(parsed_path.dir_path);
-		kfree(parsed_path.filename);
-		PUSH_ERROR("Couldn't allocate inode");
+	if (source.file_type != FILE_TYPE_NORMAL) {
+		PUSH_ERROR("can only reflink regular files");
 		return -1;
 	}
 
-	link_file_in_dir(inode_pair.dir_inode_num, inode_pair.file_inode_num);
-	int32_t fd_index = 0;
-	if (allocate_fd) {
-		fd_index = allocate_file_descriptor(inode_pair.file_inode_num, parsed_path.filename);
+	FileStat copy;
+	if (create_filetype(dst_path, FILE_TYPE_NORMAL, false) == -1 || stat(dst_path, &copy) == -1) {
+		return -1;
 	}
-	
-	kfree(parsed_path.dir_path);
-	kfree(parsed_path.filename);
-
-	// cleanup
-	if (fd_index == -1) {
-		unlink_file_in_dir(inode_pair.dir_inode_num, inode_pair.file_inode_num);
-		BitRange data_range = {.start = global_inode_table[inode_pair.file_inode_num].data_block_start, .length = 1};
-		// if {0, 0} range, should do nothing
-		dealloc_bitrange(global_dbmap, data_range);
-		BitRange inode_range = {.start = inode_pair.valid, .length = 1};
-		dealloc_bitrange(global_ibmap, inode_range);
+	FileSystemInode* inode = inode_get(copy.inode_num);
+	bool cloned = clone_file(inode, source.inode_num);
+	inode_put(inode);
+	if (!cloned) {
+		unlink(dst_path);
+		return -1;
 	}
-	
-	return fd_index; // file descriptor index
+	return 0;
 }
 
-// -- FILE SYSTEM SYSCALLS --
-// will automatically open the file
-// returns a file descriptor
-int64_t create(const char* path) {
-	return create_filetype(path, FILE_TYPE_NORMAL, true);
+// the entry in `slot` of the directory, copied out
+FileSystemDirEntry read_dir_slot(uint32_t dir_inode_num, uint32_t slot) {
+	FileSystemInode* dir_inode = inode_get(dir_inode_num);
+	CacheBlock* block;
+	FileSystemDirEntry entry = *dir_slot_entry(dir_inode, slot, &block);
+	bcache_release(block);
+	inode_put(dir_inode);
+	return entry;
 }
 
-int64_t open(const char* path) {
-	// this will open up some process related state keeping track of the cursor
-	// can't open directories
+// makes a read-only copy of the entry in directory `copy_num`, an empty directory or a reflink of the file
+// returns the inode of the copy, -1 on failure
+int32_t snapshot_entry(uint32_t copy_num, FileSystemDirEntry entry) {
+	int32_t inode_num = alloc_inode_num(copy_num, entry.file_type);
+	if (inode_num == -1) {
+		return -1;
+	}
+	FileSystemInode* inode = inode_get(inode_num);
+	memset(inode, 0, sizeof(FileSystemInode));
+	inode->file_type = entry.file_type;
+	inode->parent_inode_num = copy_num;
+	strcpy(inode->name, entry.name);
+	bool copied;
+	if (entry.file_type == FILE_TYPE_DIR) {
+		copied = reserve_file_blocks(inode_num, inode, 1);
+		if (copied) {
+			clear_file_blocks(inode);
+		}
+	} else {
+		copied = clone_file(inode, entry.inode_num);
+	}
+	inode->flags |= INODE_FLAG_READONLY;
+	mark_inode_dirty(inode);
+	inode_put(inode);
+
+	if (!copied || link_file_in_dir(copy_num, inode_num) == -1) {
+		inode = inode_get(inode_num);
+		release_file_blocks(inode);
+		mark_inode_dirty(inode);
+		inode_put(inode);
+		free_inode_num(inode_num, entry.file_type);
+		return -1;
+	}
+	return inode_num;
+}
 
-	// follow path to target directory
-	ParsedPath parsed_path = Path(path);
+// copies the entries of directory `dir_num` into the empty directory `copy_num`, all the way down
+// leaving out `skip`, the snapshot being taken, earlier snapshots and special files
+bool snapshot_dir(uint32_t dir_num, uint32_t copy_num, uint32_t skip) {
+	FileSystemInode dir_inode = inode_read(dir_num);
+	uint32_t slot_count = dir_slot_count(&dir_inode);
+	for (uint32_t slot = 0; slot < slot_count; slot++) {
+		FileSystemDirEntry entry = read_dir_slot(dir_num, slot);
+		if (entry.name[0] == '\0' || entry.inode_num == skip || entry.file_type == FILE_TYPE_SPECIAL
+			|| (inode_read(entry.inode_num).flags & INODE_FLAG_READONLY)) {
+			continue;
+		}
+		int32_t inode_num = snapshot_entry(copy_num, entry);
+		if (inode_num == -1) {
+			return false;
+		}
+		if (entry.file_type == FILE_TYPE_DIR && !snapshot_dir(entry.inode_num, inode_num, skip)) {
+			return false;
+		}
+	}
+	return true;
+}
 
-	// char dir_path[strlen(path)];
-	// char filename[32];
-	// parse_path(path, dir_path, filename);
+int32_t snapshot(const char* path) {
+	FileStat root;
+	if (!path_on_disk(path) || create_filetype(path, FILE_TYPE_DIR, false) == -1 || stat(path, &root) == -1) {
+		return -1;
+	}
+	// NOTE: a snapshot failing part way, on a full disk, is left in place with what it got to
+	bool copied = snapshot_dir(0, root.inode_num, root.inode_num);
+	FileSystemInode* inode = inode_get(root.inode_num);
+	inode->flags |= INODE_FLAG_READONLY;
+	mark_inode_dirty(inode);
+	inode_put(inode);
+	return copied ? 0 : -1;
+}
 
-	uint32_t dir_inode_num = seek_directory(parsed_path.dir_path);
+// commits every change since the last one as a single transaction
+void commit_metadata() {
+	// delayed data is placed first, its allocation commits along with everything else
+	allocate_delayed_blocks();
 
-	// read directory for files
-	int32_t file_inode_num = search_dir(dir_inode_num, parsed_path.filename);
-	if (file_inode_num == -1) {
-		PUSH_ERROR("file doesn't exist");
-		kfree(parsed_path.dir_path);
-		kfree(parsed_path.filename);
-		return -1; // file doesn't exist
-	} 
+	// everything since the last sync commits as one transaction, checkpointed lazily,
+	// the superblock and the group descriptors join it through log_super_and_groups
+	journal_commit();
 
-	// kprintf("[open] file_inode_num: %u\n", file_inode_num);
-	// kprintf("Start: %u\n", global_inode_table[file_inode_num].data_block_start);
-	// create file descriptor
-	int32_t fd_index = allocate_file_descriptor(file_inode_num, parsed_path.filename);
-	
-	kfree(parsed_path.dir_path);
-	kfree(parsed_path.filename);
+	metadata_updates = 0;
+	last_sync_tick = timer_counter;
+}
 
-	// BitRange range = alloc_bitrange(global_fd_table.bitmap, BLOCK_BYTES * 8, 1, false);
-	// uint32_t fd_index = range.start;
-	// FileDescriptorEntry file_descriptor = {.write_pos = 0, .read_pos = 0, .inode_num = file_inode_num, .index = fd_index};
-	// strcpy(file_descriptor.name, parsed_path.filename);
-	// global_fd_table.entries[fd_index] = file_descriptor;
+int32_t sync() {
+	commit_metadata();
+	// data overwritten in place commits nothing, it still has to leave the cache
+	bcache_flush_data();
+	journal_barrier();
+	ata_flush();
+	return 0;
+}
 
-	return fd_index;
+int32_t fsync(int64_t fd) {
+	if (!fd_on_disk(fd)) {
+		return -1;
+	}
+	// a file's changes can't be committed apart from the rest, the whole file system goes
+	return sync();
 }
 
-int64_t close(int64_t fd) {
-	BitRange fd_bitmap_range = {.start = fd, .length = 1};
-	dealloc_bitrange(global_fd_table.bitmap, fd_bitmap_range);
-	return -1;
+// counts a structure scrub found off, reporting it
+void scrub_check(ScrubReport* report, bool matches, const char* what, uint32_t number) {
+	if (!matches) {
+		kprintf("scrub: %s %u fails its checksum\n", what, number);
+		report->errors++;
+	}
 }
 
-uint64_t read(int64_t fd, const void* buf, uint32_t count) {
-	// get inode from fd table
-	FileDescriptorEntry* fd_entry = &global_fd_table.entries[fd]; 
-	uint32_t fd_inode_num = fd_entry->inode_num;
-	FileSystemInode fd_inode = global_inode_table[fd_inode_num];
+// checks what hangs off an inode in use: its extent block, directory blocks and packed clusters
+void scrub_inode(ScrubReport* report, uint32_t inode_num, const FileSystemInode* inode) {
+	if (inode->flags & INODE_FLAG_INLINE) {
+		return;
+	}
+	if (inode->extent_block) {
+		ata_read_blocks(inode->extent_block, (uint8_t*)scrub_extents, 1);
+		report->blocks_checked++;
+		scrub_check(report, crc32c_verify(scrub_extents, BLOCK_BYTES, BLOCK_CHECKSUM_OFFSET), "extent block", inode->extent_block);
+	}
+
+	for (uint32_t index = 0; index < inode->extent_count && index < INODE_EXTENTS_MAX; index++) {
+		BitRange extent = (index < INODE_DIRECT_EXTENTS) ? inode->extents[index] : scrub_extents[index - INODE_DIRECT_EXTENTS];
+		uint32_t blocks = extent.length & ~CLUSTER_PACKED;
+		if (EXTENT_IS_HOLE(extent)) {
+			continue;
+		}
+		if (extent.start >= global_super.block_count || blocks > global_super.block_count - extent.start) {
+			scrub_check(report, false, "extent list of inode", inode_num);
+			return;
+		}
 
-	// special file
-	if (fd_inode.file_type == 0x2) {
-		for (size_t file = 0; file < sizeof(system_files) / sizeof(SpecialFile); file++) {
-			if (strcmp(system_files[file].filename, fd_inode.name) == 0) {
-				file_handler handler = system_files[file].handler;
-				return handler(true, fd, buf, count);
+		if ((inode->flags & INODE_FLAG_COMPRESSED) && (extent.length & CLUSTER_PACKED)) {
+			if (blocks > COMPRESS_CLUSTER_BLOCKS) {
+				scrub_check(report, false, "extent list of inode", inode_num);
+				return;
+			}
+			ata_read_blocks(extent.start, scrub_follow, blocks);
+			report->blocks_checked += blocks;
+			ClusterHeader* header = (ClusterHeader*)scrub_follow;
+			scrub_check(report, header->packed_bytes <= blocks * BLOCK_BYTES - sizeof(ClusterHeader)
+				&& crc32c(0, scrub_follow + sizeof(ClusterHeader), header->packed_bytes) == header->checksum, "cluster", extent.start);
+		} else if (inode->file_type == FILE_TYPE_DIR) {
+			for (uint32_t done = 0; done < blocks; done += SCRUB_BATCH_BLOCKS) {
+				uint32_t run = (blocks - done < SCRUB_BATCH_BLOCKS) ? blocks - done : SCRUB_BATCH_BLOCKS;
+				ata_read_blocks(extent.start + done, scrub_follow, run);
+				report->blocks_checked += run;
+				for (uint32_t i = 0; i < run; i++) {
+					scrub_check(report, crc32c_verify(scrub_follow + i * BLOCK_BYTES, BLOCK_BYTES, BLOCK_CHECKSUM_OFFSET), "directory block", extent.start + done + i);
+				}
 			}
 		}
-		return 0;
 	}
+}
 
-	// read data_blocks
-	uint8_t data_block_buf[BLOCK_BYTES] = {0};
-	ata_read_blocks(fd_inode.data_block_start, data_block_buf, 1); // NOTE: only 1 block
-	// kprintf("[reading] name: %s, fd_inode->data_block_start: %u\n", fd_inode.name, fd_inode.data_block_start);
-
-	// copy into buf, from cursor position, until cursor == size
-	uint32_t bytes_read = 0;
-	// kprintf("size: %u\n", fd_inode.size);
-	while (fd_entry->read_pos < fd_inode.size && bytes_read < count) {
-		*((uint8_t*)buf + bytes_read) = data_block_buf[fd_entry->read_pos++];
-		bytes_read++; 
+int32_t scrub(ScrubReport* report) {
+	// everything goes home first, the disk is then read past the cache
+	sync();
+	journal_checkpoint();
+	report->blocks_checked = 0;
+	report->errors = 0;
+
+	ata_read_blocks(0, scrub_buffer, 1);
+	report->blocks_checked++;
+	scrub_check(report, crc32c_verify(scrub_buffer, sizeof(FileSystemSuper), offsetof(FileSystemSuper, checksum)), "superblock", 0);
+
+	ata_read_blocks(global_super.group_desc_start, scrub_buffer, group_desc_blocks());
+	report->blocks_checked += group_desc_blocks();
+	for (uint32_t group = 0; group < global_super.group_count; group++) {
+		scrub_check(report, crc32c_verify(scrub_buffer + group * sizeof(FileSystemGroupDesc), sizeof(FileSystemGroupDesc),
+			offsetof(FileSystemGroupDesc, checksum)), "group descriptor", group);
 	}
-	return bytes_read;
-}
 
-uint64_t write(int64_t fd, const void* buf, uint32_t count) {
-	// TODO: implement some caching for writes before flushing, staging them all to disk
-	// get inode from fd table
-	FileDescriptorEntry* fd_entry = &global_fd_table.entries[fd]; 
-	uint32_t fd_inode_num = fd_entry->inode_num;
-	FileSystemInode* fd_inode = &global_inode_table[fd_inode_num];
+	for (uint32_t group = 0; group < global_super.group_count; group++) {
+		FileSystemGroupDesc* desc = &global_groups[group];
+		ata_read_blocks(desc->block_bitmap, scrub_buffer, 1);
+		ata_read_blocks(desc->inode_bitmap, scrub_inode_bitmap, 1);
+		report->blocks_checked += 2;
+		scrub_check(report, crc32c(0, scrub_buffer, BLOCK_BYTES) == desc->block_bitmap_checksum, "block bitmap of group", group);
+		scrub_check(report, crc32c(0, scrub_inode_bitmap, BLOCK_BYTES) == desc->inode_bitmap_checksum, "inode bitmap of group", group);
+
+		ata_read_blocks(desc->refcount_table, scrub_buffer, REFCOUNT_TABLE_BLOCKS);
+		report->blocks_checked += REFCOUNT_TABLE_BLOCKS;
+		for (uint32_t i = 0; i < REFCOUNT_TABLE_BLOCKS; i++) {
+			scrub_check(report, crc32c_verify(scrub_buffer + i * BLOCK_BYTES, BLOCK_BYTES, BLOCK_CHECKSUM_OFFSET), "reference count block", desc->refcount_table + i);
+		}
 
-	// special file
-	if (fd_inode->file_type == 0x2) {
-		for (size_t file = 0; file < sizeof(system_files) / sizeof(SpecialFile); file++) {
-			if (strcmp(system_files[file].filename, fd_inode->name) == 0) {
-				file_handler handler = system_files[file].handler;
-				return handler(false, fd, buf, count);
+		// the inode table streams through in large reads, each inode in use is checked and followed
+		for (uint32_t table_block = 0; table_block < inode_table_blocks(); table_block += SCRUB_BATCH_BLOCKS) {
+			uint32_t run = (inode_table_blocks() - table_block < SCRUB_BATCH_BLOCKS) ? inode_table_blocks() - table_block : SCRUB_BATCH_BLOCKS;
+			ata_read_blocks(desc->inode_table + table_block, scrub_buffer, run);
+			report->blocks_checked += run;
+			for (uint32_t i = 0; i < run * INODES_PER_BLOCK; i++) {
+				uint32_t index = table_block * INODES_PER_BLOCK + i;
+				if (!bitmap_test(scrub_inode_bitmap, index)) {
+					continue;
+				}
+				FileSystemInode* inode = (FileSystemInode*)scrub_buffer + i;
+				uint32_t inode_num = group * global_super.inodes_per_group + index;
+				bool matches = crc32c_verify(inode, sizeof(FileSystemInode), offsetof(FileSystemInode, checksum));
+				scrub_check(report, matches, "inode", inode_num);
+				if (matches) {
+					scrub_inode(report, inode_num, inode);
+				}
 			}
 		}
-		return 0;
 	}
+	return report->errors ? -1 : 0;
+}
 
-	// read data_blocks
-	uint8_t data_block_buf[BLOCK_BYTES] = {0};
-	ata_read_blocks(fd_inode->data_block_start, data_block_buf, 1); // NOTE: only 1 block
-	// kprintf("[writing] fd_inode->data_block_start: %u\n", fd_inode->data_block_start);
-	// write into data_block_buf and commit
-	uint32_t bytes_written = 0;
-	while (fd_entry->write_pos < BLOCK_BYTES && bytes_written < count) {
-		data_block_buf[fd_entry->write_pos++] = *((uint8_t*)buf + bytes_written);
-		bytes_written++; 
-		fd_inode->size++;
+// -- DEFRAGMENTATION --
+
+// the first inode in use from `inode_num` on, -1 past the last one
+int32_t next_inode_in_use(uint32_t inode_num) {
+	uint32_t group = inode_num / global_super.inodes_per_group;
+	uint32_t index = inode_num % global_super.inodes_per_group;
+	for (; group < global_super.group_count; group++, index = 0) {
+		if (global_groups[group].free_inodes == global_super.inodes_per_group) {
+			continue;
+		}
+		CacheBlock* bitmap = bcache_read(global_groups[group].inode_bitmap);
+		while (index < global_super.inodes_per_group && !bitmap_test(bitmap->data, index)) {
+			index++;
+		}
+		bcache_release(bitmap);
+		if (index < global_super.inodes_per_group) {
+			return group * global_super.inodes_per_group + index;
+		}
 	}
-	ata_write_blocks(fd_inode->data_block_start, data_block_buf, 1); // NOTE: only 1 block
-	return bytes_written;
+	return -1;
 }
 
-int32_t seek(int64_t fd, int32_t offset, uint32_t param) {
-	// TODO: assert that this fd is allocated
-	if (global_fd_table.bitmap[0] & (1 << (31 - fd))) {
-		switch (param)
-		{
-		case SEEK_SET:
-			global_fd_table.entries[fd].read_pos = offset;
-			global_fd_table.entries[fd].write_pos = offset;
-			break;
-		case SEEK_CUR:
-			global_fd_table.entries[fd].read_pos += offset;
-			global_fd_table.entries[fd].write_pos += offset;
-			break;
-		case SEEK_END:
-			global_fd_table.entries[fd].read_pos = global_inode_table[global_fd_table.entries[fd].inode_num].size - offset;
-			global_fd_table.entries[fd].write_pos = global_inode_table[global_fd_table.entries[fd].inode_num].size - offset;
-			break;
+// runs of free blocks over the whole disk, the fewer the more compact free space is
+uint32_t count_free_runs() {
+	uint32_t runs = 0;
+	for (uint32_t group = 0; group < global_super.group_count; group++) {
+		CacheBlock* bitmap = bcache_read(global_groups[group].block_bitmap);
+		bool in_run = false;
+		for (uint32_t index = 0; index < group_block_count(group); index++) {
+			bool is_free = !bitmap_test(bitmap->data, index);
+			if (is_free && !in_run) {
+				runs++;
+			}
+			in_run = is_free;
 		}
-	} else {
-		PUSH_ERROR("file descriptor is not allocated"); // TODO: put this everywhere
-		return -1;
+		bcache_release(bitmap);
 	}
-	return global_fd_table.entries[fd].read_pos; // TODO: figure out what this should really be doing
+	return runs;
 }
 
-int32_t mkdir(const char* path) {
-	// int32_t fd = create_filetype(path, FILE_TYPE_DIR, false);
-	// if (fd == -1) {
-	// 	panic(error_msg);
-	// }
-	// close(fd);
-	return create_filetype(path, FILE_TYPE_DIR, false);
+// moves `count` data blocks from `from` to `to` by renaming them in the cache, nothing is copied
+void move_data_blocks(uint32_t from, uint32_t to, uint32_t count) {
+	for (uint32_t done = 0; done < count; done += BCACHE_BATCH_BLOCKS) {
+		uint32_t run = (count - done < BCACHE_BATCH_BLOCKS) ? count - done : BCACHE_BATCH_BLOCKS;
+		bcache_prefetch(from + done, run);
+		for (uint32_t i = done; i < done + run; i++) {
+			CacheBlock* block = bcache_read(from + i);
+			bcache_rekey(block, to + i);
+			bcache_mark_dirty(block);
+			bcache_release(block);
+		}
+	}
 }
 
-// outputs directories to the buffer
-void list_dir(const char* path, char* buf) {
-	
-	char dir_path[strlen(path) + 1];
-	char filename[32];
-	parse_path(path, dir_path, filename);
-
-	uint32_t dir_inode_num = seek_directory(dir_path);
-	// kprintf("Dir inode: %x\n", dir_inode_num);
-	uint8_t current_dir_buf[BLOCK_BYTES];
-	FileSystemDirDataBlock* dir_ptr = (FileSystemDirDataBlock*)current_dir_buf;
-	
-	FileSystemInode dir_inode = global_inode_table[dir_inode_num];
-	ata_read_blocks(dir_inode.data_block_start, current_dir_buf, 1); // only 1 for now
-	uint32_t files_contained = dir_inode.size / sizeof(FileSystemDirEntry); 
-	for (uint32_t file = 0; file < files_contained; file++) {
-		buf += strcat(path, buf);
-		buf += strcat(dir_ptr->contents[file].name, buf);
-		*(buf++) = '\n';
+// rewrites a regular file into a single run of blocks, when it is split up or a run
+// nearer the start of its group is free, which packs free space towards the end of each group
+// files with shared blocks stay as they are, moving them would undo the sharing
+void defrag_file(uint32_t inode_num, DefragReport* report) {
+	// the blocks the files before moved out of are only free to take once the moves are on the media
+	if (journal_has_unsettled()) {
+		commit_metadata();
+		journal_barrier();
+	}
+	DelayedRun* run = find_delayed_run(inode_num);
+	if (run) {
+		allocate_delayed_run(run);
+	}
+	FileSystemInode* inode = inode_get(inode_num);
+	if (inode->file_type != FILE_TYPE_NORMAL || (inode->flags & (INODE_FLAG_INLINE | INODE_FLAG_COMPRESSED))) {
+		inode_put(inode);
+		return;
 	}
-}
 
-// outputs directories to the buffer
-char* str_list_dir(const char* path) {
-	
-	// char dir_path[strlen(path) + 1];
-	// char filename[32];
-	// parse_path(path, dir_path, filename);
+	// data extents, the runs they form on disk, and whether any block is shared
+	uint32_t extents = 0;
+	uint32_t fragments = 0;
+	uint32_t data_blocks = 0;
+	uint32_t first_block = 0;
+	uint32_t next_block = 0;
+	bool shared = false;
+	for (uint32_t index = 0; index < inode->extent_count; index++) {
+		BitRange extent = get_extent(inode, index);
+		if (EXTENT_IS_HOLE(extent)) {
+			continue;
+		}
+		if (!extents++) {
+			first_block = extent.start;
+		}
+		if (extent.start != next_block) {
+			fragments++;
+		}
+		next_block = extent.start + extent.length;
+		data_blocks += extent.length;
+		shared |= shared_prefix(extent.start, extent.length, false) < extent.length;
+	}
+	report->files_checked++;
+	report->extents_before += extents;
 
-	int32_t dir_inode_num = seek_directory(path);
-	if (dir_inode_num == -1) {
-		return NULL;
+	BitRange target = {.start = 0, .length = 0};
+	if (extents && !shared && free_block_total() >= delayed_blocks + data_blocks) {
+		target = alloc_blocks(global_groups[inode_num / global_super.inodes_per_group].data_start, data_blocks);
 	}
-	// kprintf("Dir inode: %x\n", dir_inode_num);
-	uint8_t current_dir_buf[BLOCK_BYTES];
-	FileSystemDirDataBlock* dir_ptr = (FileSystemDirDataBlock*)current_dir_buf;
-	
-	FileSystemInode dir_inode = global_inode_table[dir_inode_num];
-	ata_read_blocks(dir_inode.data_block_start, current_dir_buf, 1); // only 1 for now
-	uint32_t files_contained = dir_inode.size / sizeof(FileSystemDirEntry); 
-	char* base = kmalloc(files_contained * 32 + 1); // NOTE: arbitrary
-	char* buf = base;
-	for (uint32_t file = 0; file < files_contained; file++) {
-		if (file) {
-			*(buf++) = '\n';
+	if (target.length < data_blocks || (fragments == 1 && target.start >= first_block)) {
+		if (target.length) {
+			free_blocks(target);
 		}
-		buf += strcat(path, buf);
-		buf += strcat(dir_ptr->contents[file].name, buf);
+		report->extents_after += extents;
+		inode_put(inode);
+		return;
 	}
-	*(buf++) = '\0';
-	return base;
-}
 
-int32_t unlink(const char* path) {
-
-	char dir_path[strlen(path)];
-	char filename[32];
-	parse_path(path, dir_path, filename);
-	uint32_t dir_inode_num = seek_directory(dir_path);
+	// extent by extent, the list never grows as the runs land next to each other
+	uint32_t file_block = 0;
+	uint32_t moved = 0;
+	uint32_t run_length;
+	uint32_t disk_block;
+	while (moved < data_blocks && (disk_block = map_file_block(inode, file_block, &run_length), run_length)) {
+		if (disk_block) {
+			BitRange range = {.start = target.start + moved, .length = run_length};
+			move_data_blocks(disk_block, range.start, run_length);
+			bool replaced = replace_file_range(inode, file_block, range);
+			ASSERT(replaced, "defrag: moving an extent added one");
+			moved += run_length;
+		}
+		file_block += run_length;
+	}
+	mark_inode_dirty(inode);
 
-	// read directory for files
-	int32_t file_inode_num = search_dir(dir_inode_num, filename);
-	if (file_inode_num == -1) {
-		PUSH_ERROR("file doesn't exist");
-		return -1; // file doesn't exist
-	} 
+	uint32_t extents_after = 0;
+	for (uint32_t index = 0; index < inode->extent_count; index++) {
+		extents_after += !EXTENT_IS_HOLE(get_extent(inode, index));
+	}
+	report->extents_after += extents_after;
+	report->files_moved++;
+	report->blocks_moved += data_blocks;
+	inode_put(inode);
+}
 
-	unlink_file_in_dir(dir_inode_num, file_inode_num);
+int32_t defrag(DefragReport* report) {
+	memset(report, 0, sizeof(DefragReport));
+	report->free_runs_before = count_free_runs();
+	int32_t inode_num = 0;
+	while ((inode_num = next_inode_in_use(inode_num)) != -1) {
+		sync_if_due(); // each file moves in one transaction
+		defrag_file(inode_num, report);
+		inode_num++;
+	}
+	sync();
+	report->free_runs_after = count_free_runs();
+	return 0;
+}
 
-	// unallocate data blocks 
-	FileSystemInode file_inode = global_inode_table[file_inode_num];
-	BitRange range = {.start = file_inode.data_block_start, .length = 1};
-	dealloc_bitrange(global_dbmap, range);
+void defrag_background(bool enabled) {
+	defrag_enabled = enabled;
+	defrag_cursor = 0;
+	defrag_next_tick = timer_counter;
+}
 
-	// unallocate inode
-	range.start = file_inode_num;
-	dealloc_bitrange(global_ibmap, range); // don't need to clear the entry
-	
-	return 0;
+void defrag_idle() {
+	if (!defrag_enabled || timer_counter < defrag_next_tick) {
+		return;
+	}
+	int32_t inode_num = next_inode_in_use(defrag_cursor);
+	if (inode_num == -1) {
+		// the pass is over, the next one starts over from the root
+		defrag_cursor = 0;
+		defrag_next_tick = timer_counter + DEFRAG_PASS_TICKS;
+		return;
+	}
+	DefragReport report = {0};
+	sync_if_due();
+	defrag_file(inode_num, &report);
+	defrag_cursor = inode_num + 1;
+	defrag_next_tick = timer_counter + DEFRAG_STEP_TICKS;
 }
 
 void shutdown() {
@@ -602,9 +3136,7 @@ void shutdown() {
 		close(system_files[file].fd);
     }
 
-	kprintf("Syncing Disk Metadata...\n");
-	ata_write_blocks(0, (uint8_t*)&global_super, SUPER_SIZE);
-	ata_write_blocks(global_super.i_bmap_start, (uint8_t*)global_ibmap, INODE_BITMAP_SIZE);
-	ata_write_blocks(global_super.d_bmap_start, (uint8_t*)global_dbmap, DATA_BITMAP_SIZE);
-	ata_write_blocks(global_super.inode_table_start, (uint8_t*)global_inode_table, INODE_TABLE_SIZE);
+	kprintf("Syncing Disk...\n");
+	sync();
+	journal_checkpoint(); // a clean disk mounts without replay
 }
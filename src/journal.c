@@ -0,0 +1,333 @@
+#include <journal.h>
+#include <ata.h>
+#include <crc32c.h>
+#include <string.h>
+#include <util.h>
+
+// Write-ahead log of the file system metadata, whole blocks are logged
+// Source: https://pages.cs.wisc.edu/~remzi/OSTEP/file-journaling.pdf (Metadata Journaling, Block Reuse)
+
+typedef struct {
+	BitRange range;
+	uint32_t sequence; // transaction that revoked the run
+} ReplayRevoke;
+
+static bool journal_active = false;
+static uint32_t journal_start = 0;
+static uint32_t journal_block_count = 0;
+static uint32_t journal_head = 0;       // next free block of the log, from journal_start
+static uint32_t journal_sequence = 0;   // of the running transaction
+static uint32_t checkpoint_revokes = 0; // revoked runs logged since the last checkpoint
+static bool commit_in_cache = false;    // the last commit block may still sit in the drive's cache
+
+static CacheBlock* running[BCACHE_BLOCKS];
+static uint32_t running_count = 0;
+static BitRange running_revokes[JOURNAL_REVOKES_MAX];
+static uint32_t running_revoke_count = 0;
+static BitRange committed_revokes[JOURNAL_REVOKES_MAX]; // of the last commit, while its commit block may sit in the drive's cache
+static uint32_t committed_revoke_count = 0;
+static void (*commit_hook)() = NULL; // adds the owner's blocks to every transaction as it commits
+
+static JournalDescriptor descriptor;
+static uint8_t journal_staging[BCACHE_BATCH_BLOCKS * BLOCK_BYTES]; // gathers the log into large writes
+static uint32_t staged_count = 0;
+static uint32_t staged_at = 0; // log block of the first staged block
+static ReplayRevoke replay_revokes[JOURNAL_REPLAY_REVOKES_MAX];
+
+static void write_header() {
+	memset(journal_staging, 0, BLOCK_BYTES);
+	JournalHeader* header = (JournalHeader*)journal_staging;
+	header->magic = JOURNAL_MAGIC;
+	header->sequence = journal_sequence;
+	ata_write_blocks(journal_start, journal_staging, 1);
+}
+
+static void flush_staged() {
+	if (staged_count) {
+		ata_write_blocks(journal_start + staged_at, journal_staging, staged_count);
+		staged_at += staged_count;
+		staged_count = 0;
+	}
+}
+
+static void log_block(const void* data) {
+	memcpy(journal_staging + staged_count * BLOCK_BYTES, data, BLOCK_BYTES);
+	if (++staged_count == BCACHE_BATCH_BLOCKS) {
+		flush_staged();
+	}
+}
+
+// writes the logged blocks home and starts the log over
+static void reset_log() {
+	bcache_flush();
+	ata_flush(); // the home copies are on the media before the header lets go of the log
+	commit_in_cache = false;
+	committed_revoke_count = 0;
+	write_header();
+	journal_head = 1;
+	checkpoint_revokes = 0;
+}
+
+void journal_init() {
+	journal_active = false;
+	running_count = 0;
+	running_revoke_count = 0;
+	committed_revoke_count = 0;
+	commit_hook = NULL;
+}
+
+void journal_set_commit_hook(void (*hook)()) {
+	commit_hook = hook;
+}
+
+void journal_format(uint32_t start, uint32_t block_count) {
+	journal_init();
+	journal_start = start;
+	journal_block_count = block_count;
+
+	// transactions left over from an earlier format must never look like the next ones
+	ata_read_blocks(journal_start, journal_staging, 1);
+	JournalHeader old = *(JournalHeader*)journal_staging;
+	journal_sequence = (old.magic == JOURNAL_MAGIC) ? old.sequence + block_count : 1;
+
+	write_header();
+	journal_head = 1;
+	checkpoint_revokes = 0;
+	journal_active = true;
+}
+
+// loads the descriptor of the transaction at log block `head` and checks it fully committed
+// `logged` receives how many blocks it logs
+static bool read_transaction(uint32_t head, uint32_t sequence, uint32_t* logged) {
+	if (head + 2 > journal_block_count) {
+		return false;
+	}
+	ata_read_blocks(journal_start + head, (uint8_t*)&descriptor, 1);
+	if (descriptor.magic != JOURNAL_MAGIC || descriptor.sequence != sequence || descriptor.tag_count > JOURNAL_TAGS_MAX) {
+		return false;
+	}
+
+	*logged = 0;
+	for (uint32_t tag = 0; tag < descriptor.tag_count; tag++) {
+		if (descriptor.tags[tag] & JOURNAL_TAG_REVOKE) {
+			tag++; // length
+		} else {
+			(*logged)++;
+		}
+	}
+	if (head + *logged + 2 > journal_block_count) {
+		return false;
+	}
+
+	uint32_t checksum = crc32c(0, &descriptor, BLOCK_BYTES);
+	for (uint32_t block = 0; block < *logged; block += BCACHE_BATCH_BLOCKS) {
+		uint32_t run = (*logged - block < BCACHE_BATCH_BLOCKS) ? *logged - block : BCACHE_BATCH_BLOCKS;
+		ata_read_blocks(journal_start + head + 1 + block, journal_staging, run);
+		for (uint32_t i = 0; i < run; i++) {
+			checksum = crc32c(checksum, journal_staging + i * BLOCK_BYTES, BLOCK_BYTES);
+		}
+	}
+
+	ata_read_blocks(journal_start + head + 1 + *logged, journal_staging, 1);
+	JournalCommit* commit = (JournalCommit*)journal_staging;
+	return commit->magic == JOURNAL_MAGIC && commit->sequence == sequence && commit->checksum == checksum;
+}
+
+static bool revoked_after(uint32_t block_num, uint32_t sequence, uint32_t revoke_count) {
+	for (uint32_t i = 0; i < revoke_count; i++) {
+		BitRange range = replay_revokes[i].range;
+		if (replay_revokes[i].sequence > sequence && block_num >= range.start && block_num - range.start < range.length) {
+			return true;
+		}
+	}
+	return false;
+}
+
+int32_t journal_mount(uint32_t start, uint32_t block_count) {
+	journal_init();
+	journal_start = start;
+	journal_block_count = block_count;
+
+	ata_read_blocks(journal_start, journal_staging, 1);
+	JournalHeader header = *(JournalHeader*)journal_staging;
+	if (header.magic != JOURNAL_MAGIC) {
+		return -1;
+	}
+
+	// first pass finds where the committed transactions end and what they revoked
+	uint32_t revoke_count = 0;
+	uint32_t sequence = header.sequence;
+	uint32_t head = 1;
+	uint32_t logged;
+	while (read_transaction(head, sequence, &logged)) {
+		for (uint32_t tag = 0; tag < descriptor.tag_count; tag++) {
+			if (!(descriptor.tags[tag] & JOURNAL_TAG_REVOKE)) {
+				continue;
+			}
+			if (revoke_count < JOURNAL_REPLAY_REVOKES_MAX) {
+				BitRange range = {.start = descriptor.tags[tag] & ~JOURNAL_TAG_REVOKE, .length = descriptor.tags[tag + 1]};
+				replay_revokes[revoke_count++] = (ReplayRevoke){.range = range, .sequence = sequence};
+			}
+			tag++;
+		}
+		head += logged + 2;
+		sequence++;
+	}
+	uint32_t end_sequence = sequence;
+
+	// second pass writes every logged block home, unless a later transaction freed it
+	head = 1;
+	for (sequence = header.sequence; sequence < end_sequence; sequence++) {
+		ata_read_blocks(journal_start + head, (uint8_t*)&descriptor, 1);
+		logged = 0;
+		for (uint32_t tag = 0; tag < descriptor.tag_count; tag++) {
+			if (descriptor.tags[tag] & JOURNAL_TAG_REVOKE) {
+				tag++;
+				continue;
+			}
+			if (!revoked_after(descriptor.tags[tag], sequence, revoke_count)) {
+				ata_read_blocks(journal_start + head + 1 + logged, journal_staging, 1);
+				ata_write_blocks(descriptor.tags[tag], journal_staging, 1);
+			}
+			logged++;
+		}
+		head += logged + 2;
+	}
+
+	journal_sequence = end_sequence;
+	reset_log();
+	journal_active = true;
+	return end_sequence - header.sequence;
+}
+
+void journal_add(CacheBlock* block) {
+	if (!journal_active || block->writeback == BCACHE_RUNNING) {
+		return;
+	}
+	block->writeback = BCACHE_RUNNING;
+	running[running_count++] = block;
+}
+
+void journal_revoke(BitRange range) {
+	if (!journal_active) {
+		return;
+	}
+
+	// blocks freed under the running transaction aren't logged at all
+	uint32_t i = 0;
+	while (i < running_count) {
+		CacheBlock* block = running[i];
+		if (block->block_num >= range.start && block->block_num - range.start < range.length) {
+			block->writeback = BCACHE_UNJOURNALED;
+			running[i] = running[--running_count];
+		} else {
+			i++;
+		}
+	}
+
+	if (running_revoke_count == JOURNAL_REVOKES_MAX) {
+		// NOTE: commits in the middle of the current operation, which is then no longer atomic
+		journal_commit();
+	}
+	running_revokes[running_revoke_count++] = range;
+}
+
+uint32_t journal_running_blocks() {
+	return running_count;
+}
+
+void journal_commit() {
+	if (!journal_active) {
+		return;
+	}
+	if (commit_hook) {
+		commit_hook();
+	}
+	if (running_count == 0 && running_revoke_count == 0) {
+		return;
+	}
+
+	// ordered: file data reaches the disk before the metadata pointing at it commits
+	bcache_flush_data();
+
+	if (journal_head + running_count + 2 > journal_block_count
+		|| checkpoint_revokes + running_revoke_count > JOURNAL_REPLAY_REVOKES_MAX) {
+		reset_log();
+	}
+
+	memset(&descriptor, 0, sizeof(descriptor));
+	descriptor.magic = JOURNAL_MAGIC;
+	descriptor.sequence = journal_sequence;
+	for (uint32_t i = 0; i < running_revoke_count; i++) {
+		descriptor.tags[descriptor.tag_count++] = running_revokes[i].start | JOURNAL_TAG_REVOKE;
+		descriptor.tags[descriptor.tag_count++] = running_revokes[i].length;
+	}
+	for (uint32_t i = 0; i < running_count; i++) {
+		descriptor.tags[descriptor.tag_count++] = running[i]->block_num;
+	}
+
+	staged_at = journal_head;
+	log_block(&descriptor);
+	uint32_t checksum = crc32c(0, &descriptor, BLOCK_BYTES);
+	for (uint32_t i = 0; i < running_count; i++) {
+		bcache_seal(running[i]); // replay brings the logged copy home as is
+		log_block(running[i]->data);
+		checksum = crc32c(checksum, running[i]->data, BLOCK_BYTES);
+		running[i]->writeback = BCACHE_COMMITTED; // still dirty, goes home lazily
+	}
+	flush_staged();
+	ata_flush(); // barrier, the data and the log can't land after the commit block, nor can the last commit block
+
+	// the commit block goes out last, only then does the transaction count
+	memset(journal_staging, 0, BLOCK_BYTES);
+	JournalCommit* commit = (JournalCommit*)journal_staging;
+	commit->magic = JOURNAL_MAGIC;
+	commit->sequence = journal_sequence;
+	commit->checksum = checksum;
+	ata_write_blocks(journal_start + staged_at, journal_staging, 1);
+	commit_in_cache = true;
+
+	journal_head += running_count + 2;
+	journal_sequence++;
+	checkpoint_revokes += running_revoke_count;
+	memcpy(committed_revokes, running_revokes, running_revoke_count * sizeof(BitRange));
+	committed_revoke_count = running_revoke_count;
+	running_count = 0;
+	running_revoke_count = 0;
+}
+
+void journal_barrier() {
+	if (commit_in_cache) {
+		ata_flush();
+		commit_in_cache = false;
+		committed_revoke_count = 0;
+	}
+}
+
+// sets or clears the bits of the runs in `revokes` falling within the bitmap
+static void mask_revokes(const BitRange* revokes, uint32_t count, uint32_t* bitmap, uint32_t first_block, uint32_t block_count, bool set) {
+	for (uint32_t i = 0; i < count; i++) {
+		BitRange range = revokes[i];
+		if (range.start >= first_block && range.start - first_block < block_count) {
+			range.start -= first_block;
+			apply_bitrange(bitmap, range, set);
+		}
+	}
+}
+
+void journal_mask_unsettled(uint32_t* bitmap, uint32_t first_block, uint32_t block_count, bool set) {
+	mask_revokes(running_revokes, running_revoke_count, bitmap, first_block, block_count, set);
+	mask_revokes(committed_revokes, committed_revoke_count, bitmap, first_block, block_count, set);
+}
+
+bool journal_has_unsettled() {
+	return running_revoke_count || committed_revoke_count;
+}
+
+void journal_checkpoint() {
+	if (!journal_active) {
+		return;
+	}
+	journal_commit();
+	reset_log();
+}
@@ -12,6 +12,8 @@
 #include <file_handlers.h>
 #include <serial.h>
 #include <paging.h>
+#include <vfs.h>
+#include <tmpfs.h>
 
 // can have normal Registers struct passing, then in the isr80, we jump, put &r in eax, push, put the pointer 
 // to the beginning of the stack before the saving of the registers
@@ -37,13 +39,28 @@ void syscall_handler(void* arguments, Registers *r) {
 // cmd: ls 'dirname'
 int32_t exec_ls(int32_t stdin, int32_t stdout, StringList cmd) {
 	UNUSED(stdin);
-	char* ptr = str_list_dir(cmd.contents[1].contents);
-	if (!ptr) {
+	char* path = cmd.contents[1].contents;
+	int32_t fd = open(path);
+	if (fd == -1) {
 		return -1;
 	}
-	write(stdout, ptr, strlen(ptr));
-	FREE(ptr);
-	return 0;
+
+	// a few entries at a time, however large the directory is
+	DirRecord entries[8];
+	int32_t count;
+	bool first = true;
+	while ((count = readdir(fd, entries, sizeof(entries) / sizeof(DirRecord))) > 0) {
+		for (int32_t entry = 0; entry < count; entry++) {
+			if (!first) {
+				write(stdout, "\n", 1);
+			}
+			first = false;
+			write(stdout, path, strlen(path));
+			write(stdout, entries[entry].name, strlen(entries[entry].name));
+		}
+	}
+	close(fd);
+	return (count == -1) ? -1 : 0;
 }
 
 // cmd: cat 'filename' b
@@ -95,6 +112,16 @@ int32_t exec_rm(int32_t stdin, int32_t stdout, StringList cmd) {
 	return unlink(cmd.contents[1].contents);
 }
 
+// cmd: mv 'from' 'to'
+int32_t exec_mv(int32_t stdin, int32_t stdout, StringList cmd) {
+	UNUSED(stdin); UNUSED(stdout);
+	if (cmd.len < 3) {
+		PUSH_ERROR("usage: mv 'from' 'to'");
+		return -1;
+	}
+	return rename(cmd.contents[1].contents, cmd.contents[2].contents);
+}
+
 // cmd: mkdir 'filename'
 int32_t exec_mkdir(int32_t stdin, int32_t stdout, StringList cmd) {
 	UNUSED(stdin); UNUSED(stdout);
@@ -109,18 +136,156 @@ void sleep(float seconds) {
 	while (timer_counter < start + ticks_to_wait);
 }
 
+// writes "`label``value``unit`\n" to the file
+void write_stat_line(int32_t stdout, const char* label, uint32_t value, const char* unit) {
+	char number[12];
+	int_to_string(value, number);
+	write(stdout, label, strlen(label));
+	write(stdout, number, strlen(number));
+	write(stdout, unit, strlen(unit));
+	write(stdout, "\n", 1);
+}
+
 // cmd: stat 'filename'
 int32_t exec_stat(int32_t stdin, int32_t stdout, StringList cmd) {
+	UNUSED(stdin);
+	FileStat st;
+	if (stat(cmd.contents[1].contents, &st) == -1) {
+		return -1;
+	}
+
+	write_stat_line(stdout, "inode: ", st.inode_num, "");
+	write_stat_line(stdout, "size: ", st.size, " bytes");
+	write_stat_line(stdout, "on disk: ", st.disk_blocks, " blocks");
+	if (st.flags & INODE_FLAG_COMPRESSED) {
+		// size over the bytes on disk, as a percentage
+		uint32_t ratio = st.disk_blocks ? (st.size / st.disk_blocks) * 100 / BLOCK_BYTES : 0;
+		write_stat_line(stdout, "compression ratio: ", ratio, "%");
+	}
+	return 0;
+}
+
+// cmd: compress 'filename'
+int32_t exec_compress(int32_t stdin, int32_t stdout, StringList cmd) {
 	UNUSED(stdin); UNUSED(stdout);
 	int32_t fd = open(cmd.contents[1].contents);
 	if (fd == -1) {
 		return -1;
 	}
-
+	int32_t result = set_compression(fd, true);
 	close(fd);
+	return result;
+}
+
+// cmd: scrub
+int32_t exec_scrub(int32_t stdin, int32_t stdout, StringList cmd) {
+	UNUSED(stdin); UNUSED(cmd);
+	ScrubReport report;
+	int32_t result = scrub(&report);
+	write_stat_line(stdout, "checked: ", report.blocks_checked, " blocks");
+	write_stat_line(stdout, "checksum errors: ", report.errors, "");
+	if (result == -1) {
+		PUSH_ERROR("scrub found damaged metadata");
+	}
+	return result;
+}
+
+// cmd: cp [--reflink] 'from' 'to'
+int32_t exec_cp(int32_t stdin, int32_t stdout, StringList cmd) {
+	UNUSED(stdin); UNUSED(stdout);
+	if (cmd.len == 4 && MATCH(cmd.contents[1], "--reflink")) {
+		return reflink(cmd.contents[2].contents, cmd.contents[3].contents);
+	}
+	if (cmd.len != 3) {
+		PUSH_ERROR("usage: cp [--reflink] 'from' 'to'");
+		return -1;
+	}
+
+	int32_t from = open(cmd.contents[1].contents);
+	if (from == -1) {
+		return -1;
+	}
+	if (create_filetype(cmd.contents[2].contents, FILE_TYPE_NORMAL, false) == -1) {
+		close(from);
+		return -1;
+	}
+	int32_t to = open(cmd.contents[2].contents);
+	if (to == -1) {
+		close(from);
+		return -1;
+	}
+
+	char buffer[256];
+	uint32_t count;
+	int32_t result = 0;
+	while ((count = read(from, buffer, sizeof(buffer))) > 0) {
+		if (write(to, buffer, count) != count) {
+			result = -1;
+			break;
+		}
+	}
+	close(from);
+	close(to);
+	return result;
+}
+
+// cmd: snapshot 'dirname'
+int32_t exec_snapshot(int32_t stdin, int32_t stdout, StringList cmd) {
+	UNUSED(stdin); UNUSED(stdout);
+	return snapshot(cmd.contents[1].contents);
+}
+
+// cmd: defrag [on|off]
+int32_t exec_defrag(int32_t stdin, int32_t stdout, StringList cmd) {
+	UNUSED(stdin);
+	if (cmd.len == 2) {
+		if (!MATCH(cmd.contents[1], "on") && !MATCH(cmd.contents[1], "off")) {
+			PUSH_ERROR("usage: defrag [on|off]");
+			return -1;
+		}
+		defrag_background(MATCH(cmd.contents[1], "on"));
+		return 0;
+	}
+
+	DefragReport report;
+	int32_t result = defrag(&report);
+	write_stat_line(stdout, "files checked: ", report.files_checked, "");
+	write_stat_line(stdout, "files moved: ", report.files_moved, "");
+	write_stat_line(stdout, "blocks moved: ", report.blocks_moved, "");
+	write_stat_line(stdout, "extents before: ", report.extents_before, "");
+	write_stat_line(stdout, "extents after: ", report.extents_after, "");
+	write_stat_line(stdout, "free runs before: ", report.free_runs_before, "");
+	write_stat_line(stdout, "free runs after: ", report.free_runs_after, "");
+	return result;
+}
+
+// cmd: mount [`path`]
+int32_t exec_mount(int32_t stdin, int32_t stdout, StringList cmd) {
+	UNUSED(stdin);
+	if (cmd.len == 2) {
+		return tmpfs_mount(cmd.contents[1].contents);
+	}
+
+	for (uint32_t i = 0; i < MOUNTS_MAX; i++) {
+		const Mount* mount = vfs_mount_at(i);
+		if (!mount) {
+			continue;
+		}
+		const char* path = (mount->path[0] == '\0') ? "/" : mount->path;
+		write(stdout, path, strlen(path));
+		write(stdout, " ", 1);
+		write(stdout, mount->ops->name, strlen(mount->ops->name));
+		write(stdout, "\n", 1);
+	}
 	return 0;
 }
 
+// cmd: umount `path`
+int32_t exec_umount(int32_t stdin, int32_t stdout, StringList cmd) {
+	UNUSED(stdin); UNUSED(stdout);
+	return umount(cmd.contents[1].contents);
+}
+
 // cmd: sget `filename`
 int32_t exec_sget(int32_t stdin, int32_t stdout, StringList cmd) {
 	// Waits until a synchronizing message is sent over serial with a timeout
@@ -306,7 +471,7 @@ int32_t shell() {
 				FREE(curr_command); FREE(working_dir); FREE(cmd);
 				return 0;
 			} else if (PREFIX(cmd, "help")) {
-				write(STDOUT, "commands: ls, cat, echo, touch, rm, mkdir\n", 43);
+				write(STDOUT, "commands: ls, cat, echo, touch, rm, mv, cp, mkdir, stat, compress, snapshot, scrub, defrag, mount, umount, sync\n", 112);
 			} else if (PREFIX(cmd, "ls")) {
 				exit_code = exec_ls(STDIN, exp1_stdout, cmd);
 			} else if (PREFIX(cmd, "cat")) {
@@ -317,8 +482,28 @@ int32_t shell() {
 				exit_code = exec_touch(STDIN, exp1_stdout, cmd);
 			} else if (PREFIX(cmd, "rm")) {
 				exit_code = exec_rm(STDIN, exp1_stdout, cmd);
+			} else if (PREFIX(cmd, "mv")) {
+				exit_code = exec_mv(STDIN, exp1_stdout, cmd);
+			} else if (PREFIX(cmd, "cp")) {
+				exit_code = exec_cp(STDIN, exp1_stdout, cmd);
 			} else if (PREFIX(cmd, "mkdir")) {
 				exit_code = exec_mkdir(STDIN, exp1_stdout, cmd);
+			} else if (PREFIX(cmd, "stat")) {
+				exit_code = exec_stat(STDIN, exp1_stdout, cmd);
+			} else if (PREFIX(cmd, "compress")) {
+				exit_code = exec_compress(STDIN, exp1_stdout, cmd);
+			} else if (PREFIX(cmd, "snapshot")) {
+				exit_code = exec_snapshot(STDIN, exp1_stdout, cmd);
+			} else if (PREFIX(cmd, "scrub")) {
+				exit_code = exec_scrub(STDIN, exp1_stdout, cmd);
+			} else if (PREFIX(cmd, "defrag")) {
+				exit_code = exec_defrag(STDIN, exp1_stdout, cmd);
+			} else if (PREFIX(cmd, "mount")) {
+				exit_code = exec_mount(STDIN, exp1_stdout, cmd);
+			} else if (PREFIX(cmd, "umount")) {
+				exit_code = exec_umount(STDIN, exp1_stdout, cmd);
+			} else if (PREFIX(cmd, "sync")) {
+				exit_code = sync();
 			} else if (PREFIX(cmd, "sget")) {
 				exit_code = exec_sget(STDIN, exp1_stdout, cmd);
 			} else if (PREFIX(cmd, "run")) {
@@ -338,6 +523,8 @@ int32_t shell() {
 			FREE(cmd);
 			curr_command.len = 0; // reset to nothing
 			write(STDOUT, "\n$ ", 3);
+		} else {
+			defrag_idle(); // nothing typed, background work can go on
 		}
 	}
 
@@ -350,6 +537,7 @@ void main(void)
 {
 	initialize_allocator();	
 	initialize_terminal();
+	ata_init();
 	initalize_file_system(false);
 
 	gdt_install();
@@ -360,6 +548,7 @@ void main(void)
 	timer_install();
 	keyboard_install();
 	serial_interrupt_install();
+	ata_irq_install();
 	
 	enable_interrupts();
 
@@ -0,0 +1,146 @@
+#include <lz4.h>
+#include <string.h>
+
+#define MIN_MATCH 4     // shortest match a sequence can describe
+#define LAST_LITERALS 5 // the block always ends with this many literals
+#define MATCH_LIMIT 12  // no match starts within this many bytes of the end
+#define MAX_OFFSET 65535
+
+static uint16_t match_table[1 << LZ4_HASH_BITS]; // last position seen for each hash of 4 bytes
+
+static uint32_t read32(const uint8_t* p) {
+	return p[0] | (p[1] << 8) | (p[2] << 16) | ((uint32_t)p[3] << 24);
+}
+
+static uint32_t hash32(uint32_t sequence) {
+	return (sequence * 2654435761u) >> (32 - LZ4_HASH_BITS);
+}
+
+// appends a length past what fits in the token, in runs of 255
+static uint8_t* write_length(uint8_t* out, uint32_t length) {
+	while (length >= 255) {
+		*out++ = 255;
+		length -= 255;
+	}
+	*out++ = length;
+	return out;
+}
+
+// appends literals [`anchor`, `anchor` + `literals`) followed by a match, `match_length` 0 for the last sequence
+// returns NULL if it would go past `end`
+static uint8_t* write_sequence(uint8_t* out, uint8_t* end, const uint8_t* anchor, uint32_t literals, uint32_t offset, uint32_t match_length) {
+	uint32_t worst = 1 + literals + literals / 255 + 1 + 2 + match_length / 255 + 1;
+	if (worst > (uint32_t)(end - out)) {
+		return NULL;
+	}
+
+	uint8_t* token = out++;
+	*token = (literals < 15 ? literals : 15) << 4;
+	if (literals >= 15) {
+		out = write_length(out, literals - 15);
+	}
+	memcpy(out, anchor, literals);
+	out += literals;
+	if (match_length == 0) {
+		return out;
+	}
+
+	*out++ = offset & 0xFF;
+	*out++ = offset >> 8;
+	match_length -= MIN_MATCH;
+	*token |= (match_length < 15) ? match_length : 15;
+	if (match_length >= 15) {
+		out = write_length(out, match_length - 15);
+	}
+	return out;
+}
+
+uint32_t lz4_compress(const uint8_t* src, uint32_t length, uint8_t* dst, uint32_t capacity) {
+	if (length > LZ4_INPUT_MAX) {
+		return 0;
+	}
+	memset(match_table, 0, sizeof(match_table));
+
+	uint8_t* out = dst;
+	uint8_t* end = dst + capacity;
+	uint32_t anchor = 0; // first byte not covered by a sequence yet
+	uint32_t pos = 1;    // position 0 is where every empty table entry points
+	while (length > MATCH_LIMIT && pos < length - MATCH_LIMIT) {
+		uint32_t sequence = read32(src + pos);
+		uint32_t hash = hash32(sequence);
+		uint32_t candidate = match_table[hash];
+		match_table[hash] = pos;
+		if (pos - candidate > MAX_OFFSET || read32(src + candidate) != sequence) {
+			pos++;
+			continue;
+		}
+
+		uint32_t match_length = MIN_MATCH;
+		while (pos + match_length < length - LAST_LITERALS && src[candidate + match_length] == src[pos + match_length]) {
+			match_length++;
+		}
+		out = write_sequence(out, end, src + anchor, pos - anchor, pos - candidate, match_length);
+		if (!out) {
+			return 0;
+		}
+		pos += match_length;
+		anchor = pos;
+	}
+
+	out = write_sequence(out, end, src + anchor, length - anchor, 0, 0);
+	return out ? out - dst : 0;
+}
+
+// reads a length continued past the token, false if the block ends first
+static bool read_length(const uint8_t* src, uint32_t length, uint32_t* in, uint32_t* value) {
+	uint8_t byte;
+	do {
+		if (*in >= length) {
+			return false;
+		}
+		byte = src[(*in)++];
+		*value += byte;
+	} while (byte == 255);
+	return true;
+}
+
+int32_t lz4_decompress(const uint8_t* src, uint32_t length, uint8_t* dst, uint32_t capacity) {
+	uint32_t in = 0;
+	uint32_t out = 0;
+	while (in < length) {
+		uint8_t token = src[in++];
+		uint32_t literals = token >> 4;
+		if (literals == 15 && !read_length(src, length, &in, &literals)) {
+			return -1;
+		}
+		if (literals > length - in || literals > capacity - out) {
+			return -1;
+		}
+		memcpy(dst + out, src + in, literals);
+		in += literals;
+		out += literals;
+		if (in == length) {
+			break; // the last sequence has no match
+		}
+
+		if (length - in < 2) {
+			return -1;
+		}
+		uint32_t offset = src[in] | (src[in + 1] << 8);
+		in += 2;
+		uint32_t match_length = token & 0xF;
+		if (match_length == 15 && !read_length(src, length, &in, &match_length)) {
+			return -1;
+		}
+		match_length += MIN_MATCH;
+		if (offset == 0 || offset > out || match_length > capacity - out) {
+			return -1;
+		}
+		// byte by byte, the match may overlap what it is copying
+		for (uint32_t i = 0; i < match_length; i++) {
+			dst[out + i] = dst[out - offset + i];
+		}
+		out += match_length;
+	}
+	return out;
+}
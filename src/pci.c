@@ -0,0 +1,42 @@
+#include <pci.h>
+
+static uint32_t config_address(PciDevice device, uint8_t offset) {
+    return 0x80000000 | ((uint32_t)device.bus << 16) | ((uint32_t)device.slot << 11)
+        | ((uint32_t)device.function << 8) | (offset & 0xFC);
+}
+
+uint32_t pci_config_read(PciDevice device, uint8_t offset) {
+    outl(PCI_CONFIG_ADDRESS, config_address(device, offset));
+    return inl(PCI_CONFIG_DATA);
+}
+
+void pci_config_write(PciDevice device, uint8_t offset, uint32_t value) {
+    outl(PCI_CONFIG_ADDRESS, config_address(device, offset));
+    outl(PCI_CONFIG_DATA, value);
+}
+
+bool pci_find_class(uint8_t class_code, uint8_t subclass, PciDevice* device) {
+    // brute force over every bus, slot and function, a few thousand reads at boot
+    for (uint32_t bus = 0; bus < 256; bus++) {
+        for (uint32_t slot = 0; slot < 32; slot++) {
+            PciDevice candidate = {.bus = bus, .slot = slot, .function = 0};
+            if ((pci_config_read(candidate, PCI_REG_ID) & 0xFFFF) == PCI_NO_VENDOR) {
+                continue;
+            }
+            bool multi_function = (pci_config_read(candidate, PCI_REG_HEADER) >> 16) & PCI_HEADER_MULTI;
+            for (uint32_t function = 0; function < (multi_function ? 8u : 1u); function++) {
+                candidate.function = function;
+                if ((pci_config_read(candidate, PCI_REG_ID) & 0xFFFF) == PCI_NO_VENDOR) {
+                    continue;
+                }
+                uint32_t class_reg = pci_config_read(candidate, PCI_REG_CLASS);
+                if ((class_reg >> 24) == class_code && ((class_reg >> 16) & 0xFF) == subclass) {
+                    candidate.prog_if = (class_reg >> 8) & 0xFF;
+                    *device = candidate;
+                    return true;
+                }
+            }
+        }
+    }
+    return false;
+}
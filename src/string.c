@@ -148,4 +148,14 @@ uint32_t strcat(const char* src, char* dst) {
 	}
 	*dst = '\0';
 	return len; // so that you can take over the space with \0
+}
+
+// FNV-1a, cheap and spreads short names well
+uint32_t strhash(const char* str) {
+	uint32_t hash = 2166136261u;
+	while (*str) {
+		hash ^= (uint8_t)*str++;
+		hash *= 16777619u;
+	}
+	return hash;
 }
\ No newline at end of file
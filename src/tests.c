@@ -5,6 +5,7 @@
 #include <util.h>
 #include <io.h>
 #include <alloc.h>
+#include <blkq.h>
 
 
 bool test_ata_pio(void) {
@@ -60,6 +61,67 @@ bool test_ata_pio(void) {
     return true;
 }
 
+// DMA buffers are split into PRD entries at page boundaries, this one starts at an even but unaligned address
+bool test_ata_dma(void) {
+
+#define SECTOR_COUNT 8
+#define OFFSET 2050
+
+    static uint8_t expected[2 * 4096];
+    static uint8_t result[2 * 4096];
+    for (int i = 0; i < 512 * SECTOR_COUNT; i++) {
+        expected[OFFSET + i] = (uint8_t)(i * 7 + i / 512);
+    }
+
+    ata_write_sectors(0, SECTOR_COUNT, expected + OFFSET);
+    ata_read_sectors(0, SECTOR_COUNT, result + OFFSET);
+
+    for (int j = 0; j < 512 * SECTOR_COUNT; j++) {
+        if (expected[OFFSET + j] != result[OFFSET + j]) {
+            kprintf("\ndifference detected at byte % \n", j);
+            return false;
+        }
+    }
+
+#undef SECTOR_COUNT
+#undef OFFSET
+
+    return true;
+}
+
+static uint32_t blkq_completed[2];
+static uint32_t blkq_completions;
+
+static void record_completion(BlockRequest* request) {
+    blkq_completed[blkq_completions++] = request->block_num;
+}
+
+// two single block writes queued out of order go out as one command, lowest block first
+bool test_blkq_merge(void) {
+    static uint8_t blocks[2][BLOCK_BYTES];
+    static uint8_t result[2 * BLOCK_BYTES];
+    BlockRequest requests[2];
+    for (uint32_t i = 0; i < 2; i++) {
+        memset(blocks[i], 0xA0 + i, BLOCK_BYTES);
+        // block 1 is queued first
+        requests[i] = (BlockRequest){.block_num = 1 - i, .count = 1, .buffer = blocks[i], .write = true, .done = record_completion};
+    }
+
+    blkq_completions = 0;
+    blkq_submit(&requests[0]);
+    blkq_submit(&requests[1]);
+    if (blkq_completions != 0 || blkq_pending() != 2) {
+        return false;
+    }
+    blkq_unplug();
+    if (blkq_completions != 2 || blkq_completed[0] != 0 || blkq_completed[1] != 1) {
+        return false;
+    }
+
+    ata_read_blocks(0, result, 2);
+    return result[0] == 0xA1 && result[2 * BLOCK_BYTES - 1] == 0xA0;
+}
+
 bool test_intlen(void) {
     bool failing = false;
     failing |= intlen(10) != 2;
@@ -175,6 +237,255 @@ bool test_filesystem() {
 	return passing;
 }
 
+bool test_filesystem_extents() {
+    bool passing = true;
+    // spans several blocks, with a partial block on either end
+    static uint8_t expected[BLOCK_BYTES * 6];
+    static uint8_t result[BLOCK_BYTES * 6];
+    for (uint32_t i = 0; i < sizeof(expected); i++) {
+        expected[i] = (uint8_t)(i * 7 + i / BLOCK_BYTES);
+    }
+
+    int fd = create("/large");
+    if (fd == -1) {
+        panic(error_msg);
+    }
+    passing &= write(fd, expected, 100) == 100;
+    passing &= write(fd, expected + 100, sizeof(expected) - 100) == sizeof(expected) - 100;
+    passing &= read(fd, result, sizeof(result)) == sizeof(result);
+    for (uint32_t i = 0; i < sizeof(expected); i++) {
+        passing &= expected[i] == result[i];
+    }
+    close(fd);
+
+    passing &= unlink("/large") == 0;
+    return passing;
+}
+
+// frees blocks full of 0x5a, which the next file to grow is handed
+void leave_stale_blocks() {
+    static uint8_t stale[BLOCK_BYTES];
+    memset(stale, 0x5a, sizeof(stale));
+    int fd = create("/stale");
+    if (fd == -1) {
+        panic(error_msg);
+    }
+    for (uint32_t i = 0; i < 16; i++) {
+        write(fd, stale, sizeof(stale));
+    }
+    close(fd);
+    sync(); // the delayed blocks are placed on disk before they are freed
+    unlink("/stale");
+}
+
+bool reads_zeroes(int fd, uint32_t from, uint32_t to) {
+    uint8_t result[256];
+    bool passing = true;
+    seek(fd, from, SEEK_SET);
+    while (from < to) {
+        uint32_t chunk = (to - from < sizeof(result)) ? to - from : sizeof(result);
+        passing &= read(fd, result, chunk) == chunk;
+        for (uint32_t i = 0; i < chunk; i++) {
+            passing &= result[i] == 0;
+        }
+        from += chunk;
+    }
+    return passing;
+}
+
+bool test_filesystem_truncate_grow() {
+    bool passing = true;
+    leave_stale_blocks();
+    int fd = create("/grown");
+    if (fd == -1) {
+        panic(error_msg);
+    }
+    // a partial write past the last extent, inside the file
+    passing &= ftruncate(fd, 4595) == 0;
+    seek(fd, 5648, SEEK_SET);
+    passing &= write(fd, "hello", 5) == 5;
+    passing &= reads_zeroes(fd, 0, 5648);
+    close(fd);
+
+    passing &= unlink("/grown") == 0;
+    return passing;
+}
+
+bool test_filesystem_truncate_shrink() {
+    bool passing = true;
+    leave_stale_blocks();
+    int fd = create("/shrunk");
+    if (fd == -1) {
+        panic(error_msg);
+    }
+    // cutting off the block past the hole leaves the file without extents
+    seek(fd, 99347, SEEK_SET);
+    passing &= write(fd, "hello", 5) == 5;
+    passing &= ftruncate(fd, 43004) == 0;
+    seek(fd, 40174, SEEK_SET);
+    passing &= write(fd, "hello", 5) == 5;
+    passing &= reads_zeroes(fd, 0, 40174);
+    close(fd);
+
+    passing &= unlink("/shrunk") == 0;
+    return passing;
+}
+
+bool test_filesystem_fallocate_hole() {
+    bool passing = true;
+    leave_stale_blocks();
+    int fd = create("/preallocated");
+    if (fd == -1) {
+        panic(error_msg);
+    }
+    seek(fd, 5514, SEEK_SET);
+    passing &= write(fd, "hello", 5) == 5;
+    passing &= ftruncate(fd, 3683) == 0;
+    passing &= fallocate(fd, 49, 10684) == 0;
+    passing &= reads_zeroes(fd, 0, 3683);
+    close(fd);
+
+    passing &= unlink("/preallocated") == 0;
+    return passing;
+}
+
+bool test_filesystem_empty_write() {
+    bool passing = true;
+    static uint8_t data[BLOCK_BYTES];
+    int fd = create("/empty_write");
+    if (fd == -1) {
+        panic(error_msg);
+    }
+    // past the end, while the file's blocks are still delayed
+    passing &= write(fd, data, sizeof(data)) == sizeof(data);
+    passing &= write(fd, data, 904) == 904;
+    seek(fd, 9000, SEEK_SET);
+    passing &= write(fd, data, 0) == 0;
+    close(fd);
+    passing &= sync() == 0;
+
+    passing &= unlink("/empty_write") == 0;
+    return passing;
+}
+
+bool test_filesystem_rename() {
+    bool passing = true;
+    char buffer[8];
+
+    int fd = create("/old");
+    if (fd == -1) {
+        panic(error_msg);
+    }
+    write(fd, "hello", 6);
+    close(fd);
+    if (mkdir("/moved") == -1) {
+        panic(error_msg);
+    }
+
+    // into another directory, the data comes along
+    passing &= rename("/old", "/moved/new") == 0;
+    passing &= open("/old") == -1;
+    fd = open("/moved/new");
+    passing &= read(fd, buffer, 6) == 6 && strcmp(buffer, "hello") == 0;
+    close(fd);
+
+    // over an existing file, which goes away
+    fd = create("/other");
+    close(fd);
+    passing &= rename("/other", "/moved/new") == 0;
+    FileStat st;
+    passing &= stat("/moved/new", &st) == 0 && st.size == 0;
+    passing &= stat("/other", &st) == -1;
+
+    // never beneath itself, over a different type or under a name that doesn't fit
+    passing &= rename("/moved", "/moved/sub") == -1;
+    passing &= mkdir("/moved/dir") == 0;
+    passing &= rename("/moved/dir", "/moved/new") == -1;
+    passing &= rename("/moved/new", "/moved/dir") == -1;
+    passing &= rename("/moved/new", "/moved/0123456789012345678901234567890123") == -1;
+    passing &= create("/0123456789012345678901234567890123") == -1;
+    passing &= mkdir("/0123456789012345678901234567890123") == -1;
+
+    passing &= unlink("/moved/new") == 0;
+    passing &= unlink("/moved/dir") == 0;
+    passing &= unlink("/moved") == 0;
+    return passing;
+}
+
+bool test_filesystem_reuse_after_crash() {
+    bool passing = true;
+    static uint8_t data[8 * BLOCK_BYTES]; // past what delayed allocation holds back
+
+    memset(data, 'A', sizeof(data));
+    int a = create("/a");
+    if (a == -1) {
+        panic(error_msg);
+    }
+    for (int i = 0; i < 2; i++) {
+        write(a, data, sizeof(data));
+    }
+    passing &= sync() == 0;
+
+    // the blocks /a lets go of can't take /b's data before the truncate is on disk
+    passing &= ftruncate(a, 0) == 0;
+    memset(data, 'B', sizeof(data));
+    int b = create("/b");
+    seek(b, 8192, SEEK_SET);
+    for (int i = 0; i < 2; i++) {
+        write(b, data, sizeof(data));
+    }
+    int c = create("/c");
+    for (int i = 0; i < 16; i++) {
+        write(c, data, sizeof(data));
+    }
+    close(a);
+    close(b);
+    close(c);
+    initalize_file_system(false);
+
+    // either side of the truncate, never /b's data
+    a = open("/a");
+    while (read(a, data, sizeof(data)) > 0) {
+        for (uint32_t i = 0; i < sizeof(data); i++) {
+            passing &= data[i] == 'A';
+        }
+    }
+    close(a);
+
+    unlink("/a");
+    unlink("/b");
+    unlink("/c");
+    return passing;
+}
+
+bool test_filesystem_scrub_after_early_commit() {
+    bool passing = true;
+    static uint8_t data[BLOCK_BYTES];
+
+    int fd = create("/holes");
+    if (fd == -1) {
+        panic(error_msg);
+    }
+    for (int i = 0; i < 300; i++) {
+        write(fd, data, sizeof(data));
+    }
+    for (int i = 0; i < 300; i += 2) {
+        passing &= punch_hole(fd, i * BLOCK_BYTES, BLOCK_BYTES) == 0;
+    }
+    passing &= sync() == 0;
+
+    // freeing more runs than a transaction revokes commits part of the truncate early,
+    // the bitmaps it logs come with descriptors sealing them
+    passing &= ftruncate(fd, 0) == 0;
+    close(fd);
+    initalize_file_system(false);
+    ScrubReport report;
+    passing &= scrub(&report) == 0 && report.errors == 0;
+
+    unlink("/holes");
+    return passing;
+}
+
 uint32_t* test_malloc_part() {
 	uint32_t* a = (uint32_t*)kmalloc(3);
 	kprintf("a: 0x%x, *a: 0x%x\n", a, *a);
@@ -213,6 +524,12 @@ void run_tests(void) {
     // kprintf("test_ata_pio...");
     // kprintf((test_ata_pio()) ? "OK\n" : "FAIL\n");
 
+    // kprintf("test_ata_dma...");
+    // kprintf((test_ata_dma()) ? "OK\n" : "FAIL\n");
+
+    // kprintf("test_blkq_merge...");
+    // kprintf((test_blkq_merge()) ? "OK\n" : "FAIL\n");
+
     // kprintf("test_intlen...");
     // kprintf((test_intlen()) ? "OK\n" : "FAIL\n");
     
@@ -228,6 +545,30 @@ void run_tests(void) {
     // kprintf("test_filesystem...");
     // kprintf((test_filesystem()) ? "OK\n" : "FAIL\n");
 
+    // kprintf("test_filesystem_extents...");
+    // kprintf((test_filesystem_extents()) ? "OK\n" : "FAIL\n");
+
+    // kprintf("test_filesystem_truncate_grow...");
+    // kprintf((test_filesystem_truncate_grow()) ? "OK\n" : "FAIL\n");
+
+    // kprintf("test_filesystem_truncate_shrink...");
+    // kprintf((test_filesystem_truncate_shrink()) ? "OK\n" : "FAIL\n");
+
+    // kprintf("test_filesystem_fallocate_hole...");
+    // kprintf((test_filesystem_fallocate_hole()) ? "OK\n" : "FAIL\n");
+
+    // kprintf("test_filesystem_empty_write...");
+    // kprintf((test_filesystem_empty_write()) ? "OK\n" : "FAIL\n");
+
+    // kprintf("test_filesystem_rename...");
+    // kprintf((test_filesystem_rename()) ? "OK\n" : "FAIL\n");
+
+    // kprintf("test_filesystem_reuse_after_crash...");
+    // kprintf((test_filesystem_reuse_after_crash()) ? "OK\n" : "FAIL\n");
+
+    // kprintf("test_filesystem_scrub_after_early_commit...");
+    // kprintf((test_filesystem_scrub_after_early_commit()) ? "OK\n" : "FAIL\n");
+
     // kprintf("test_malloc...");
     // kprintf((test_malloc()) ? "OK\n" : "FAIL\n");
 
@@ -0,0 +1,399 @@
+#include <tmpfs.h>
+#include <file_handlers.h>
+#include <string.h>
+#include <util.h>
+
+// A file's pages are found by following page_next from its first page, the
+// page holding byte `pos` is pos / TMPFS_PAGE_BYTES links down the chain.
+// Directories have no pages, their entries are the nodes naming them as parent.
+
+typedef struct {
+	bool used;
+	uint8_t file_type;      // FILE_TYPE_*
+	uint8_t parent;         // directory holding the node, itself for the root of a mount
+	uint8_t first_page;     // TMPFS_NO_PAGE while the file is empty
+	uint32_t size;          // bytes of a file, entries of a directory
+	char name[32];
+} TmpfsNode;
+
+static TmpfsNode nodes[TMPFS_NODES_MAX];
+static uint8_t pages[TMPFS_PAGES][TMPFS_PAGE_BYTES];
+static uint8_t page_next[TMPFS_PAGES];
+static bool page_used[TMPFS_PAGES];
+
+_Static_assert(TMPFS_PAGES < TMPFS_NO_PAGE, "pages are numbered by a byte");
+_Static_assert(TMPFS_NODES_MAX <= 0x100, "nodes are numbered by a byte");
+
+void tmpfs_init() {
+	memset(nodes, 0, sizeof(nodes));
+	memset(page_used, 0, sizeof(page_used));
+}
+
+// -- NODES AND PAGES --
+
+static int32_t alloc_node(uint8_t file_type, uint8_t parent, const char* name) {
+	for (uint32_t node = 0; node < TMPFS_NODES_MAX; node++) {
+		if (!nodes[node].used) {
+			nodes[node] = (TmpfsNode){.used = true, .file_type = file_type, .parent = parent, .first_page = TMPFS_NO_PAGE};
+			strcpy(nodes[node].name, name);
+			return node;
+		}
+	}
+	PUSH_ERROR("tmpfs: out of nodes");
+	return -1;
+}
+
+static void free_node(uint32_t node) {
+	uint8_t page = nodes[node].first_page;
+	while (page != TMPFS_NO_PAGE) {
+		page_used[page] = false;
+		page = page_next[page];
+	}
+	nodes[node].used = false;
+}
+
+// a zeroed page off the end of no chain, TMPFS_NO_PAGE if all are in use
+static uint8_t alloc_page() {
+	for (uint32_t page = 0; page < TMPFS_PAGES; page++) {
+		if (!page_used[page]) {
+			page_used[page] = true;
+			memset(pages[page], 0, TMPFS_PAGE_BYTES);
+			page_next[page] = TMPFS_NO_PAGE;
+			return page;
+		}
+	}
+	return TMPFS_NO_PAGE;
+}
+
+// the entry named `name` of directory `dir`, -1 if there is none
+static int32_t find_child(uint32_t dir, const char* name) {
+	for (uint32_t node = 0; node < TMPFS_NODES_MAX; node++) {
+		if (nodes[node].used && nodes[node].parent == dir && node != dir && strcmp(nodes[node].name, name) == 0) {
+			return node;
+		}
+	}
+	return -1;
+}
+
+// follows `path` from the root of the mount to the directory holding its last component,
+// which is copied into `name`, left empty when the path names a directory by a trailing '/'
+static int32_t walk_path(const Mount* mount, const char* path, char* name) {
+	uint32_t dir = mount->root;
+	const char* component = path + 1;
+	while (true) {
+		uint32_t length = 0;
+		while (component[length] != '\0' && component[length] != '/') {
+			length++;
+		}
+		if (length >= sizeof(nodes[0].name)) {
+			PUSH_ERROR("file name too long");
+			return -1;
+		}
+		memcpy(name, component, length);
+		name[length] = '\0';
+		if (component[length] == '\0') {
+			return dir;
+		}
+
+		component += length + 1;
+		if (length == 0) {
+			continue; // "//"
+		}
+		int32_t child = find_child(dir, name);
+		if (child == -1 || nodes[child].file_type != FILE_TYPE_DIR) {
+			PUSH_ERROR("directory doesn't exist");
+			return -1;
+		}
+		dir = child;
+	}
+}
+
+// the node `path` names, -1 if there is none
+static int32_t lookup(const Mount* mount, const char* path) {
+	char name[32];
+	int32_t dir = walk_path(mount, path, name);
+	if (dir == -1 || name[0] == '\0') {
+		return dir;
+	}
+	int32_t node = find_child(dir, name);
+	if (node == -1) {
+		PUSH_ERROR("file doesn't exist");
+	}
+	return node;
+}
+
+// the page holding byte `pos` of the file, with the chain grown up to it when `grow` is set
+// TMPFS_NO_PAGE past the end, or when no page is left to grow it
+static uint8_t page_at(TmpfsNode* file, uint32_t pos, bool grow) {
+	uint8_t* link = &file->first_page;
+	for (uint32_t index = 0; index <= pos / TMPFS_PAGE_BYTES; index++) {
+		if (*link == TMPFS_NO_PAGE) {
+			uint8_t page = grow ? alloc_page() : TMPFS_NO_PAGE;
+			if (page == TMPFS_NO_PAGE) {
+				return TMPFS_NO_PAGE;
+			}
+			*link = page;
+		}
+		if (index == pos / TMPFS_PAGE_BYTES) {
+			return *link;
+		}
+		link = &page_next[*link];
+	}
+	return TMPFS_NO_PAGE;
+}
+
+// -- OPEN FILES --
+
+static uint64_t tmpfs_read(int64_t fd, const void* buf, uint32_t count) {
+	FileDescriptorEntry* entry = file_descriptor(fd);
+	TmpfsNode* file = &nodes[entry->inode_num];
+	if (entry->read_pos >= file->size) {
+		return 0;
+	}
+	if (count > file->size - entry->read_pos) {
+		count = file->size - entry->read_pos;
+	}
+
+	uint32_t done = 0;
+	uint8_t page = page_at(file, entry->read_pos, false);
+	while (done < count) {
+		uint32_t offset = (entry->read_pos + done) % TMPFS_PAGE_BYTES;
+		uint32_t chunk = (TMPFS_PAGE_BYTES - offset < count - done) ? TMPFS_PAGE_BYTES - offset : count - done;
+		memcpy((uint8_t*)buf + done, pages[page] + offset, chunk);
+		done += chunk;
+		page = page_next[page];
+	}
+	entry->read_pos += done;
+	return done;
+}
+
+static uint64_t tmpfs_write(int64_t fd, const void* buf, uint32_t count) {
+	FileDescriptorEntry* entry = file_descriptor(fd);
+	TmpfsNode* file = &nodes[entry->inode_num];
+	if (count == 0) {
+		return 0;
+	}
+
+	// a short write once the pages run out
+	while (count && page_at(file, entry->write_pos + count - 1, true) == TMPFS_NO_PAGE) {
+		uint32_t fits = (entry->write_pos + count - 1) / TMPFS_PAGE_BYTES * TMPFS_PAGE_BYTES;
+		count = (fits > entry->write_pos) ? fits - entry->write_pos : 0;
+	}
+	if (count == 0) {
+		PUSH_ERROR("tmpfs: out of pages");
+		return 0;
+	}
+
+	uint32_t done = 0;
+	uint8_t page = page_at(file, entry->write_pos, false);
+	while (done < count) {
+		uint32_t offset = (entry->write_pos + done) % TMPFS_PAGE_BYTES;
+		uint32_t chunk = (TMPFS_PAGE_BYTES - offset < count - done) ? TMPFS_PAGE_BYTES - offset : count - done;
+		memcpy(pages[page] + offset, (const uint8_t*)buf + done, chunk);
+		done += chunk;
+		page = page_next[page];
+	}
+	entry->write_pos += done;
+	if (entry->write_pos > file->size) {
+		file->size = entry->write_pos;
+	}
+	return done;
+}
+
+static int32_t tmpfs_seek(int64_t fd, int32_t offset, uint32_t param) {
+	FileDescriptorEntry* entry = file_descriptor(fd);
+	switch (param) {
+	case SEEK_SET:
+		entry->read_pos = offset;
+		entry->write_pos = offset;
+		break;
+	case SEEK_CUR:
+		entry->read_pos += offset;
+		entry->write_pos += offset;
+		break;
+	case SEEK_END:
+		entry->read_pos = nodes[entry->inode_num].size - offset;
+		entry->write_pos = nodes[entry->inode_num].size - offset;
+		break;
+	}
+	return entry->read_pos;
+}
+
+static uint64_t tmpfs_dir_io(int64_t fd, const void* buf, uint32_t count) {
+	UNUSED(fd); UNUSED(buf); UNUSED(count);
+	PUSH_ERROR("is a directory");
+	return 0;
+}
+
+// read_pos is the next node to look at
+static int32_t tmpfs_readdir(int64_t fd, DirRecord* entries, uint32_t max) {
+	FileDescriptorEntry* entry = file_descriptor(fd);
+	uint32_t dir = entry->inode_num;
+	uint32_t filled = 0;
+	while (filled < max && entry->read_pos < TMPFS_NODES_MAX) {
+		uint32_t node = entry->read_pos++;
+		if (nodes[node].used && nodes[node].parent == dir && node != dir) {
+			strcpy(entries[filled].name, nodes[node].name);
+			entries[filled].inode_num = node;
+			entries[filled].file_type = nodes[node].file_type;
+			filled++;
+		}
+	}
+	return filled;
+}
+
+static const FileOps tmpfs_file_ops = {tmpfs_read, tmpfs_write, tmpfs_seek, release_file_descriptor, NULL};
+static const FileOps tmpfs_dir_ops = {tmpfs_dir_io, tmpfs_dir_io, tmpfs_seek, release_file_descriptor, tmpfs_readdir};
+
+static int64_t open_node(uint32_t node) {
+	const FileOps* ops = &tmpfs_file_ops;
+	if (nodes[node].file_type == FILE_TYPE_DIR) {
+		ops = &tmpfs_dir_ops;
+	} else if (nodes[node].file_type == FILE_TYPE_SPECIAL) {
+		ops = special_file_ops(nodes[node].name);
+		if (!ops) {
+			PUSH_ERROR("no driver for special file");
+			return -1;
+		}
+	}
+	return allocate_file_descriptor(node, nodes[node].name, ops);
+}
+
+// -- FILE SYSTEM OPERATIONS --
+
+static int64_t tmpfs_create(const Mount* mount, const char* path, uint8_t file_type, bool allocate_fd) {
+	char name[32];
+	int32_t dir = walk_path(mount, path, name);
+	if (dir == -1) {
+		return -1;
+	}
+	if (name[0] == '\0') {
+		PUSH_ERROR("can't create without a name");
+		return -1;
+	}
+	if (find_child(dir, name) != -1) {
+		PUSH_ERROR("file already exists");
+		return -1;
+	}
+	int32_t node = alloc_node(file_type, dir, name);
+	if (node == -1) {
+		return -1;
+	}
+	int64_t fd = allocate_fd ? open_node(node) : 0;
+	if (fd == -1) {
+		free_node(node);
+		return -1;
+	}
+	nodes[dir].size++;
+	return fd;
+}
+
+static int64_t tmpfs_open(const Mount* mount, const char* path) {
+	int32_t node = lookup(mount, path);
+	return (node == -1) ? -1 : open_node(node);
+}
+
+static int32_t tmpfs_unlink(const Mount* mount, const char* path) {
+	char name[32];
+	int32_t dir = walk_path(mount, path, name);
+	if (dir == -1) {
+		return -1;
+	}
+	if (name[0] == '\0') {
+		PUSH_ERROR("can't remove without a name");
+		return -1;
+	}
+	int32_t node = find_child(dir, name);
+	if (node == -1) {
+		PUSH_ERROR("file doesn't exist");
+		return -1;
+	}
+	if (nodes[node].file_type == FILE_TYPE_DIR && nodes[node].size) {
+		PUSH_ERROR("directory not empty");
+		return -1;
+	}
+	free_node(node);
+	nodes[dir].size--;
+	return 0;
+}
+
+static int32_t tmpfs_stat(const Mount* mount, const char* path, FileStat* st) {
+	int32_t node = lookup(mount, path);
+	if (node == -1) {
+		return -1;
+	}
+	st->inode_num = node;
+	st->file_type = nodes[node].file_type;
+	st->flags = 0;
+	st->size = nodes[node].size;
+	st->disk_blocks = 0;
+	return 0;
+}
+
+static int32_t tmpfs_rename(const Mount* mount, const char* old_path, const char* new_path) {
+	char old_name[32];
+	char new_name[32];
+	int32_t old_dir = walk_path(mount, old_path, old_name);
+	int32_t new_dir = walk_path(mount, new_path, new_name);
+	if (old_dir == -1 || new_dir == -1) {
+		return -1;
+	}
+	if (old_name[0] == '\0' || new_name[0] == '\0') {
+		PUSH_ERROR("can't rename without a name");
+		return -1;
+	}
+	int32_t node = find_child(old_dir, old_name);
+	if (node == -1) {
+		PUSH_ERROR("file doesn't exist");
+		return -1;
+	}
+	// a directory can't move into itself
+	for (uint32_t dir = new_dir; dir != nodes[dir].parent; dir = nodes[dir].parent) {
+		if (dir == (uint32_t)node) {
+			PUSH_ERROR("can't move a directory into itself");
+			return -1;
+		}
+	}
+
+	int32_t replaced = find_child(new_dir, new_name);
+	if (replaced == node) {
+		return 0;
+	}
+	if (replaced != -1) {
+		if (nodes[replaced].file_type == FILE_TYPE_DIR && nodes[replaced].size) {
+			PUSH_ERROR("directory not empty");
+			return -1;
+		}
+		free_node(replaced);
+		nodes[new_dir].size--;
+	}
+	nodes[old_dir].size--;
+	nodes[node].parent = new_dir;
+	strcpy(nodes[node].name, new_name);
+	nodes[new_dir].size++;
+	return 0;
+}
+
+static int32_t tmpfs_unmount(const Mount* mount) {
+	if (nodes[mount->root].size) {
+		PUSH_ERROR("file system is busy");
+		return -1;
+	}
+	free_node(mount->root);
+	return 0;
+}
+
+static const FileSystemOps tmpfs_ops = {"tmpfs", tmpfs_create, tmpfs_open, tmpfs_unlink, tmpfs_stat, tmpfs_rename, tmpfs_unmount};
+
+int32_t tmpfs_mount(const char* path) {
+	int32_t root = alloc_node(FILE_TYPE_DIR, 0, "");
+	if (root == -1) {
+		return -1;
+	}
+	nodes[root].parent = root;
+	if (mount(path, &tmpfs_ops, root) == -1) {
+		free_node(root);
+		return -1;
+	}
+	return 0;
+}
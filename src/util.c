@@ -81,6 +81,54 @@ BitRange alloc_bitrange(uint32_t* bitmap, uint32_t capacity, uint32_t count, boo
     return range; // No space found
 }
 
+BitRange alloc_bitrange_near(uint32_t* bitmap, uint32_t capacity, uint32_t goal, uint32_t count) {
+	BitRange best = { .start = 0, .length = 0 };
+	if (count == 0) {
+		return best;
+	}
+	if (goal >= capacity) {
+		goal = 0;
+	}
+
+	// first pass covers [goal, capacity), second wraps around to cover [0, goal)
+	for (uint8_t pass = 0; pass < 2; pass++) {
+		uint32_t bit = (pass) ? 0 : goal;
+		uint32_t end = (pass) ? goal : capacity;
+		uint32_t curr_start = bit;
+		uint32_t curr_length = 0;
+		while (bit < end) {
+			// skip over fully allocated words
+			if (bit % 32 == 0 && bitmap[bit / 32] == ~0u) {
+				curr_length = 0;
+				bit += 32;
+				continue;
+			}
+			if (bitmap[bit / 32] & (1u << (31 - bit % 32))) {
+				curr_length = 0;
+			} else {
+				if (curr_length == 0) {
+					curr_start = bit;
+				}
+				curr_length++;
+				if (curr_length > best.length) {
+					best.start = curr_start;
+					best.length = curr_length;
+				}
+				if (curr_length == count) {
+					apply_bitrange(bitmap, best, true);
+					return best;
+				}
+			}
+			bit++;
+		}
+	}
+
+	if (best.length) {
+		apply_bitrange(bitmap, best, true);
+	}
+	return best;
+}
+
 void dealloc_bitrange(uint32_t* bitmap, BitRange range) {
 	apply_bitrange(bitmap, range, false);
 }
@@ -0,0 +1,205 @@
+#include <vfs.h>
+#include <string.h>
+#include <util.h>
+
+static Mount mounts[MOUNTS_MAX];
+
+// the rest of `path` past `prefix`, if `prefix` is made of whole components of it, NULL otherwise
+static const char* skip_prefix(const char* path, const char* prefix) {
+	while (*prefix) {
+		if (*path++ != *prefix++) {
+			return NULL;
+		}
+	}
+	if (*path == '\0') {
+		return "/";
+	}
+	return (*path == '/') ? path : NULL;
+}
+
+void vfs_init() {
+	memset(mounts, 0, sizeof(mounts));
+}
+
+const Mount* vfs_resolve(const char* path, const char** rest) {
+	const Mount* best = NULL;
+	uint32_t best_length = 0;
+	for (uint32_t i = 0; i < MOUNTS_MAX; i++) {
+		if (!mounts[i].ops) {
+			continue;
+		}
+		uint32_t length = strlen(mounts[i].path);
+		const char* within = skip_prefix(path, mounts[i].path);
+		if (within && (!best || length > best_length)) {
+			best = &mounts[i];
+			best_length = length;
+			*rest = within;
+		}
+	}
+	ASSERT(best, "vfs: nothing mounted on /");
+	return best;
+}
+
+const Mount* vfs_mount_at(uint32_t index) {
+	return (index < MOUNTS_MAX && mounts[index].ops) ? &mounts[index] : NULL;
+}
+
+// the slot of the mount on `path` exactly, -1 if there is none
+static int32_t find_mount(const char* path) {
+	for (uint32_t i = 0; i < MOUNTS_MAX; i++) {
+		if (mounts[i].ops && strcmp(mounts[i].path, path) == 0) {
+			return i;
+		}
+	}
+	return -1;
+}
+
+// copies `path` into `mount_path` without its trailing '/', so "/" becomes ""
+static bool mount_point(const char* path, char* mount_path) {
+	uint32_t length = strlen(path);
+	while (length && path[length - 1] == '/') {
+		length--;
+	}
+	if (path[0] != '/' || length >= MOUNT_PATH_MAX) {
+		PUSH_ERROR("mount point must be an absolute path shorter than MOUNT_PATH_MAX");
+		return false;
+	}
+	memcpy(mount_path, path, length);
+	mount_path[length] = '\0';
+	return true;
+}
+
+int32_t mount(const char* path, const FileSystemOps* ops, uint32_t root) {
+	char mount_path[MOUNT_PATH_MAX];
+	if (!mount_point(path, mount_path)) {
+		return -1;
+	}
+	if (find_mount(mount_path) != -1) {
+		PUSH_ERROR("a file system is mounted there already");
+		return -1;
+	}
+	bool root_mounted = find_mount("") != -1;
+	if (!root_mounted && mount_path[0] != '\0') {
+		PUSH_ERROR("the root has to be mounted first");
+		return -1;
+	}
+	FileStat st;
+	if (root_mounted && (stat(path, &st) == -1 || st.file_type != FILE_TYPE_DIR)) {
+		PUSH_ERROR("mount point must be a directory");
+		return -1;
+	}
+
+	int32_t slot = -1;
+	for (uint32_t i = 0; i < MOUNTS_MAX && slot == -1; i++) {
+		if (!mounts[i].ops) {
+			slot = i;
+		}
+	}
+	if (slot == -1) {
+		PUSH_ERROR("mount table is full");
+		return -1;
+	}
+	strcpy(mounts[slot].path, mount_path);
+	mounts[slot].ops = ops;
+	mounts[slot].root = root;
+	return 0;
+}
+
+int32_t umount(const char* path) {
+	char mount_path[MOUNT_PATH_MAX];
+	if (!mount_point(path, mount_path)) {
+		return -1;
+	}
+	int32_t slot = find_mount(mount_path);
+	if (slot == -1) {
+		PUSH_ERROR("nothing is mounted there");
+		return -1;
+	}
+	if (mount_path[0] == '\0') {
+		PUSH_ERROR("the root stays mounted");
+		return -1;
+	}
+	for (uint32_t i = 0; i < MOUNTS_MAX; i++) {
+		if (i != (uint32_t)slot && mounts[i].ops && skip_prefix(mounts[i].path, mount_path)) {
+			PUSH_ERROR("a file system is mounted within it");
+			return -1;
+		}
+	}
+	if (mounts[slot].ops->unmount(&mounts[slot]) == -1) {
+		return -1;
+	}
+	mounts[slot].ops = NULL;
+	return 0;
+}
+
+// -- PATH SYSCALLS --
+
+int64_t create_filetype(const char* path, uint8_t file_type, bool allocate_fd) {
+	if (path[0] != '/') {
+		PUSH_ERROR("Relative addressing unimplmented");
+		return -1;
+	}
+	const char* rest;
+	const Mount* mount = vfs_resolve(path, &rest);
+	return mount->ops->create(mount, rest, file_type, allocate_fd);
+}
+
+int64_t create(const char* path) {
+	return create_filetype(path, FILE_TYPE_NORMAL, true);
+}
+
+int32_t mkdir(const char* path) {
+	return create_filetype(path, FILE_TYPE_DIR, false);
+}
+
+int64_t open(const char* path) {
+	if (path[0] != '/') {
+		PUSH_ERROR("Relative addressing unimplmented");
+		return -1;
+	}
+	const char* rest;
+	const Mount* mount = vfs_resolve(path, &rest);
+	return mount->ops->open(mount, rest);
+}
+
+int32_t unlink(const char* path) {
+	if (path[0] != '/') {
+		PUSH_ERROR("Relative addressing unimplmented");
+		return -1;
+	}
+	const char* rest;
+	const Mount* mount = vfs_resolve(path, &rest);
+	return mount->ops->unlink(mount, rest);
+}
+
+int32_t stat(const char* path, FileStat* st) {
+	if (path[0] != '/') {
+		PUSH_ERROR("Relative addressing unimplmented");
+		return -1;
+	}
+	const char* rest;
+	const Mount* mount = vfs_resolve(path, &rest);
+	return mount->ops->stat(mount, rest, st);
+}
+
+int32_t rename(const char* old_path, const char* new_path) {
+	if (old_path[0] != '/' || new_path[0] != '/') {
+		PUSH_ERROR("Relative addressing unimplmented");
+		return -1;
+	}
+	const char* old_rest;
+	const char* new_rest;
+	const Mount* mount = vfs_resolve(old_path, &old_rest);
+	if (vfs_resolve(new_path, &new_rest) != mount) {
+		PUSH_ERROR("can't move across file systems");
+		return -1;
+	}
+	// a mount point would be left behind
+	for (uint32_t i = 0; i < MOUNTS_MAX; i++) {
+		if (mounts[i].ops && skip_prefix(mounts[i].path, old_path)) {
+			PUSH_ERROR("a file system is mounted there");
+			return -1;
+		}
+	}
+	return mount->ops->rename(mount, old_rest, new_rest);
+}
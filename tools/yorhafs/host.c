@@ -0,0 +1,214 @@
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdarg.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <dirent.h>
+#include <sys/stat.h>
+#include <ata.h>
+#include "image.h"
+
+static int image_fd = -1;
+static uint64_t image_bytes;
+
+bool image_open(const char* path, uint64_t size) {
+	image_fd = open(path, O_RDWR | (size ? O_CREAT : 0), 0644);
+	if (image_fd == -1) {
+		fprintf(stderr, "yorhafs: %s: %s\n", path, strerror(errno));
+		return false;
+	}
+	if (size && ftruncate(image_fd, size) == -1) {
+		fprintf(stderr, "yorhafs: %s: %s\n", path, strerror(errno));
+		close(image_fd);
+		return false;
+	}
+	struct stat st;
+	fstat(image_fd, &st);
+	image_bytes = st.st_size;
+	return true;
+}
+
+void image_close() {
+	fsync(image_fd);
+	close(image_fd);
+	image_fd = -1;
+}
+
+// the kernel has no way to take an I/O error, the image was cut short under it
+static void image_failed(const char* what, uint64_t lba) {
+	fprintf(stderr, "yorhafs: %s at sector %llu failed: %s\n", what, (unsigned long long)lba, errno ? strerror(errno) : "past the end of the image");
+	exit(2);
+}
+
+void image_read_blocks(uint32_t block_num, void* buffer, uint32_t count) {
+	size_t bytes = (size_t)count * BLOCK_BYTES;
+	if (pread(image_fd, buffer, bytes, (off_t)block_num * BLOCK_BYTES) != (ssize_t)bytes) {
+		image_failed("read", block_num * SECTORS_PER_BLOCK);
+	}
+}
+
+// -- KERNEL SHIMS --
+// what the file system code needs of the rest of the kernel, see ata.h, vga.h, alloc.h and serial.h
+
+void ata_read_sectors(uint64_t lba, uint32_t sector_count, const uint8_t* buffer) {
+	size_t bytes = (size_t)sector_count * SECTOR_BYTES;
+	errno = 0;
+	if (pread(image_fd, (void*)buffer, bytes, (off_t)lba * SECTOR_BYTES) != (ssize_t)bytes) {
+		image_failed("read", lba);
+	}
+}
+
+void ata_write_sectors(uint64_t lba, uint32_t sector_count, const uint8_t* buffer) {
+	size_t bytes = (size_t)sector_count * SECTOR_BYTES;
+	errno = 0;
+	if (pwrite(image_fd, buffer, bytes, (off_t)lba * SECTOR_BYTES) != (ssize_t)bytes) {
+		image_failed("write", lba);
+	}
+}
+
+void ata_read_segments(uint64_t lba, const AtaSegment* segments, uint32_t segment_count) {
+	for (uint32_t i = 0; i < segment_count; i++) {
+		ata_read_sectors(lba, segments[i].sector_count, segments[i].buffer);
+		lba += segments[i].sector_count;
+	}
+}
+
+void ata_write_segments(uint64_t lba, const AtaSegment* segments, uint32_t segment_count) {
+	for (uint32_t i = 0; i < segment_count; i++) {
+		ata_write_sectors(lba, segments[i].sector_count, segments[i].buffer);
+		lba += segments[i].sector_count;
+	}
+}
+
+// the journal's write barriers, the image reaches the disk in the same order the drive's media would
+void ata_flush() {
+	fdatasync(image_fd);
+}
+
+void ata_read_blocks(uint32_t block_num, const uint8_t* buffer, uint32_t count) {
+	ata_read_sectors((uint64_t)block_num * SECTORS_PER_BLOCK, count * SECTORS_PER_BLOCK, buffer);
+}
+
+void ata_write_blocks(uint32_t block_num, const uint8_t* buffer, uint32_t count) {
+	ata_write_sectors((uint64_t)block_num * SECTORS_PER_BLOCK, count * SECTORS_PER_BLOCK, buffer);
+}
+
+uint64_t ata_get_disk_size() {
+	return image_bytes;
+}
+
+// the kernel's console goes to stderr, leaving stdout to yorhafs itself
+void kwrite(const char* data, size_t size) {
+	fwrite(data, 1, size, stderr);
+}
+
+void kprint(const char* s) {
+	fputs(s, stderr);
+}
+
+void kprintf(const char* fmt, ...) {
+	va_list args;
+	va_start(args, fmt);
+	vfprintf(stderr, fmt, args);
+	va_end(args);
+}
+
+void terminal_clear(void) {}
+
+// linked in with --wrap=panic, the kernel's own halts the CPU
+void __wrap_panic(const char* msg) {
+	fprintf(stderr, "%s\nyorhafs: the file system code panicked, the image may be left inconsistent\n", msg);
+	exit(2);
+}
+
+void* kmalloc(size_t size) {
+	void* ptr = malloc(size);
+	if (!ptr) {
+		fprintf(stderr, "yorhafs: out of memory\n");
+		exit(2);
+	}
+	return ptr;
+}
+
+void kfree(void* ptr) {
+	free(ptr);
+}
+
+// no serial port, /dev/serial reads nothing and writes go nowhere
+int init_serial() {
+	return 0;
+}
+
+int is_transmit_empty() {
+	return 1;
+}
+
+int serial_received() {
+	return 0;
+}
+
+volatile uint64_t timer_counter; // stands still, the file system syncs off its update count alone
+
+// -- HOST FILES --
+
+bool host_walk(const char* host_dir, const char* path, HostVisit visit) {
+	DIR* dir = opendir(host_dir);
+	if (!dir) {
+		fprintf(stderr, "yorhafs: %s: %s\n", host_dir, strerror(errno));
+		return false;
+	}
+
+	bool ok = true;
+	struct dirent* entry;
+	while (ok && (entry = readdir(dir))) {
+		if (strcmp(entry->d_name, ".") == 0 || strcmp(entry->d_name, "..") == 0) {
+			continue;
+		}
+		char* host_path;
+		char* child_path;
+		if (asprintf(&host_path, "%s/%s", host_dir, entry->d_name) == -1
+			|| asprintf(&child_path, "%s/%s", (strcmp(path, "/") == 0) ? "" : path, entry->d_name) == -1) {
+			fprintf(stderr, "yorhafs: out of memory\n");
+			exit(2);
+		}
+
+		struct stat st;
+		if (lstat(host_path, &st) == -1) {
+			fprintf(stderr, "yorhafs: %s: %s\n", host_path, strerror(errno));
+			ok = false;
+		} else if (S_ISDIR(st.st_mode)) {
+			ok = visit(host_path, child_path, true) && host_walk(host_path, child_path, visit);
+		} else if (S_ISREG(st.st_mode)) {
+			ok = visit(host_path, child_path, false);
+		} else {
+			fprintf(stderr, "yorhafs: %s: skipped, neither a directory nor a regular file\n", host_path);
+		}
+		free(host_path);
+		free(child_path);
+	}
+	closedir(dir);
+	return ok;
+}
+
+int32_t host_file_open(const char* host_path) {
+	int file = open(host_path, O_RDONLY);
+	if (file == -1) {
+		fprintf(stderr, "yorhafs: %s: %s\n", host_path, strerror(errno));
+	}
+	return file;
+}
+
+int32_t host_file_read(int32_t file, void* buffer, uint32_t count) {
+	ssize_t bytes = read(file, buffer, count);
+	if (bytes == -1) {
+		fprintf(stderr, "yorhafs: read: %s\n", strerror(errno));
+	}
+	return bytes;
+}
+
+void host_file_close(int32_t file) {
+	close(file);
+}
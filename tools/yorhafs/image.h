@@ -0,0 +1,62 @@
+#ifndef YORHAFS_IMAGE_H
+#define YORHAFS_IMAGE_H
+
+#include <stdint.h>
+#include <stdbool.h>
+
+// host.c is built against the C library alone and stands in for the ATA
+// driver, the console and the heap under the kernel's file system code.
+// Everything else in yorhafs sees the kernel's headers, so what crosses
+// between the two sides goes through here in plain types.
+
+/**
+ * @brief Opens the disk image the kernel's ATA calls read and write.
+ *
+ * @param path Path of the image on the host.
+ * @param size Bytes to create or resize the image to, 0 to take it as it is.
+ * @return false, with a message printed, if the image can't be opened.
+ */
+bool image_open(const char* path, uint64_t size);
+
+/**
+ * @brief Flushes the image to the host's disk and closes it.
+ */
+void image_close();
+
+/**
+ * @brief Reads blocks straight from the image, past the kernel's cache.
+ */
+void image_read_blocks(uint32_t block_num, void* buffer, uint32_t count);
+
+/**
+ * @brief Called by `host_walk` for every directory and regular file.
+ *
+ * @param host_path Where the entry is on the host.
+ * @param path Where it goes in the image, "/" joined.
+ * @param is_dir Whether it is a directory, entered after the call.
+ * @return false to stop the walk.
+ */
+typedef bool (*HostVisit)(const char* host_path, const char* path, bool is_dir);
+
+/**
+ * @brief Walks a host directory tree, each directory before its contents.
+ *
+ * Anything but directories and regular files is skipped with a warning.
+ *
+ * @return false if the walk failed or was stopped.
+ */
+bool host_walk(const char* host_dir, const char* path, HostVisit visit);
+
+/**
+ * @brief Opens a host file for reading, -1 on failure.
+ */
+int32_t host_file_open(const char* host_path);
+
+/**
+ * @brief Reads from a host file, returns the bytes read, 0 at the end and -1 on failure.
+ */
+int32_t host_file_read(int32_t file, void* buffer, uint32_t count);
+
+void host_file_close(int32_t file);
+
+#endif // YORHAFS_IMAGE_H
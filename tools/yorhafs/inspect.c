@@ -0,0 +1,342 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdarg.h>
+#include <fs.h>
+#include <string.h>
+#include <util.h>
+#include "image.h"
+#include "yorhafs.h"
+
+static FileSystemSuper super;
+static FileSystemGroupDesc groups[FS_MAX_GROUPS];
+static uint8_t (*block_bitmaps)[BLOCK_BYTES];   // one per group
+static uint8_t (*inode_bitmaps)[BLOCK_BYTES];
+static uint16_t* block_owners;                  // files claiming each block, 1 for metadata
+static bool* inode_reached;
+static uint32_t dirs_reached[FS_MAX_GROUPS];
+static uint32_t problems;
+static bool dumping;
+
+static void problem(const char* format, ...) {
+	problems++;
+	if (!dumping) {
+		va_list args;
+		va_start(args, format);
+		printf("fsck: ");
+		vprintf(format, args);
+		printf("\n");
+		va_end(args);
+	}
+}
+
+// same order as the kernel's bitmap_test, bits run from the top of each 32 bit word
+static bool test_bit(const uint8_t* bitmap, uint32_t index) {
+	return ((const uint32_t*)bitmap)[index / 32] & (1u << (31 - index % 32));
+}
+
+static uint32_t group_block_count(uint32_t group) {
+	uint32_t remaining = super.block_count - group * super.blocks_per_group;
+	return (remaining < super.blocks_per_group) ? remaining : super.blocks_per_group;
+}
+
+static FileSystemInode read_inode(uint32_t inode_num) {
+	uint8_t table[BLOCK_BYTES];
+	FileSystemGroupDesc* desc = &groups[inode_num / super.inodes_per_group];
+	uint32_t index = inode_num % super.inodes_per_group;
+	image_read_blocks(desc->inode_table + index / INODES_PER_BLOCK, table, 1);
+	return ((FileSystemInode*)table)[index % INODES_PER_BLOCK];
+}
+
+// counts the inode as one more owner of each block of the run
+static bool claim_blocks(const char* path, BitRange run) {
+	if (run.start >= super.block_count || run.length > super.block_count - run.start) {
+		problem("%s: blocks %u+%u lie past the end of the disk", path, run.start, run.length);
+		return false;
+	}
+	uint32_t group = run.start / super.blocks_per_group;
+	uint32_t group_start = group * super.blocks_per_group;
+	if ((run.start + run.length - 1) / super.blocks_per_group != group) {
+		problem("%s: blocks %u+%u cross into another group", path, run.start, run.length);
+		return false;
+	}
+	if (run.start < groups[group].data_start) {
+		problem("%s: blocks %u+%u overlap the metadata of group %u", path, run.start, run.length, group);
+		return false;
+	}
+
+	uint32_t marked_free = 0;
+	for (uint32_t block = run.start; block < run.start + run.length; block++) {
+		if (!test_bit(block_bitmaps[group], block - group_start)) {
+			marked_free++;
+		}
+		if (block_owners[block] < UINT16_MAX) {
+			block_owners[block]++;
+		}
+	}
+	if (marked_free) {
+		problem("%s: %u of blocks %u+%u are marked free", path, marked_free, run.start, run.length);
+	}
+	return true;
+}
+
+// the inode's extents, direct and overflow, with the overflow block claimed
+static bool read_extents(const char* path, const FileSystemInode* inode, BitRange* extents) {
+	if (inode->extent_count > INODE_EXTENTS_MAX) {
+		problem("%s: %u extents, more than an inode holds", path, inode->extent_count);
+		return false;
+	}
+	uint32_t direct = (inode->extent_count < INODE_DIRECT_EXTENTS) ? inode->extent_count : INODE_DIRECT_EXTENTS;
+	memcpy(extents, inode->extents, direct * sizeof(BitRange));
+	if (inode->extent_block) {
+		if (!claim_blocks(path, (BitRange){.start = inode->extent_block, .length = 1})) {
+			return false;
+		}
+		if (inode->extent_count > INODE_DIRECT_EXTENTS) {
+			uint8_t block[BLOCK_BYTES];
+			image_read_blocks(inode->extent_block, block, 1);
+			memcpy(extents + INODE_DIRECT_EXTENTS, block, (inode->extent_count - INODE_DIRECT_EXTENTS) * sizeof(BitRange));
+		}
+	} else if (inode->extent_count > INODE_DIRECT_EXTENTS) {
+		problem("%s: %u extents but no extent block", path, inode->extent_count);
+		return false;
+	}
+	return true;
+}
+
+static void print_inode(const char* path, uint32_t inode_num, const FileSystemInode* inode, const BitRange* extents) {
+	const char* types = "d-c";
+	uint32_t size = (inode->file_type == FILE_TYPE_DIR) ? inode->size / sizeof(FileSystemDirEntry) : inode->size;
+	printf("%6u %c %10u %s", inode_num, (inode->file_type <= FILE_TYPE_SPECIAL) ? types[inode->file_type] : '?', size, path);
+	if (inode->flags & INODE_FLAG_INLINE) {
+		printf(" [inline]");
+	}
+	if (inode->flags & INODE_FLAG_COMPRESSED) {
+		printf(" [compressed]");
+	}
+	if (inode->flags & INODE_FLAG_READONLY) {
+		printf(" [read-only]");
+	}
+	if (extents) {
+		for (uint32_t index = 0; index < inode->extent_count; index++) {
+			BitRange extent = extents[index];
+			bool packed = (inode->flags & INODE_FLAG_COMPRESSED) && (extent.length & CLUSTER_PACKED);
+			extent.length &= ~CLUSTER_PACKED;
+			if (EXTENT_IS_HOLE(extent)) {
+				printf(" hole+%u", extent.length);
+			} else {
+				printf(" %u+%u%s", extent.start, extent.length, packed ? "z" : "");
+			}
+		}
+	}
+	printf("\n");
+}
+
+static void walk(uint32_t inode_num, uint32_t parent_num, const char* path, uint8_t file_type);
+
+// follows every entry of a directory, its blocks already claimed
+static void walk_dir(uint32_t dir_num, const FileSystemInode* dir, const BitRange* extents, const char* path) {
+	uint32_t entries = 0;
+	uint32_t tombstones = 0;
+	for (uint32_t index = 0; index < dir->extent_count; index++) {
+		if (EXTENT_IS_HOLE(extents[index])) {
+			problem("%s: directory has a hole", path);
+			continue;
+		}
+		for (uint32_t i = 0; i < extents[index].length; i++) {
+			FileSystemDirDataBlock block;
+			image_read_blocks(extents[index].start + i, &block, 1);
+			for (uint32_t slot = 0; slot < DIR_FILE_COUNT_MAX; slot++) {
+				FileSystemDirEntry* entry = &block.contents[slot];
+				if (entry->name[0] == '\0') {
+					tombstones += entry->inode_num == DIR_TOMBSTONE;
+					continue;
+				}
+				entries++;
+
+				char child_path[512];
+				entry->name[sizeof(entry->name) - 1] = '\0';
+				snprintf(child_path, sizeof(child_path), "%s/%s", (dir_num == 0) ? "" : path, entry->name);
+				if (entry->inode_num >= super.group_count * super.inodes_per_group) {
+					problem("%s: entry points past the inode table, at inode %u", child_path, entry->inode_num);
+					continue;
+				}
+				walk(entry->inode_num, dir_num, child_path, entry->file_type);
+			}
+		}
+	}
+	if (entries * sizeof(FileSystemDirEntry) != dir->size) {
+		problem("%s: directory holds %u entries, its size says %u", path, entries, dir->size / sizeof(FileSystemDirEntry));
+	}
+	if (tombstones != dir->dir_tombstones) {
+		problem("%s: directory holds %u tombstones, its inode says %u", path, tombstones, dir->dir_tombstones);
+	}
+}
+
+static void walk(uint32_t inode_num, uint32_t parent_num, const char* path, uint8_t file_type) {
+	uint32_t group = inode_num / super.inodes_per_group;
+	if (!test_bit(inode_bitmaps[group], inode_num % super.inodes_per_group)) {
+		problem("%s: inode %u is marked free", path, inode_num);
+	}
+	if (inode_reached[inode_num]) {
+		problem("%s: inode %u is reached a second time", path, inode_num);
+		return;
+	}
+	inode_reached[inode_num] = true;
+
+	FileSystemInode inode = read_inode(inode_num);
+	if (inode.file_type != file_type) {
+		problem("%s: inode %u has type %u, its directory entry says %u", path, inode_num, inode.file_type, file_type);
+	}
+	if (inode_num != 0) {
+		if (inode.parent_inode_num != parent_num) {
+			problem("%s: inode %u names inode %u as its parent, not %u", path, inode_num, inode.parent_inode_num, parent_num);
+		}
+		inode.name[sizeof(inode.name) - 1] = '\0';
+		const char* name = path;
+		for (const char* c = path; *c; c++) {
+			if (*c == '/') {
+				name = c + 1;
+			}
+		}
+		if (strcmp(inode.name, name) != 0) {
+			problem("%s: inode %u is named %s", path, inode_num, inode.name);
+		}
+	}
+	if (inode.file_type == FILE_TYPE_DIR) {
+		dirs_reached[group]++;
+	}
+
+	if (inode.flags & INODE_FLAG_INLINE) {
+		if (inode.size > INODE_INLINE_BYTES || inode.file_type == FILE_TYPE_DIR) {
+			problem("%s: inode %u can't hold its data inline", path, inode_num);
+		}
+		if (dumping) {
+			print_inode(path, inode_num, &inode, NULL);
+		}
+		return;
+	}
+
+	BitRange extents[INODE_EXTENTS_MAX];
+	if (!read_extents(path, &inode, extents)) {
+		return;
+	}
+	if (dumping) {
+		print_inode(path, inode_num, &inode, extents);
+	}
+	for (uint32_t index = 0; index < inode.extent_count; index++) {
+		BitRange extent = extents[index];
+		if (inode.flags & INODE_FLAG_COMPRESSED) {
+			extent.length &= ~CLUSTER_PACKED;
+		}
+		if (!EXTENT_IS_HOLE(extent) && !claim_blocks(path, extent)) {
+			return;
+		}
+	}
+	if (inode.file_type == FILE_TYPE_DIR) {
+		walk_dir(inode_num, &inode, extents, path);
+	}
+}
+
+// checks the counters and bitmaps of a group against what the walk found
+static uint32_t check_group(uint32_t group) {
+	FileSystemGroupDesc* desc = &groups[group];
+	uint32_t group_start = group * super.blocks_per_group;
+
+	uint32_t used_blocks = 0;
+	uint32_t unowned = 0;
+	uint32_t shared = 0;
+	uint8_t refcounts[REFCOUNT_TABLE_BLOCKS][BLOCK_BYTES];
+	image_read_blocks(desc->refcount_table, refcounts, REFCOUNT_TABLE_BLOCKS);
+	for (uint32_t index = 0; index < group_block_count(group); index++) {
+		uint32_t owners = block_owners[group_start + index];
+		uint8_t refcount = refcounts[index / REFCOUNTS_PER_BLOCK][index % REFCOUNTS_PER_BLOCK];
+		if (test_bit(block_bitmaps[group], index)) {
+			used_blocks++;
+			unowned += owners == 0;
+		}
+		if (refcount) {
+			shared++;
+		}
+		// the count holds the owners past the first
+		if (refcount != ((owners > 1) ? owners - 1 : 0)) {
+			problem("block %u is owned by %u files, its reference count says %u", group_start + index, owners, refcount + 1);
+		}
+	}
+	if (unowned) {
+		problem("group %u: %u blocks are marked used but no file owns them", group, unowned);
+	}
+	if (desc->free_blocks != group_block_count(group) - used_blocks) {
+		problem("group %u: %u blocks are free, its descriptor says %u", group, group_block_count(group) - used_blocks, desc->free_blocks);
+	}
+	if (desc->shared_blocks != shared) {
+		problem("group %u: %u blocks are shared, its descriptor says %u", group, shared, desc->shared_blocks);
+	}
+
+	uint32_t used_inodes = 0;
+	for (uint32_t index = 0; index < super.inodes_per_group; index++) {
+		if (!test_bit(inode_bitmaps[group], index)) {
+			continue;
+		}
+		used_inodes++;
+		if (!inode_reached[group * super.inodes_per_group + index]) {
+			problem("inode %u is marked used but no directory holds it", group * super.inodes_per_group + index);
+		}
+	}
+	if (desc->free_inodes != super.inodes_per_group - used_inodes) {
+		problem("group %u: %u inodes are free, its descriptor says %u", group, super.inodes_per_group - used_inodes, desc->free_inodes);
+	}
+	if (desc->dir_count != dirs_reached[group]) {
+		problem("group %u: %u directories, its descriptor says %u", group, dirs_reached[group], desc->dir_count);
+	}
+	return used_inodes;
+}
+
+uint32_t inspect_image(bool dump) {
+	dumping = dump;
+	problems = 0;
+	uint8_t block[BLOCK_BYTES];
+	image_read_blocks(0, block, 1);
+	memcpy(&super, block, sizeof(FileSystemSuper));
+	image_read_blocks(super.group_desc_start, groups, (super.group_count + GROUP_DESCS_PER_BLOCK - 1) / GROUP_DESCS_PER_BLOCK);
+
+	block_bitmaps = calloc(super.group_count, BLOCK_BYTES);
+	inode_bitmaps = calloc(super.group_count, BLOCK_BYTES);
+	block_owners = calloc(super.block_count, sizeof(uint16_t));
+	inode_reached = calloc(super.group_count * super.inodes_per_group, sizeof(bool));
+	memset(dirs_reached, 0, sizeof(dirs_reached));
+
+	if (dumping) {
+		printf("superblock: version %u, %u blocks of %u bytes in %u groups, %u inodes per group, %u in use\n",
+			super.version, super.block_count, BLOCK_BYTES, super.group_count, super.inodes_per_group, super.used_inodes);
+		printf("journal: %u blocks from block %u\n", super.journal_blocks, super.journal_start);
+	}
+	for (uint32_t group = 0; group < super.group_count; group++) {
+		FileSystemGroupDesc* desc = &groups[group];
+		image_read_blocks(desc->block_bitmap, block_bitmaps[group], 1);
+		image_read_blocks(desc->inode_bitmap, inode_bitmaps[group], 1);
+		// the superblock, descriptors, journal and the group's own metadata belong to no file
+		for (uint32_t block_num = group * super.blocks_per_group; block_num < desc->data_start; block_num++) {
+			block_owners[block_num] = 1;
+		}
+		if (dumping) {
+			printf("group %u: data from block %u, %u blocks free, %u inodes free, %u directories, %u blocks shared\n",
+				group, desc->data_start, desc->free_blocks, desc->free_inodes, desc->dir_count, desc->shared_blocks);
+		}
+	}
+
+	walk(0, 0, "/", FILE_TYPE_DIR);
+
+	uint32_t used_inodes = 0;
+	for (uint32_t group = 0; group < super.group_count; group++) {
+		used_inodes += check_group(group);
+	}
+	if (super.used_inodes != used_inodes) {
+		problem("%u inodes are in use, the superblock says %u", used_inodes, super.used_inodes);
+	}
+
+	free(block_bitmaps);
+	free(inode_bitmaps);
+	free(block_owners);
+	free(inode_reached);
+	return problems;
+}
@@ -0,0 +1,31 @@
+#ifndef YORHAFS_RENAME_H
+#define YORHAFS_RENAME_H
+
+// Forced in front of every kernel source built into yorhafs, and of the
+// yorhafs sources using the kernel's headers, so the kernel's syscalls and
+// string functions don't collide with the C library's on the host.
+#define close yorha_close
+#define fallocate yorha_fallocate
+#define fsync yorha_fsync
+#define ftruncate yorha_ftruncate
+#define memcpy yorha_memcpy
+#define memmove yorha_memmove
+#define memset yorha_memset
+#define mkdir yorha_mkdir
+#define mount yorha_mount
+#define open yorha_open
+#define read yorha_read
+#define readdir yorha_readdir
+#define rename yorha_rename
+#define shutdown yorha_shutdown
+#define stat yorha_stat
+#define strcat yorha_strcat
+#define strcmp yorha_strcmp
+#define strcpy yorha_strcpy
+#define strlen yorha_strlen
+#define sync yorha_sync
+#define umount yorha_umount
+#define unlink yorha_unlink
+#define write yorha_write
+
+#endif // YORHAFS_RENAME_H
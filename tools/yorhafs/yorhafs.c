@@ -0,0 +1,215 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <fs.h>
+#include <vfs.h>
+#include <journal.h>
+#include <string.h>
+#include "image.h"
+#include "yorhafs.h"
+
+// yorhafs: builds and checks YoRHa disk images on the host, running the
+// kernel's own file system code over an image file in place of the ATA disk.
+
+static void usage() {
+	fprintf(stderr,
+		"usage: yorhafs mkfs IMAGE [SIZE]            format IMAGE, created or resized to SIZE bytes (K, M or G suffix)\n"
+		"       yorhafs pack [-z] IMAGE HOST_DIR [DIR]  copy a host directory tree into DIR, / by default, -z compresses the files\n"
+		"       yorhafs fsck IMAGE                   check checksums and structure, exits 1 on problems\n"
+		"       yorhafs dump IMAGE                   print the superblock, groups and every file\n");
+	exit(2);
+}
+
+static uint64_t parse_size(const char* text) {
+	char* end;
+	uint64_t size = strtoull(text, &end, 10);
+	switch (*end) {
+		case 'G': size <<= 10; // fall through
+		case 'M': size <<= 10; // fall through
+		case 'K': size <<= 10; end++; break;
+	}
+	if (*end != '\0' || size == 0) {
+		fprintf(stderr, "yorhafs: bad size %s\n", text);
+		exit(2);
+	}
+	return size;
+}
+
+// mounts the image as the kernel would, replaying its journal, but never formats it
+static void mount_image(const char* path) {
+	if (!image_open(path, 0)) {
+		exit(2);
+	}
+	uint8_t block[BLOCK_BYTES];
+	image_read_blocks(0, block, 1);
+	FileSystemSuper* super = (FileSystemSuper*)block;
+	bool recognized = strcmp(super->format_indicator, "Yorha") == 0 && super->version == FS_VERSION && super->group_count <= FS_MAX_GROUPS;
+	if (recognized) {
+		image_read_blocks(super->journal_start, block, 1);
+		recognized = ((JournalHeader*)block)->magic == JOURNAL_MAGIC;
+	}
+	if (!recognized) {
+		fprintf(stderr, "yorhafs: %s: not a version %u YoRHa file system\n", path, FS_VERSION);
+		exit(2);
+	}
+	if (!initalize_file_system(false)) {
+		fprintf(stderr, "yorhafs: %s: %s\n", path, error_msg);
+		exit(2);
+	}
+}
+
+// syncs and checkpoints, the image then mounts without replay
+static void unmount_image() {
+	shutdown();
+	image_close();
+}
+
+static int mkfs(int argc, char** argv) {
+	if (argc < 1 || argc > 2) {
+		usage();
+	}
+	if (!image_open(argv[0], (argc == 2) ? parse_size(argv[1]) : 0)) {
+		return 2;
+	}
+	if (!initalize_file_system(true)) {
+		fprintf(stderr, "yorhafs: %s: %s\n", argv[0], error_msg);
+		image_close();
+		return 2;
+	}
+	unmount_image();
+	return 0;
+}
+
+static bool pack_compressed;
+static uint32_t packed_files;
+static uint64_t packed_bytes;
+static uint8_t pack_buffer[256 * 1024];
+
+static bool pack_failed(const char* path) {
+	fprintf(stderr, "yorhafs: %s: %s\n", path, error_msg);
+	return false;
+}
+
+static bool pack_entry(const char* host_path, const char* path, bool is_dir) {
+	const char* name = path;
+	for (const char* c = path; *c; c++) {
+		if (*c == '/') {
+			name = c + 1;
+		}
+	}
+	if (strlen(name) >= sizeof(((FileSystemInode*)0)->name)) {
+		fprintf(stderr, "yorhafs: %s: name longer than %u bytes\n", host_path, (uint32_t)sizeof(((FileSystemInode*)0)->name) - 1);
+		return false;
+	}
+	const char* rest;
+	if (strcmp(vfs_resolve(path, &rest)->ops->name, "disk") != 0) {
+		fprintf(stderr, "yorhafs: %s: lands on a %s mounted at boot, it would never reach the disk\n", path, vfs_resolve(path, &rest)->ops->name);
+		return false;
+	}
+
+	FileStat st;
+	bool exists = stat(path, &st) != -1;
+	if (is_dir) {
+		if (exists && st.file_type != FILE_TYPE_DIR) {
+			fprintf(stderr, "yorhafs: %s: a file is in the way of the directory\n", path);
+			return false;
+		}
+		return exists || mkdir(path) != -1 || pack_failed(path);
+	}
+
+	// files already there are replaced
+	if (exists && (st.file_type == FILE_TYPE_DIR || unlink(path) == -1)) {
+		fprintf(stderr, "yorhafs: %s: can't replace what is there\n", path);
+		return false;
+	}
+	int64_t fd = create(path);
+	if (fd == -1) {
+		return pack_failed(path);
+	}
+	if (pack_compressed && set_compression(fd, true) == -1) {
+		pack_failed(path);
+		close(fd);
+		return false;
+	}
+	int32_t file = host_file_open(host_path);
+	bool ok = file != -1;
+	int32_t count;
+	while (ok && (count = host_file_read(file, pack_buffer, sizeof(pack_buffer))) > 0) {
+		if (write(fd, pack_buffer, count) != (uint64_t)count) {
+			ok = pack_failed(path);
+		}
+		packed_bytes += count;
+	}
+	ok = ok && count == 0;
+	if (file != -1) {
+		host_file_close(file);
+	}
+	close(fd);
+	packed_files += ok;
+	return ok;
+}
+
+static int pack(int argc, char** argv) {
+	if (argc > 0 && strcmp(argv[0], "-z") == 0) {
+		pack_compressed = true;
+		argc--;
+		argv++;
+	}
+	if (argc < 2 || argc > 3) {
+		usage();
+	}
+	const char* dir = (argc == 3) ? argv[2] : "/";
+	mount_image(argv[0]);
+
+	FileStat st;
+	bool ok = true;
+	if (dir[0] != '/' || stat(dir, &st) == -1 || st.file_type != FILE_TYPE_DIR) {
+		fprintf(stderr, "yorhafs: %s: not a directory in the image\n", dir);
+		ok = false;
+	}
+	ok = ok && host_walk(argv[1], dir, pack_entry);
+	unmount_image();
+	printf("%u files, %llu bytes packed\n", packed_files, (unsigned long long)packed_bytes);
+	return ok ? 0 : 1;
+}
+
+static int fsck(int argc, char** argv) {
+	if (argc != 1) {
+		usage();
+	}
+	mount_image(argv[0]);
+	ScrubReport report;
+	scrub(&report); // syncs and checkpoints first, the image is then read past the cache
+	uint32_t problems = inspect_image(false);
+	unmount_image();
+	printf("%u blocks checked, %u checksum errors, %u problems\n", report.blocks_checked, report.errors, problems);
+	return (report.errors || problems) ? 1 : 0;
+}
+
+static int dump(int argc, char** argv) {
+	if (argc != 1) {
+		usage();
+	}
+	mount_image(argv[0]);
+	sync();
+	journal_checkpoint();
+	inspect_image(true);
+	unmount_image();
+	return 0;
+}
+
+int main(int argc, char** argv) {
+	if (argc < 2) {
+		usage();
+	}
+	if (strcmp(argv[1], "mkfs") == 0) {
+		return mkfs(argc - 2, argv + 2);
+	} else if (strcmp(argv[1], "pack") == 0) {
+		return pack(argc - 2, argv + 2);
+	} else if (strcmp(argv[1], "fsck") == 0) {
+		return fsck(argc - 2, argv + 2);
+	} else if (strcmp(argv[1], "dump") == 0) {
+		return dump(argc - 2, argv + 2);
+	}
+	usage();
+	return 2;
+}
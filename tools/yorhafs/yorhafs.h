@@ -0,0 +1,20 @@
+#ifndef YORHAFS_H
+#define YORHAFS_H
+
+#include <stdint.h>
+#include <stdbool.h>
+
+/**
+ * @brief Walks the checkpointed image from the root directory down and
+ * cross-checks it against the bitmaps, reference counts and counters.
+ *
+ * Reads the image past the kernel's cache, so the file system has to be
+ * synced and its journal checkpointed first. Checksums are left to `scrub`.
+ *
+ * @param dump Print the superblock, the groups and every file on the way,
+ *             instead of the problems found.
+ * @return The number of problems found.
+ */
+uint32_t inspect_image(bool dump);
+
+#endif // YORHAFS_H